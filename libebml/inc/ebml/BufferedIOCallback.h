@@ -0,0 +1,98 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version \$Id$
+*/
+#ifndef LIBEBML_BUFFEREDIOCALLBACK_H
+#define LIBEBML_BUFFEREDIOCALLBACK_H
+
+#include "IOCallback.h"
+
+#ifndef EBML_NO_READ
+
+START_LIBEBML_NAMESPACE
+
+/*!
+  \class BufferedIOCallback
+  \brief Reads another IOCallback in large blocks
+
+  Small reads and seeks within the buffer don't reach the input, and the
+  buffered data can be looked at in place with peek() and consume(), which
+  is how EbmlElement::FindNextElement scans for IDs and sizes.
+*/
+class EBML_DLL_API BufferedIOCallback : public IOCallback
+{
+public:
+  BufferedIOCallback(IOCallback & Input, size_t BufferSize = 64 * 1024);
+  ~BufferedIOCallback();
+
+  uint32 read(void *Buffer, size_t Size);
+
+  void setFilePointer(int64 Offset, seek_mode Mode=seek_beginning);
+
+  /*!
+    Writes go to the input at the current position, the buffer is dropped
+  */
+  size_t write(const void *Buffer, size_t Size);
+
+  uint64 getFilePointer() {return BufferPosition + DataStart;}
+
+  void close();
+
+  size_t peek(const binary *&Buffer, size_t Size);
+  void consume(size_t Size);
+
+protected:
+  /*!
+    Reads from the input until Size bytes are buffered from the file pointer
+    or the end of the input is reached
+  */
+  void Fill(size_t Size);
+  void Drop();
+
+  IOCallback & Input;
+  binary * Data;
+  size_t DataSize;
+  /*!
+    Position of the file pointer in Data, up to DataEnd
+  */
+  size_t DataStart;
+  size_t DataEnd;
+  /*!
+    Position of Data[0] in the input, the input is at BufferPosition + DataEnd
+  */
+  uint64 BufferPosition;
+};
+
+END_LIBEBML_NAMESPACE
+
+#endif // EBML_NO_READ
+
+#endif // LIBEBML_BUFFEREDIOCALLBACK_H
@@ -0,0 +1,95 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version \$Id$
+*/
+#ifndef LIBEBML_CRCIOCALLBACK_H
+#define LIBEBML_CRCIOCALLBACK_H
+
+#include "IOCallback.h"
+#include "EbmlCrc32.h"
+
+START_LIBEBML_NAMESPACE
+
+/*!
+  \class CrcIOCallback
+  \brief Computes the CRC-32 of everything written through it
+
+  The data is passed on to the output it was created with, or dropped when
+  there is none, so an element can be checksummed while it's rendered
+  instead of being rendered to memory first. The data goes to its own CRC,
+  or is added to a CRC that is being computed elsewhere.
+*/
+class EBML_DLL_API CrcIOCallback : public IOCallback
+{
+public:
+  CrcIOCallback(IOCallback * Output = NULL, EbmlCrc32 * Target = NULL);
+
+#ifndef EBML_NO_READ
+  uint32 read(void *Buffer, size_t Size);
+#endif
+
+  /*!
+    Seeking is passed on to the output, the CRC only covers the data
+    written in sequence
+  */
+  void setFilePointer(int64 Offset, seek_mode Mode=seek_beginning);
+
+  size_t write(const void *Buffer, size_t Size);
+
+  /*!
+    The buffers are checksummed one by one and passed on to the output together
+  */
+  size_t writev(const IOVector *Buffers, size_t Count);
+
+  uint64 getFilePointer();
+
+  void close();
+
+  /*!
+    Patched data would be counted twice, nested checksums are buffered instead
+  */
+  bool canOverwrite() {return false;}
+
+  /*!
+    \return The CRC-32 of the data written so far, the next write starts a new one
+  */
+  uint32 GetCrc32();
+
+protected:
+  IOCallback * Output;
+  uint64 Position;
+  EbmlCrc32 OwnCrc;
+  EbmlCrc32 & Crc;
+};
+
+END_LIBEBML_NAMESPACE
+
+#endif // LIBEBML_CRCIOCALLBACK_H
@@ -0,0 +1,111 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version $Id$
+*/
+#ifndef LIBEBML_ARENA_H
+#define LIBEBML_ARENA_H
+
+#include <vector>
+
+#include "EbmlTypes.h"
+
+START_LIBEBML_NAMESPACE
+
+/*!
+  \class EbmlArena
+  \brief Memory for EBML elements that all go away together
+
+  While an EbmlArena::Scope is alive, the small elements created by its thread
+  are cut from large chunks of the arena instead of being allocated one by one
+  on the heap. Deleting one runs its destructor and puts its memory on a free
+  list of its size, which the next element of that size reuses. The chunks
+  are freed with the arena.
+
+  \warning the arena must outlive the elements created in it, and only the
+  thread using the arena may create or delete them, while its scope is alive
+*/
+class EBML_DLL_API EbmlArena {
+  public:
+    EbmlArena(size_t aChunkSize = 64 * 1024);
+    /*!
+      \note elements still alive at this point are leaked along with the
+      chunks they live in, use GetElementCount() before to catch them
+    */
+    ~EbmlArena();
+
+    /*!
+      \class Scope
+      \brief Elements created by this thread go to the arena while it exists
+    */
+    class EBML_DLL_API Scope {
+      public:
+        Scope(EbmlArena & Arena);
+        ~Scope();
+
+      private:
+        EbmlArena * Previous;
+
+        Scope(const Scope &);
+        Scope & operator=(const Scope &);
+    };
+
+    /*!
+      \brief Memory for an element, from the arena of the current scope or from the heap
+      \return NULL if there is not enough memory
+    */
+    static void * Allocate(size_t Size);
+    /*!
+      \brief Release memory returned by Allocate(), wherever it comes from
+      \param Size the size given to Allocate(), 0 if not known in which case
+      arena memory is not reused until the arena goes away
+    */
+    static void Free(void * Ptr, size_t Size);
+
+    size_t GetElementCount() const {return ElementCount;}
+
+  private:
+    void * AllocateHere(size_t Size);
+    bool Owns(const void * Ptr) const;
+
+    std::vector<binary *> Chunks; ///< sorted by address
+    std::vector<void *> FreeLists; ///< one per size class, linked through the freed memory
+    size_t ChunkSize;
+    binary * Chunk; ///< the chunk being cut
+    size_t ChunkUsed;
+    size_t ElementCount; ///< allocations not freed yet
+
+    EbmlArena(const EbmlArena &);
+    EbmlArena & operator=(const EbmlArena &);
+};
+
+END_LIBEBML_NAMESPACE
+
+#endif // LIBEBML_ARENA_H
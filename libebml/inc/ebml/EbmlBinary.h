@@ -70,6 +70,7 @@ class EBML_DLL_API EbmlBinary : public EbmlElement {
 
     void SetBuffer(const binary *Buffer, const uint32 BufferSize) {
       Data = (binary *) Buffer;
+      bDataInPlace = false;
       SetSize_(BufferSize);
       SetValueIsSet();
     }
@@ -77,9 +78,10 @@ class EBML_DLL_API EbmlBinary : public EbmlElement {
     binary *GetBuffer() const {return Data;}
 
     void CopyBuffer(const binary *Buffer, const uint32 BufferSize) {
-      if (Data != NULL)
+      if (Data != NULL && !bDataInPlace)
         free(Data);
       Data = (binary *)malloc(BufferSize * sizeof(binary));
+      bDataInPlace = false;
       memcpy(Data, Buffer, BufferSize);
       SetSize_(BufferSize);
       SetValueIsSet();
@@ -93,12 +95,19 @@ class EBML_DLL_API EbmlBinary : public EbmlElement {
 
     bool operator==(const EbmlBinary & ElementToCompare) const;
 
+    /*!
+      \return True when the data was read in place from the IOCallback
+      (see IOCallback::readInPlace), it is read-only and not owned
+    */
+    bool IsDataInPlace() const {return bDataInPlace;}
+
 #if defined(EBML_STRICT_API)
   private:
 #else
   protected:
 #endif
     binary *Data; // the binary data inside the element
+    bool bDataInPlace; // Data belongs to the IOCallback it was read from
 };
 
 END_LIBEBML_NAMESPACE
@@ -85,6 +85,23 @@ DECLARE_EBML_BINARY(EbmlCrc32)
 
     void ForceCrc32(uint32 NewValue) { m_crc_final = NewValue; SetValueIsSet();}
 
+    /*!
+      Large buffers use carry-less multiplication (PCLMULQDQ) when the CPU
+      has it and slice-by-8 tables otherwise, the CPU is checked once
+      \return True if the PCLMULQDQ path is in use
+    */
+    static bool HasClmul();
+
+#ifdef EBML_CRC32_BENCH
+    /*!
+      \brief UpdateCRC() with the PCLMULQDQ path left out or not, for benchmarks and tests
+      \note the path is only taken when HasClmul() is true
+    */
+    static uint32 BenchUpdateCRC(uint32 crc, const binary *input, uint32 length, bool bClmul) {
+      return UpdateCRC(crc, input, length, bClmul);
+    }
+#endif
+
 #if defined(EBML_STRICT_API)
     private:
 #else
@@ -92,6 +109,8 @@ DECLARE_EBML_BINARY(EbmlCrc32)
 #endif
     void ResetCRC();
     void UpdateByte(binary b);
+    static uint32 UpdateCRC(uint32 crc, const binary *input, uint32 length);
+    static uint32 UpdateCRC(uint32 crc, const binary *input, uint32 length, bool bClmul);
 
     static const uint32 m_tab[256];
     uint32 m_crc;
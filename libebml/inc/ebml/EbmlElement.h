@@ -34,6 +34,8 @@
 #ifndef LIBEBML_ELEMENT_H
 #define LIBEBML_ELEMENT_H
 
+#include <new>
+
 #include "EbmlTypes.h"
 #include "EbmlId.h"
 #include "IOCallback.h"
@@ -372,6 +374,14 @@ class EBML_DLL_API EbmlElement {
     EbmlElement(uint64 aDefaultSize, bool bValueSet = false);
     virtual ~EbmlElement();
 
+    /*!
+      \brief elements are allocated in the current EbmlArena, if any
+    */
+    static void * operator new(size_t Size);
+    static void * operator new(size_t Size, const std::nothrow_t &) throw();
+    static void operator delete(void * Ptr, size_t Size);
+    static void operator delete(void * Ptr, const std::nothrow_t &) throw();
+
     /// Set the minimum length that will be used to write the element size (-1 = optimal)
     void SetSizeLength(int NewSizeLength) {SizeLength = NewSizeLength;}
     int GetSizeLength() const {return SizeLength;}
@@ -497,6 +507,17 @@ class EBML_DLL_API EbmlElement {
         inline void SetSizeIsFinite(bool Set = true) {bSizeIsFinite = Set;}
         inline uint64 GetSizePosition() const {return SizePosition;}
 
+    /*!
+      \brief the size of the element and its children was just computed for
+      the render in progress, the next RenderHead() or master RenderData() uses it as is
+    */
+    static void SetSizeIsUpToDate(EbmlElement & Element) {Element.bSizeIsUpToDate = true;}
+    bool TakeSizeIsUpToDate() {
+      bool Result = bSizeIsUpToDate;
+      bSizeIsUpToDate = false;
+      return Result;
+    }
+
 #if defined(EBML_STRICT_API)
   private:
 #endif
@@ -509,6 +530,7 @@ class EBML_DLL_API EbmlElement {
     bool bValueIsSet;
     bool DefaultIsSet;
     bool bLocked;
+    bool bSizeIsUpToDate;
 };
 
 END_LIBEBML_NAMESPACE
@@ -38,6 +38,8 @@
 
 #include <lgpl/stdstring.h>
 #include <vector>
+#include <map>
+#include <functional>
 
 #include "EbmlTypes.h"
 #include "EbmlElement.h"
@@ -51,6 +53,7 @@
 START_LIBEBML_NAMESPACE
 
 const bool bChecksumUsedByDefault = false;
+const size_t IdIndexMinimumSize = 32; ///< masters with fewer children are searched without the ID index
 
 /*!
     \class EbmlMaster
@@ -91,6 +94,17 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
 
     /*!
       \brief find the element corresponding to the ID of the element, NULL if not found
+      \note masters with many children keep an index of them by ID for the Find
+      methods. It is only built and updated by non-const methods: the ones adding
+      children, Read(), Sort() and the non-const Find methods, while the ones
+      changing the list otherwise (including the non-const GetElementList()) drop
+      it until the next of those. The const Find methods use it when it is there
+      and search the list otherwise, so they don't change the master and several
+      threads may use them on the same master as long as none of them changes
+      it. Children read with SCOPE_LAZY_DATA are the exception: they are read on
+      first access, even through const methods, so such a master can only be used
+      by one thread at a time until ListSize() was called once. Elements replaced
+      through iterators are not seen by the index.
     */
     EbmlElement *FindElt(const EbmlCallbacks & Callbacks) const;
     /*!
@@ -114,6 +128,10 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
 
     /*!
       \brief Read the data and keep the known children
+      \note with SCOPE_LAZY_DATA only the IDs and sizes of the children are read,
+      each one is read the first time it is looked for with the Find methods, and
+      all of them once the list is accessed otherwise. The input has to stay open
+      and must not be written to until then.
     */
 #ifndef EBML_NO_READ
     void Read(EbmlStream & inDataStream, const EbmlSemanticContext & Context, int & UpperEltFound, EbmlElement * & FoundElt, bool AllowDummyElt, ScopeMode ReadFully = SCOPE_ALL_DATA);
@@ -124,23 +142,24 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
     */
     void Sort();
 
-    size_t ListSize() const {return ElementList.size();}
-    std::vector<EbmlElement *> const &GetElementList() const {return ElementList;}
-    std::vector<EbmlElement *> &GetElementList() {return ElementList;}
+    size_t ListSize() const {ReadLazy(); return ElementList.size();}
+    std::vector<EbmlElement *> const &GetElementList() const {ReadLazy(); return ElementList;}
+    std::vector<EbmlElement *> &GetElementList() {ReadLazy(); InvalidateIdIndex(); return ElementList;}
 
-        inline EBML_MASTER_ITERATOR begin() {return ElementList.begin();}
-        inline EBML_MASTER_ITERATOR end() {return ElementList.end();}
-        inline EBML_MASTER_RITERATOR rbegin() {return ElementList.rbegin();}
-        inline EBML_MASTER_RITERATOR rend() {return ElementList.rend();}
-        inline EBML_MASTER_CONST_ITERATOR begin() const {return ElementList.begin();}
-        inline EBML_MASTER_CONST_ITERATOR end() const {return ElementList.end();}
-        inline EBML_MASTER_CONST_RITERATOR rbegin() const {return ElementList.rbegin();}
-        inline EBML_MASTER_CONST_RITERATOR rend() const {return ElementList.rend();}
+        inline EBML_MASTER_ITERATOR begin() {ReadLazy(); return ElementList.begin();}
+        inline EBML_MASTER_ITERATOR end() {ReadLazy(); return ElementList.end();}
+        inline EBML_MASTER_RITERATOR rbegin() {ReadLazy(); return ElementList.rbegin();}
+        inline EBML_MASTER_RITERATOR rend() {ReadLazy(); return ElementList.rend();}
+        inline EBML_MASTER_CONST_ITERATOR begin() const {ReadLazy(); return ElementList.begin();}
+        inline EBML_MASTER_CONST_ITERATOR end() const {ReadLazy(); return ElementList.end();}
+        inline EBML_MASTER_CONST_RITERATOR rbegin() const {ReadLazy(); return ElementList.rbegin();}
+        inline EBML_MASTER_CONST_RITERATOR rend() const {ReadLazy(); return ElementList.rend();}
 
-    EbmlElement * operator[](unsigned int position) {return ElementList[position];}
-    const EbmlElement * operator[](unsigned int position) const {return ElementList[position];}
+    EbmlElement * operator[](unsigned int position) {ReadLazy(); return ElementList[position];}
+    const EbmlElement * operator[](unsigned int position) const {ReadLazy(); return ElementList[position];}
 
     bool IsDefaultValue() const {
+      ReadLazy();
       return (ElementList.size() == 0);
     }
     virtual bool IsMaster() const {return true;}
@@ -161,7 +180,7 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
     /*!
       \brief remove all elements, even the mandatory ones
     */
-    void RemoveAll() {ElementList.clear();}
+    void RemoveAll() {ElementList.clear(); InvalidateIdIndex(); DropLazy();}
 
     /*!
       \brief facility for Master elements to write only the head and force the size later
@@ -200,6 +219,90 @@ class EBML_DLL_API EbmlMaster : public EbmlElement {
       \brief Add all the mandatory elements to the list
     */
     bool ProcessMandatory();
+
+    /*!
+      \brief Build the ID index if the master is large enough to need it
+    */
+    void BuildIdIndex();
+    void AddToIdIndex(EbmlElement & element, size_t Position);
+    void InvalidateIdIndex() {
+      if (bIdIndexValid) {
+        IdIndex.clear();
+        IdIndexPlaces.clear();
+        bIdIndexValid = false;
+      }
+    }
+
+    /*!
+      \brief a child with its place in the list, sorted by ID then place
+    */
+    struct IdIndexEntry {
+      uint64 Key;
+      size_t Position;
+      EbmlElement * Element;
+      bool operator<(const IdIndexEntry & Other) const {
+        return (Key != Other.Key) ? (Key < Other.Key) : (Position < Other.Position);
+      }
+    };
+    /*!
+      \brief the place of a child in the list, sorted by child then place
+    */
+    struct IdIndexPlace {
+      const EbmlElement * Element;
+      size_t Position;
+      bool operator<(const IdIndexPlace & Other) const {
+        return (Element != Other.Element) ? std::less<const EbmlElement *>()(Element, Other.Element) : (Position < Other.Position);
+      }
+    };
+
+    /*!
+      \brief children by ID, and where to find each one in it
+      \note the list only grows at the end between two builds, so the places of
+      the children already in the index stay right
+    */
+    std::vector<IdIndexEntry> IdIndex;
+    std::vector<IdIndexPlace> IdIndexPlaces;
+    bool bIdIndexValid;
+
+    /*!
+      \brief where a child not read yet lies in the input, with its head
+      \note the lazy read state is there with EBML_NO_READ too, so that the
+      class has the same layout whatever the build
+    */
+    struct LazyChild {
+      uint64 Position;
+      uint64 Size;
+    };
+
+    /*!
+      \brief Note the children of a master read with SCOPE_LAZY_DATA
+      \return false when they have to be read right away
+    */
+    bool FindLazyChildren(IOCallback & input);
+    /*!
+      \brief Read the children not read yet, all of them or only the ones with that ID
+    */
+    void ReadLazyChildren(const EbmlId * Id);
+    EbmlElement *ReadLazyChild(EbmlStream & inDataStream, const LazyChild & Child);
+    void ReadLazy() const {
+      if (!LazyChildren.empty())
+        const_cast<EbmlMaster *>(this)->ReadLazyChildren(NULL);
+    }
+    void ReadLazy(const EbmlId & Id) const {
+      if (!LazyChildren.empty())
+        const_cast<EbmlMaster *>(this)->ReadLazyChildren(&Id);
+    }
+    void DropLazy() {
+      LazyChildren.clear();
+      LazyInput = NULL;
+    }
+
+    /*!
+      \brief children not read yet by ID, in file order
+    */
+    std::map<uint64, std::vector<LazyChild> > LazyChildren;
+    IOCallback * LazyInput;
+    bool bLazyDummy;
 };
 
 ///< \todo add a restriction to only elements legal in the context
@@ -64,7 +64,8 @@ typedef Endian<bits80,big_endian>    big_80bits;
 enum ScopeMode {
   SCOPE_PARTIAL_DATA = 0,
   SCOPE_ALL_DATA,
-  SCOPE_NO_DATA
+  SCOPE_NO_DATA,
+  SCOPE_LAZY_DATA ///< masters only note where their children are, they are read when looked for
 };
 
 END_LIBEBML_NAMESPACE
@@ -50,6 +50,13 @@ enum seek_mode
   ,seek_current=SEEK_CUR
 };
 
+// One of the buffers written in sequence by IOCallback::writev()
+struct IOVector
+{
+  const void * Buffer;
+  size_t       Size;
+};
+
 class EBML_DLL_API IOCallback
 {
 public:
@@ -71,6 +78,11 @@ public:
   // This callback just works like its read pendant. It returns the number of bytes written.
   virtual size_t write(const void*Buffer,size_t Size)=0;
 
+  // Writes Count buffers one after the other and returns the number of bytes
+  // written. Callbacks that can take them in one go should override this, by
+  // default each buffer is written on its own.
+  virtual size_t writev(const IOVector*Buffers,size_t Count);
+
   // Although the position is always positive, the return value of this callback is signed to
   // easily allow negative values for returning errors. When an error occurs, the implementor
   // should return -1 and the file pointer otherwise.
@@ -83,6 +95,28 @@ public:
   // should be thrown.
   virtual void close()=0;
 
+  // Returns true when data already written can be written again by seeking back
+  // to it, so that a value known only later (like a CRC-32) can be patched in.
+  // The file pointer has to be set back to the end afterwards.
+  virtual bool canOverwrite(){return false;}
+
+  // The read-side hooks below are declared with EBML_NO_READ too, so that the
+  // vtable stays the same whatever the build.
+  //
+  // Buffered callbacks can show the data at the file pointer without reading it.
+  // Buffer is set to the data and the number of bytes available is returned, at
+  // least Size unless the end of the file comes first. The file pointer doesn't
+  // move. Callbacks without a buffer return 0 and the data has to be read.
+  virtual size_t peek(const binary *&Buffer, size_t /* Size */){Buffer=NULL; return 0;}
+
+  // Moves the file pointer over data seen with peek()
+  virtual void consume(size_t Size){setFilePointer(Size,seek_current);}
+
+  // Callbacks that hold the whole file in memory return the Size bytes at the
+  // file pointer in place and move the file pointer after them, the data stays
+  // valid as long as the callback. Others return NULL and the data has to be read.
+  virtual const binary *readInPlace(size_t /* Size */){return NULL;}
+
 
   // The readFully is made virtual to allow derived classes to use another
   // implementation for this method, which e.g. does not read any data
@@ -95,6 +129,8 @@ public:
 
   void writeFully(const void*Buffer,size_t Size);
 
+  void writeFully(const IOVector*Buffers,size_t Count);
+
   template<class STRUCT> void writeStruct(const STRUCT&Struct){writeFully(&Struct,sizeof(Struct));}
 };
 
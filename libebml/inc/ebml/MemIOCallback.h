@@ -70,6 +70,11 @@ public:
   */
   size_t write(const void *Buffer, size_t Size);
 
+  /*!
+    Grows the buffer once for all the data
+  */
+  size_t writev(const IOVector *Buffers, size_t Count);
+
   /*!
     Although the position is always positive, the return value of this callback is signed to
     easily allow negative values for returning errors. When an error occurs, the implementor
@@ -86,6 +91,8 @@ public:
   */
   void close() {};
 
+  bool canOverwrite() {return true;};
+
   binary *GetDataBuffer() const {return dataBuffer;};
   uint64 GetDataBufferSize() {return dataBufferTotalSize;};
   void SetDataBufferSize(uint64 newDataBufferSize) {dataBufferTotalSize = newDataBufferSize;};
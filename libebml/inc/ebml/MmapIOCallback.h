@@ -0,0 +1,95 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version \$Id$
+*/
+#ifndef LIBEBML_MMAPIOCALLBACK_H
+#define LIBEBML_MMAPIOCALLBACK_H
+
+#include "IOCallback.h"
+
+#if !defined(EBML_NO_READ) && !defined(_WIN32)
+
+START_LIBEBML_NAMESPACE
+
+/*!
+  \class MmapIOCallback
+  \brief Reads a file mapped in memory
+
+  The whole file is mapped read-only. Binary elements and blocks read
+  through it point into the mapping instead of copying their payload, so
+  they must not be modified and must not outlive the callback.
+
+  The range after the file pointer is requested from the disk ahead of
+  time, following the parser as it reads clusters or seeks over them.
+*/
+class EBML_DLL_API MmapIOCallback : public IOCallback
+{
+public:
+  MmapIOCallback(const char *Path, size_t ReadAhead = 8 * 1024 * 1024);
+  ~MmapIOCallback();
+
+  uint32 read(void *Buffer, size_t Size);
+
+  void setFilePointer(int64 Offset, seek_mode Mode=seek_beginning);
+
+  /*!
+    The file is read-only, nothing is written
+  */
+  size_t write(const void *Buffer, size_t Size);
+
+  uint64 getFilePointer() {return Position;}
+
+  void close();
+
+  size_t peek(const binary *&Buffer, size_t Size);
+  void consume(size_t Size);
+  const binary *readInPlace(size_t Size);
+
+protected:
+  /*!
+    Makes sure the ReadAhead bytes after Size bytes from the file pointer
+    have been asked for
+  */
+  void Advise(size_t Size);
+
+  binary * Base;
+  uint64 Length;
+  uint64 Position;
+  size_t ReadAhead;
+  uint64 AdviseStart;
+  uint64 AdviseEnd;
+};
+
+END_LIBEBML_NAMESPACE
+
+#endif // !EBML_NO_READ && !_WIN32
+
+#endif // LIBEBML_MMAPIOCALLBACK_H
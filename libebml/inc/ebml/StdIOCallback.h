@@ -94,6 +94,8 @@ class EBML_DLL_API StdIOCallback:public IOCallback
   // library, this is equivalent to calling fclose. When the close is not successful, an exception
   // should be thrown.
   virtual void close();
+
+  virtual bool canOverwrite(){return true;}
 };
 
 END_LIBEBML_NAMESPACE
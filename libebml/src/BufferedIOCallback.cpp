@@ -0,0 +1,190 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version \$Id$
+*/
+
+#include <cstring>
+
+#include "ebml/BufferedIOCallback.h"
+
+#ifndef EBML_NO_READ
+
+START_LIBEBML_NAMESPACE
+
+BufferedIOCallback::BufferedIOCallback(IOCallback & Input, size_t BufferSize)
+  :Input(Input)
+  ,DataSize(BufferSize)
+  ,DataStart(0)
+  ,DataEnd(0)
+{
+  // an ID and its coded size, up to 12 bytes, have to fit for peek()
+  if (DataSize < 16)
+    DataSize = 16;
+  Data = new binary[DataSize];
+  BufferPosition = Input.getFilePointer();
+}
+
+BufferedIOCallback::~BufferedIOCallback()
+{
+  delete [] Data;
+}
+
+void BufferedIOCallback::Drop()
+{
+  BufferPosition += DataEnd;
+  DataStart = 0;
+  DataEnd = 0;
+}
+
+void BufferedIOCallback::Fill(size_t Size)
+{
+  if (Size > DataSize)
+    Size = DataSize;
+
+  if (DataStart + Size > DataSize) {
+    // move what is left to the front
+    memmove(Data, Data + DataStart, DataEnd - DataStart);
+    BufferPosition += DataStart;
+    DataEnd -= DataStart;
+    DataStart = 0;
+  }
+
+  while (DataEnd - DataStart < Size) {
+    uint32 Read = Input.read(Data + DataEnd, DataSize - DataEnd);
+    if (Read == 0)
+      break;
+    DataEnd += Read;
+  }
+}
+
+uint32 BufferedIOCallback::read(void *Buffer, size_t Size)
+{
+  binary * Dest = static_cast<binary *>(Buffer);
+  size_t Result = 0;
+
+  while (Size != 0) {
+    if (DataStart == DataEnd) {
+      Drop();
+      if (Size >= DataSize) {
+        // large reads skip the buffer, the input is at the file pointer
+        uint32 Read = Input.read(Dest, Size);
+        BufferPosition += Read;
+        return uint32(Result + Read);
+      }
+      Fill(Size);
+      if (DataStart == DataEnd)
+        break;
+    }
+
+    size_t Copy = DataEnd - DataStart;
+    if (Copy > Size)
+      Copy = Size;
+    memcpy(Dest, Data + DataStart, Copy);
+    DataStart += Copy;
+    Dest += Copy;
+    Size -= Copy;
+    Result += Copy;
+  }
+
+  return uint32(Result);
+}
+
+void BufferedIOCallback::setFilePointer(int64 Offset, seek_mode Mode)
+{
+  uint64 Position;
+
+  switch (Mode) {
+    case seek_beginning:
+      Position = Offset;
+      break;
+    case seek_current:
+      Position = getFilePointer() + Offset;
+      break;
+    default:
+      Input.setFilePointer(Offset, Mode);
+      BufferPosition = Input.getFilePointer();
+      DataStart = 0;
+      DataEnd = 0;
+      return;
+  }
+
+  if (Position >= BufferPosition && Position <= BufferPosition + DataEnd) {
+    DataStart = size_t(Position - BufferPosition);
+    return;
+  }
+
+  Input.setFilePointer(Position);
+  BufferPosition = Position;
+  DataStart = 0;
+  DataEnd = 0;
+}
+
+size_t BufferedIOCallback::write(const void *Buffer, size_t Size)
+{
+  uint64 Position = getFilePointer();
+
+  if (DataStart != DataEnd)
+    Input.setFilePointer(Position);
+  size_t Result = Input.write(Buffer, Size);
+
+  BufferPosition = Position + Result;
+  DataStart = 0;
+  DataEnd = 0;
+  return Result;
+}
+
+void BufferedIOCallback::close()
+{
+  DataStart = 0;
+  DataEnd = 0;
+  Input.close();
+}
+
+size_t BufferedIOCallback::peek(const binary *&Buffer, size_t Size)
+{
+  if (DataEnd - DataStart < Size)
+    Fill(Size);
+
+  Buffer = Data + DataStart;
+  return DataEnd - DataStart;
+}
+
+void BufferedIOCallback::consume(size_t Size)
+{
+  if (Size <= DataEnd - DataStart)
+    DataStart += Size;
+  else
+    setFilePointer(Size, seek_current);
+}
+
+END_LIBEBML_NAMESPACE
+
+#endif // EBML_NO_READ
@@ -0,0 +1,117 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version \$Id$
+*/
+
+#include "ebml/CrcIOCallback.h"
+
+START_LIBEBML_NAMESPACE
+
+CrcIOCallback::CrcIOCallback(IOCallback * Output, EbmlCrc32 * Target)
+  :Output(Output)
+  ,Position(0)
+  ,Crc((Target != NULL) ? *Target : OwnCrc)
+{
+}
+
+#ifndef EBML_NO_READ
+uint32 CrcIOCallback::read(void *Buffer, size_t Size)
+{
+  if (Output == NULL)
+    return 0;
+  return Output->read(Buffer, Size);
+}
+#endif
+
+void CrcIOCallback::setFilePointer(int64 Offset, seek_mode Mode)
+{
+  if (Output != NULL) {
+    Output->setFilePointer(Offset, Mode);
+    return;
+  }
+
+  switch (Mode) {
+    case seek_beginning:
+      Position = Offset;
+      break;
+    case seek_current:
+    case seek_end:
+      Position += Offset;
+      break;
+  }
+}
+
+size_t CrcIOCallback::write(const void *Buffer, size_t Size)
+{
+  Crc.Update(static_cast<const binary *>(Buffer), (uint32)Size);
+
+  if (Output != NULL)
+    return Output->write(Buffer, Size);
+
+  Position += Size;
+  return Size;
+}
+
+size_t CrcIOCallback::writev(const IOVector *Buffers, size_t Count)
+{
+  size_t Size = 0;
+  for (size_t i=0; i<Count; i++) {
+    Crc.Update(static_cast<const binary *>(Buffers[i].Buffer), (uint32)Buffers[i].Size);
+    Size += Buffers[i].Size;
+  }
+
+  if (Output != NULL)
+    return Output->writev(Buffers, Count);
+
+  Position += Size;
+  return Size;
+}
+
+uint64 CrcIOCallback::getFilePointer()
+{
+  if (Output != NULL)
+    return Output->getFilePointer();
+  return Position;
+}
+
+void CrcIOCallback::close()
+{
+  if (Output != NULL)
+    Output->close();
+}
+
+uint32 CrcIOCallback::GetCrc32()
+{
+  Crc.Finalize();
+  return Crc.GetCrc32();
+}
+
+END_LIBEBML_NAMESPACE
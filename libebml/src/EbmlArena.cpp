@@ -0,0 +1,161 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version $Id$
+*/
+
+#include <new>
+#include <algorithm>
+#include <functional>
+
+#include "ebml/EbmlArena.h"
+
+#ifdef _MSC_VER
+#define EBML_THREAD_LOCAL __declspec(thread)
+#else
+#define EBML_THREAD_LOCAL __thread
+#endif
+
+START_LIBEBML_NAMESPACE
+
+/*!
+  \brief allocations are rounded up to this, it keeps them aligned and is the size step of the free lists
+*/
+static const size_t ArenaAlign = 16;
+/*!
+  \brief bigger allocations, which are rare, go to the heap
+*/
+static const size_t ArenaMaxSize = 1024;
+
+static EBML_THREAD_LOCAL EbmlArena * CurrentArena = NULL;
+
+EbmlArena::EbmlArena(size_t aChunkSize)
+  :FreeLists(ArenaMaxSize / ArenaAlign, NULL)
+  ,ChunkSize(aChunkSize)
+  ,Chunk(NULL)
+  ,ChunkUsed(0)
+  ,ElementCount(0)
+{
+}
+
+EbmlArena::~EbmlArena()
+{
+  if (ElementCount != 0)
+    return; // leak rather than leave them pointing to freed memory
+
+  for (size_t Index = 0; Index < Chunks.size(); Index++)
+    delete [] Chunks[Index];
+}
+
+EbmlArena::Scope::Scope(EbmlArena & Arena)
+  :Previous(CurrentArena)
+{
+  CurrentArena = &Arena;
+}
+
+EbmlArena::Scope::~Scope()
+{
+  CurrentArena = Previous;
+}
+
+void * EbmlArena::AllocateHere(size_t Size)
+{
+  if (Size > ArenaMaxSize || Size > ChunkSize)
+    return NULL;
+
+  // rounded up, so each size class only ever holds blocks of its own size
+  Size = (Size + ArenaAlign - 1) & ~(ArenaAlign - 1);
+  void * & FreeList = FreeLists[Size / ArenaAlign - 1];
+  if (FreeList != NULL) {
+    void * Result = FreeList;
+    FreeList = *static_cast<void **>(Result);
+    ElementCount++;
+    return Result;
+  }
+
+  if (Chunk == NULL || ChunkUsed + Size > ChunkSize) {
+    // the end of the previous chunk is lost, less than ArenaMaxSize
+    Chunk = new (std::nothrow) binary[ChunkSize];
+    if (Chunk == NULL)
+      return NULL;
+    Chunks.insert(std::upper_bound(Chunks.begin(), Chunks.end(), Chunk, std::less<binary *>()), Chunk);
+    ChunkUsed = 0;
+  }
+
+  void * Result = Chunk + ChunkUsed;
+  ChunkUsed += Size;
+  ElementCount++;
+  return Result;
+}
+
+bool EbmlArena::Owns(const void * Ptr) const
+{
+  binary * Where = static_cast<binary *>(const_cast<void *>(Ptr));
+  std::vector<binary *>::const_iterator Next = std::upper_bound(Chunks.begin(), Chunks.end(), Where, std::less<binary *>());
+  if (Next == Chunks.begin())
+    return false;
+  --Next;
+  return std::less<binary *>()(Where, *Next + ChunkSize);
+}
+
+void * EbmlArena::Allocate(size_t Size)
+{
+  if (CurrentArena != NULL) {
+    void * Result = CurrentArena->AllocateHere(Size);
+    if (Result != NULL)
+      return Result;
+  }
+
+  return ::operator new(Size, std::nothrow);
+}
+
+void EbmlArena::Free(void * Ptr, size_t Size)
+{
+  if (Ptr == NULL)
+    return;
+
+  // elements of the arena are only deleted while its scope is alive, big
+  // ones and the ones of other threads or from before the scope are on the heap
+  EbmlArena * Arena = CurrentArena;
+  if (Arena == NULL || Size > ArenaMaxSize || !Arena->Owns(Ptr)) {
+    ::operator delete(Ptr);
+    return;
+  }
+
+  Arena->ElementCount--;
+  if (Size != 0) {
+    Size = (Size + ArenaAlign - 1) & ~(ArenaAlign - 1);
+    void * & FreeList = Arena->FreeLists[Size / ArenaAlign - 1];
+    *static_cast<void **>(Ptr) = FreeList;
+    FreeList = Ptr;
+  }
+}
+
+END_LIBEBML_NAMESPACE
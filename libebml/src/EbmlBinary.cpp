@@ -43,11 +43,12 @@
 START_LIBEBML_NAMESPACE
 
 EbmlBinary::EbmlBinary()
-  :EbmlElement(0, false), Data(NULL)
+  :EbmlElement(0, false), Data(NULL), bDataInPlace(false)
 {}
 
 EbmlBinary::EbmlBinary(const EbmlBinary & ElementToClone)
   :EbmlElement(ElementToClone)
+  ,bDataInPlace(false)
 {
   if (ElementToClone.Data == NULL)
     Data = NULL;
@@ -59,7 +60,7 @@ EbmlBinary::EbmlBinary(const EbmlBinary & ElementToClone)
 }
 
 EbmlBinary::~EbmlBinary(void) {
-  if(Data)
+  if(Data && !bDataInPlace)
     free(Data);
 }
 
@@ -84,14 +85,24 @@ uint64 EbmlBinary::UpdateSize(bool /* bWithDefault */, bool /* bForceRender */)
 #ifndef EBML_NO_READ
 filepos_t EbmlBinary::ReadData(IOCallback & input, ScopeMode ReadFully)
 {
-  if (Data != NULL)
+  if (Data != NULL && !bDataInPlace)
     free(Data);
+  bDataInPlace = false;
 
   if (ReadFully == SCOPE_NO_DATA || !GetSize()) {
     Data = NULL;
     return GetSize();
   }
 
+  // no copy when the data is already in memory
+  const binary *InPlace = input.readInPlace(GetSize());
+  if (InPlace != NULL) {
+    Data = const_cast<binary *>(InPlace);
+    bDataInPlace = true;
+    SetValueIsSet();
+    return GetSize();
+  }
+
   Data = (binary *)malloc(GetSize());
   if (Data == NULL)
     throw CRTError(std::string("Error allocating data"));
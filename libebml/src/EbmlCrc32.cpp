@@ -36,7 +36,7 @@
 */
 #include "ebml/EbmlCrc32.h"
 #include "ebml/EbmlContexts.h"
-#include "ebml/MemIOCallback.h"
+#include "ebml/CrcIOCallback.h"
 
 #ifdef WORDS_BIGENDIAN
 # define CRC32_INDEX(c) (c >> 24)
@@ -48,6 +48,25 @@
 
 const uint32 CRC32_NEGL = 0xffffffffL;
 
+// below this the PCLMULQDQ setup and reduction cost more than they save
+#define CRC32_CLMUL_MINIMUM 64
+
+// below this the alignment loop and the 8 KB of slice tables cost more than
+// a byte at a time
+#define CRC32_SLICE_MINIMUM 16
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define EBML_CRC32_CLMUL 1
+# define CRC32_CLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+# include <cpuid.h>
+# include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+# define EBML_CRC32_CLMUL 1
+# define CRC32_CLMUL_TARGET
+# include <intrin.h>
+# include <immintrin.h>
+#endif
+
 START_LIBEBML_NAMESPACE
 
 DEFINE_EBML_CLASS_GLOBAL(EbmlCrc32, 0xBF, 1, "EBMLCrc32\0ratamadabapa");
@@ -162,6 +181,198 @@ const uint32 EbmlCrc32::m_tab[] = {
 #endif
 };
 
+#ifndef WORDS_BIGENDIAN
+// crc32_slice[k][i] is the CRC of byte i followed by k zero bytes,
+// crc32_slice[0] is the same as m_tab
+static uint32 crc32_slice[8][256];
+
+static struct Crc32SliceInit {
+  Crc32SliceInit() {
+    for (unsigned int i = 0; i < 256; i++) {
+      uint32 c = i;
+      for (unsigned int j = 0; j < 8; j++)
+        c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+      crc32_slice[0][i] = c;
+    }
+    for (unsigned int i = 0; i < 256; i++)
+      for (unsigned int k = 1; k < 8; k++)
+        crc32_slice[k][i] = crc32_slice[0][crc32_slice[k-1][i] & 0xff] ^ (crc32_slice[k-1][i] >> 8);
+  }
+} crc32_slice_init;
+#endif
+
+#ifdef EBML_CRC32_CLMUL
+static bool Crc32HasClmul()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return ((info[2] & (1 << 1)) != 0) && ((info[2] & (1 << 19)) != 0);
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+  return ((ecx & bit_PCLMUL) != 0) && ((ecx & bit_SSE4_1) != 0);
+#endif
+}
+
+
+/*!
+  Folds 64 bytes at a time with carry-less multiplies and reduces the result
+  with Barrett reduction, see "Fast CRC Computation for Generic Polynomials
+  Using PCLMULQDQ Instruction" (Intel, 2009). The constants are for the
+  bit-reflected CRC-32 polynomial. length is at least 64 and a multiple of 16.
+*/
+static CRC32_CLMUL_TARGET uint32 Crc32Clmul(uint32 crc, const binary *input, uint32 length)
+{
+  static const uint64 k1k2[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+  static const uint64 k3k4[2] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+  static const uint64 k5k0[2] = { 0x0163cd6124ULL, 0x0000000000ULL };
+  static const uint64 poly[2] = { 0x01db710641ULL, 0x01f7011641ULL };
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128((const __m128i *)(input + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *)(input + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *)(input + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *)(input + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  x0 = _mm_loadu_si128((const __m128i *)k1k2);
+  input += 64;
+  length -= 64;
+
+  // four independent folds of 64 bytes
+  while (length >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    y5 = _mm_loadu_si128((const __m128i *)(input + 0x00));
+    y6 = _mm_loadu_si128((const __m128i *)(input + 0x10));
+    y7 = _mm_loadu_si128((const __m128i *)(input + 0x20));
+    y8 = _mm_loadu_si128((const __m128i *)(input + 0x30));
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+    input += 64;
+    length -= 64;
+  }
+
+  // fold the four into one
+  x0 = _mm_loadu_si128((const __m128i *)k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // the remaining 16 byte blocks
+  while (length >= 16) {
+    x2 = _mm_loadu_si128((const __m128i *)input);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    input += 16;
+    length -= 16;
+  }
+
+  // 128 to 64 bits
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_loadu_si128((const __m128i *)poly);
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (uint32)_mm_extract_epi32(x1, 1);
+}
+#endif // EBML_CRC32_CLMUL
+
+bool EbmlCrc32::HasClmul()
+{
+#ifdef EBML_CRC32_CLMUL
+  // initialized once, even with several threads, and never changed
+  static const bool bHasClmul = Crc32HasClmul();
+  return bHasClmul;
+#else
+  return false;
+#endif
+}
+
+uint32 EbmlCrc32::UpdateCRC(uint32 crc, const binary *input, uint32 length)
+{
+  return UpdateCRC(crc, input, length, true);
+}
+
+uint32 EbmlCrc32::UpdateCRC(uint32 crc, const binary *input, uint32 length, bool bClmul)
+{
+  if (length < CRC32_SLICE_MINIMUM) {
+    while (length--)
+      crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+    return crc;
+  }
+
+#ifdef EBML_CRC32_CLMUL
+  if (bClmul && length >= CRC32_CLMUL_MINIMUM && HasClmul()) {
+    uint32 blocks = length & ~15;
+    crc = Crc32Clmul(crc, input, blocks);
+    input += blocks;
+    length -= blocks;
+  }
+#endif
+
+  for(; !IsAligned<uint32>(input) && length > 0; length--)
+    crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+
+#ifndef WORDS_BIGENDIAN
+  while (length >= 8) {
+    uint32 one = *(const uint32 *)input ^ crc;
+    uint32 two = *(const uint32 *)(input + 4);
+    crc = crc32_slice[7][one & 0xff] ^ crc32_slice[6][(one >> 8) & 0xff] ^
+          crc32_slice[5][(one >> 16) & 0xff] ^ crc32_slice[4][one >> 24] ^
+          crc32_slice[3][two & 0xff] ^ crc32_slice[2][(two >> 8) & 0xff] ^
+          crc32_slice[1][(two >> 16) & 0xff] ^ crc32_slice[0][two >> 24];
+    length -= 8;
+    input += 8;
+  }
+#else
+  while (length >= 4) {
+    crc ^= *(const uint32 *)input;
+    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
+    length -= 4;
+    input += 4;
+  }
+#endif
+
+  while (length--)
+    crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+
+  return crc;
+}
+
 EbmlCrc32::EbmlCrc32()
 {
   ResetCRC();
@@ -191,20 +402,19 @@ void EbmlCrc32::UpdateByte(binary b)
 
 void EbmlCrc32::AddElementCRC32(EbmlElement &ElementToCRC)
 {
-  // Use a special IOCallback class that Render's to memory instead of to disk
-  MemIOCallback memoryBuffer;
-  ElementToCRC.Render(memoryBuffer, true, true);
-
-  Update(memoryBuffer.GetDataBuffer(), memoryBuffer.GetDataBufferSize());
+  // Use a special IOCallback class that only feeds the CRC, the element
+  // is not kept anywhere
+  CrcIOCallback crcOnly(NULL, this);
+  ElementToCRC.Render(crcOnly, true, true);
   //  Finalize();
 };
 
 bool EbmlCrc32::CheckElementCRC32(EbmlElement &ElementToCRC)
 {
-  MemIOCallback memoryBuffer;
-  ElementToCRC.Render(memoryBuffer);
+  CrcIOCallback crcOnly;
+  ElementToCRC.Render(crcOnly);
 
-  return CheckCRC(m_crc_final, memoryBuffer.GetDataBuffer(), memoryBuffer.GetDataBufferSize());
+  return (crcOnly.GetCrc32() == m_crc_final);
 };
 
 filepos_t EbmlCrc32::RenderData(IOCallback & output, bool /* bForceRender */, bool /* bWithDefault */)
@@ -253,23 +463,7 @@ filepos_t EbmlCrc32::ReadData(IOCallback & input, ScopeMode ReadFully)
 
 bool EbmlCrc32::CheckCRC(uint32 inputCRC, const binary *input, uint32 length)
 {
-  uint32 crc = CRC32_NEGL;
-
-  for(; !IsAligned<uint32>(input) && length > 0; length--)
-    crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
-
-  while (length >= 4) {
-    crc ^= *(const uint32 *)input;
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    length -= 4;
-    input += 4;
-  }
-
-  while (length--)
-    crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
+  uint32 crc = UpdateCRC(CRC32_NEGL, input, length);
 
   //Now we finalize the CRC32
   crc ^= CRC32_NEGL;
@@ -316,25 +510,7 @@ void EbmlCrc32::FillCRC32(const binary *s, uint32 n)
 
 void EbmlCrc32::Update(const binary *input, uint32 length)
 {
-  uint32 crc = m_crc;
-
-  for(; !IsAligned<uint32>(input) && length > 0; length--)
-    crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
-
-  while (length >= 4) {
-    crc ^= *(const uint32 *)input;
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    crc = m_tab[CRC32_INDEX(crc)] ^ CRC32_SHIFTED(crc);
-    length -= 4;
-    input += 4;
-  }
-
-  while (length--)
-    crc = m_tab[CRC32_INDEX(crc) ^ *input++] ^ CRC32_SHIFTED(crc);
-
-  m_crc = crc;
+  m_crc = UpdateCRC(m_crc, input, length);
 }
 
 void EbmlCrc32::Finalize()
@@ -41,6 +41,7 @@
 #include "ebml/EbmlVoid.h"
 #include "ebml/EbmlDummy.h"
 #include "ebml/EbmlContexts.h"
+#include "ebml/EbmlArena.h"
 
 START_LIBEBML_NAMESPACE
 
@@ -138,46 +139,32 @@ int CodedValueLengthSigned(int64 Length, int CodedSize, binary * OutBuffer)
 
 uint64 ReadCodedSizeValue(const binary * InBuffer, uint32 & BufferSize, uint64 & SizeUnknown)
 {
-  binary SizeBitMask = 1 << 7;
-  uint64 Result = 0x7F;
-  unsigned int SizeIdx, PossibleSizeLength = 0;
-  binary PossibleSize[8];
-  memset(PossibleSize, 0, 8);
-
-  SizeUnknown = 0x7F; // the last bit is discarded when computing the size
-  for (SizeIdx = 0; SizeIdx < BufferSize && SizeIdx < 8; SizeIdx++) {
-    if (InBuffer[0] & (SizeBitMask >> SizeIdx)) {
-      // ID found
-      PossibleSizeLength = SizeIdx + 1;
-      SizeBitMask >>= SizeIdx;
-
-      // Guard against invalid memory accesses with incomplete IDs.
-      if (PossibleSizeLength > BufferSize)
-        break;
-
-      for (SizeIdx = 0; SizeIdx < PossibleSizeLength; SizeIdx++) {
-        PossibleSize[SizeIdx] = InBuffer[SizeIdx];
-      }
-      for (SizeIdx = 0; SizeIdx < PossibleSizeLength - 1; SizeIdx++) {
-        Result <<= 7;
-        Result |= 0xFF;
-      }
-
-      Result = 0;
-      Result |= PossibleSize[0] & ~SizeBitMask;
-      for (unsigned int i = 1; i<PossibleSizeLength; i++) {
+  // the length is given by the first bit set in the first octet, decoded in
+  // place when all of it is in the buffer
+  uint32 Length = 1;
+  uint32 MaxLength = (BufferSize < 8) ? BufferSize : 8;
+
+  if (MaxLength != 0) {
+    binary First = InBuffer[0];
+    while (Length <= 8 && !(First & (0x80 >> (Length - 1))))
+      Length++;
+
+    if (Length <= MaxLength) {
+      // the last bit is discarded when computing the size
+      SizeUnknown = (uint64(1) << (7 * Length)) - 1;
+
+      uint64 Result = First & ((0x80 >> (Length - 1)) - 1);
+      for (uint32 i = 1; i < Length; i++) {
         Result <<= 8;
-        Result |= PossibleSize[i];
+        Result |= InBuffer[i];
       }
 
-      BufferSize = PossibleSizeLength;
-
+      BufferSize = Length;
       return Result;
     }
-    SizeUnknown <<= 7;
-    SizeUnknown |= 0xFF;
   }
 
+  SizeUnknown = (uint64(1) << (7 * (MaxLength + 1))) - 1;
   BufferSize = 0;
   return 0;
 }
@@ -235,6 +222,7 @@ EbmlElement::EbmlElement(uint64 aDefaultSize, bool bValueSet)
   ,bValueIsSet(bValueSet)
   ,DefaultIsSet(false)
   ,bLocked(false)
+  ,bSizeIsUpToDate(false)
 {
   Size = DefaultSize;
 }
@@ -249,6 +237,7 @@ EbmlElement::EbmlElement(const EbmlElement & ElementToClone)
   ,bValueIsSet(ElementToClone.bValueIsSet)
   ,DefaultIsSet(ElementToClone.DefaultIsSet)
   ,bLocked(ElementToClone.bLocked)
+  ,bSizeIsUpToDate(false)
 {
 }
 
@@ -257,6 +246,30 @@ EbmlElement::~EbmlElement()
   assert(!bLocked);
 }
 
+void * EbmlElement::operator new(size_t Size)
+{
+  void * Result = EbmlArena::Allocate(Size);
+  if (Result == NULL)
+    throw std::bad_alloc();
+  return Result;
+}
+
+void * EbmlElement::operator new(size_t Size, const std::nothrow_t &) throw()
+{
+  return EbmlArena::Allocate(Size);
+}
+
+void EbmlElement::operator delete(void * Ptr, size_t Size)
+{
+  EbmlArena::Free(Ptr, Size);
+}
+
+void EbmlElement::operator delete(void * Ptr, const std::nothrow_t &) throw()
+{
+  // only when a constructor throws, the size is not known here
+  EbmlArena::Free(Ptr, 0);
+}
+
 /*!
   \todo this method is deprecated and should be called FindThisID
   \todo replace the new RawElement with the appropriate class (when known)
@@ -353,6 +366,83 @@ EbmlElement * EbmlElement::FindNextID(IOCallback & DataStream, const EbmlCallbac
 }
 
 
+/*!
+  \class EbmlScanOctets
+  \brief The octets of a possible ID and size while FindNextElement scans
+
+  With a buffered stream they are looked at in its buffer and dropping the
+  first one only moves a pointer, otherwise they are read one at a time into
+  a local copy. The stream is only moved by Sync() in the buffered case.
+*/
+class EbmlScanOctets
+{
+public:
+  EbmlScanOctets(IOCallback & aStream)
+    :Stream(aStream)
+    ,Count(0)
+  {
+    WindowSize = Stream.peek(Window, sizeof(Copy));
+    Octets = (Window != NULL) ? Window : Copy;
+  }
+
+  const binary * Get() const {return Octets;}
+
+  /*!
+    Adds the next octet of the stream, false at the end of the stream
+  */
+  bool Read() {
+    if (Window == NULL) {
+      if (Stream.read(&Copy[Count], 1) == 0)
+        return false;
+    } else if (size_t(Octets - Window) + Count >= WindowSize) {
+      // start the window at the first octet again
+      Stream.consume(Octets - Window);
+      WindowSize = Stream.peek(Window, sizeof(Copy));
+      Octets = Window;
+      if (Count >= WindowSize)
+        return false;
+    }
+    Count++;
+    return true;
+  }
+
+  /*!
+    Drops the first octet
+  */
+  void Shift() {
+    Count--;
+    if (Window == NULL)
+      memmove(&Copy[0], &Copy[1], Count);
+    else
+      Octets++;
+  }
+
+  /*!
+    \return The position in the stream after the last octet
+  */
+  uint64 End() {
+    if (Window == NULL)
+      return Stream.getFilePointer();
+    return Stream.getFilePointer() + (Octets - Window) + Count;
+  }
+
+  /*!
+    Moves the stream after the last octet, like reading them would have
+  */
+  void Sync() {
+    if (Window != NULL)
+      Stream.consume((Octets - Window) + Count);
+  }
+
+protected:
+  IOCallback & Stream;
+  binary Copy[16];
+  const binary * Octets;
+  size_t Count;
+  const binary * Window;
+  size_t WindowSize;
+};
+
 /*!
   \todo replace the new RawElement with the appropriate class (when known)
   \todo skip data for Dummy elements when they are not allowed
@@ -363,7 +453,7 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
                                            uint64 MaxDataSize, bool AllowDummyElt, unsigned int MaxLowerLevel)
 {
   int PossibleID_Length = 0;
-  binary PossibleIdNSize[16];
+  EbmlScanOctets PossibleIdNSize(DataStream);
   int PossibleSizeLength;
   uint64 SizeUnknown;
   int ReadIndex = 0; // trick for the algo, start index at 0
@@ -381,7 +471,7 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
       bFound = false;
       binary IdBitMask = 1 << 7;
       for (SizeIdx = 0; SizeIdx < ReadIndex && SizeIdx < 4; SizeIdx++) {
-        if (PossibleIdNSize[0] & (IdBitMask >> SizeIdx)) {
+        if (PossibleIdNSize.Get()[0] & (IdBitMask >> SizeIdx)) {
           // ID found
           PossibleID_Length = SizeIdx + 1;
           IdBitMask >>= SizeIdx;
@@ -396,12 +486,15 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
       if (ReadIndex >= 4) {
         // ID not found
         // shift left the read octets
-        memmove(&PossibleIdNSize[0],&PossibleIdNSize[1], --ReadIndex);
+        PossibleIdNSize.Shift();
+        --ReadIndex;
       }
 
-      if (DataStream.read(&PossibleIdNSize[ReadIndex++], 1) == 0) {
+      if (!PossibleIdNSize.Read()) {
+        PossibleIdNSize.Sync();
         return NULL; // no more data ?
       }
+      ReadIndex++;
       ReadSize++;
 
     } while (!bFound && MaxDataSize > ReadSize);
@@ -414,7 +507,7 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
     PossibleSizeLength = ReadIndex;
     while (1) {
       _SizeLength = PossibleSizeLength;
-      SizeFound = ReadCodedSizeValue(&PossibleIdNSize[PossibleID_Length], _SizeLength, SizeUnknown);
+      SizeFound = ReadCodedSizeValue(PossibleIdNSize.Get() + PossibleID_Length, _SizeLength, SizeUnknown);
       if (_SizeLength != 0) {
         bFound = true;
         break;
@@ -423,16 +516,18 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
         bFound = false;
         break;
       }
-      if( DataStream.read( &PossibleIdNSize[SizeIdx++], 1 ) == 0 ) {
+      if (!PossibleIdNSize.Read()) {
+        PossibleIdNSize.Sync();
         return NULL; // no more data ?
       }
+      SizeIdx++;
       ReadSize++;
       PossibleSizeLength++;
     }
 
     if (bFound) {
       // find the element in the context and use the correct creator
-      EbmlId PossibleID(PossibleIdNSize, PossibleID_Length);
+      EbmlId PossibleID(PossibleIdNSize.Get(), PossibleID_Length);
       EbmlElement * Result = CreateElementUsingContext(PossibleID, Context, UpperLevel, false, AllowDummyElt, MaxLowerLevel);
       ///< \todo continue is misplaced
       if (Result != NULL) {
@@ -450,7 +545,7 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
               Result->SetSizeInfinite();
             }
 
-            Result->SizePosition = DataStream.getFilePointer() - SizeIdx + EBML_ID_LENGTH(PossibleID);
+            Result->SizePosition = PossibleIdNSize.End() - SizeIdx + EBML_ID_LENGTH(PossibleID);
             Result->ElementPosition = Result->SizePosition - EBML_ID_LENGTH(PossibleID);
             // place the file at the beggining of the data
             DataStream.setFilePointer(Result->SizePosition + _SizeLength);
@@ -463,10 +558,11 @@ EbmlElement * EbmlElement::FindNextElement(IOCallback & DataStream, const EbmlSe
 
     // recover all the data in the buffer minus one byte
     ReadIndex = SizeIdx - 1;
-    memmove(&PossibleIdNSize[0], &PossibleIdNSize[1], ReadIndex);
+    PossibleIdNSize.Shift();
     UpperLevel = UpperLevel_original;
-  } while ( MaxDataSize > DataStream.getFilePointer() - SizeIdx + PossibleID_Length );
+  } while ( MaxDataSize > PossibleIdNSize.End() - SizeIdx + PossibleID_Length );
 
+  PossibleIdNSize.Sync();
   return NULL;
 }
 
@@ -595,7 +691,11 @@ filepos_t EbmlElement::Render(IOCallback & output, bool bWithDefault, bool bKeep
   uint64 SupposedSize = UpdateSize(bWithDefault, bForceRender);
 #endif // LIBEBML_DEBUG
   filepos_t result = RenderHead(output, bForceRender, bWithDefault, bKeepPosition);
+  // the sizes of the children were computed with this one
+  if (IsMaster())
+    bSizeIsUpToDate = true;
   uint64 WrittenSize = RenderData(output, bForceRender, bWithDefault);
+  bSizeIsUpToDate = false;
 #if defined(LIBEBML_DEBUG)
   if (static_cast<int64>(SupposedSize) != (0-1))
     assert(WrittenSize == SupposedSize);
@@ -614,7 +714,8 @@ filepos_t EbmlElement::RenderHead(IOCallback & output, bool bForceRender, bool b
   if (EBML_ID_LENGTH((const EbmlId&)*this) <= 0 || EBML_ID_LENGTH((const EbmlId&)*this) > 4)
     return 0;
 
-  UpdateSize(bWithDefault, bForceRender);
+  if (!TakeSizeIsUpToDate())
+    UpdateSize(bWithDefault, bForceRender);
 
   return MakeRenderHead(output, bKeepPosition);
 }
@@ -628,7 +729,8 @@ filepos_t EbmlElement::MakeRenderHead(IOCallback & output, bool bKeepPosition)
   EbmlId(*this).Fill(FinalHead);
 
   int CodedSize = CodedSizeLength(Size, SizeLength, bSizeIsFinite);
-  CodedValueLength(Size, CodedSize, &FinalHead[FinalHeadSize]);
+  // an unknown size is coded with all value bits set
+  CodedValueLength(bSizeIsFinite ? Size : (0-1), CodedSize, &FinalHead[FinalHeadSize]);
   FinalHeadSize += CodedSize;
 
   output.writeFully(FinalHead, FinalHeadSize);
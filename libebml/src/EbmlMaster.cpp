@@ -41,11 +41,13 @@
 #include "ebml/EbmlStream.h"
 #include "ebml/EbmlContexts.h"
 #include "ebml/MemIOCallback.h"
+#include "ebml/CrcIOCallback.h"
 
 START_LIBEBML_NAMESPACE
 
 EbmlMaster::EbmlMaster(const EbmlSemanticContext & aContext, bool bSizeIsknown)
- :EbmlElement(0), Context(aContext), bChecksumUsed(bChecksumUsedByDefault)
+ :EbmlElement(0), Context(aContext), bChecksumUsed(bChecksumUsedByDefault), bIdIndexValid(false)
+ ,LazyInput(NULL), bLazyDummy(false)
 {
   SetSizeIsFinite(bSizeIsknown);
   SetValueIsSet();
@@ -58,6 +60,9 @@ EbmlMaster::EbmlMaster(const EbmlMaster & ElementToClone)
  ,Context(ElementToClone.Context)
  ,bChecksumUsed(ElementToClone.bChecksumUsed)
  ,Checksum(ElementToClone.Checksum)
+ ,bIdIndexValid(false)
+ ,LazyInput(NULL)
+ ,bLazyDummy(false)
 {
   // add a clone of the list
   std::vector<EbmlElement *>::const_iterator Itr = ElementToClone.ElementList.begin();
@@ -92,6 +97,11 @@ filepos_t EbmlMaster::RenderData(IOCallback & output, bool bForceRender, bool bW
   filepos_t Result = 0;
   size_t Index;
 
+  // set by Render() when UpdateSize() was just called on the whole tree
+  bool bChildSizesKnown = TakeSizeIsUpToDate() && IsFiniteSize();
+
+  ReadLazy();
+
   if (!bForceRender) {
     assert(CheckMandatory());
   }
@@ -100,13 +110,35 @@ filepos_t EbmlMaster::RenderData(IOCallback & output, bool bForceRender, bool bW
     for (Index = 0; Index < ElementList.size(); Index++) {
       if (!bWithDefault && (ElementList[Index])->IsDefaultValue())
         continue;
+      if (bChildSizesKnown)
+        SetSizeIsUpToDate(*ElementList[Index]);
       Result += (ElementList[Index])->Render(output, bWithDefault, false ,bForceRender);
     }
+  } else if (output.canOverwrite()) { // new school, CRC computed on the way out
+    // placeholder for the CRC, patched once the children are written
+    uint64 ChecksumPos = output.getFilePointer();
+    Checksum.ForceCrc32(0);
+    Result += Checksum.Render(output, true, false ,bForceRender);
+    CrcIOCallback Tee(&output);
+    for (Index = 0; Index < ElementList.size(); Index++) {
+      if (!bWithDefault && (ElementList[Index])->IsDefaultValue())
+        continue;
+      if (bChildSizesKnown)
+        SetSizeIsUpToDate(*ElementList[Index]);
+      Result += (ElementList[Index])->Render(Tee, bWithDefault, false ,bForceRender);
+    }
+    Checksum.ForceCrc32(Tee.GetCrc32());
+    uint64 EndPos = output.getFilePointer();
+    output.setFilePointer(ChecksumPos);
+    Checksum.Render(output, true, false ,bForceRender);
+    output.setFilePointer(EndPos);
   } else { // new school
     MemIOCallback TmpBuf(GetSize() - 6);
     for (Index = 0; Index < ElementList.size(); Index++) {
       if (!bWithDefault && (ElementList[Index])->IsDefaultValue())
         continue;
+      if (bChildSizesKnown)
+        SetSizeIsUpToDate(*ElementList[Index]);
       (ElementList[Index])->Render(TmpBuf, bWithDefault, false ,bForceRender);
     }
     Checksum.FillCRC32(TmpBuf.GetDataBuffer(), TmpBuf.GetDataBufferSize());
@@ -123,7 +155,12 @@ filepos_t EbmlMaster::RenderData(IOCallback & output, bool bForceRender, bool bW
 */
 bool EbmlMaster::PushElement(EbmlElement & element)
 {
+  ReadLazy();
   ElementList.push_back(&element);
+  if (bIdIndexValid)
+    AddToIdIndex(element, ElementList.size() - 1);
+  else
+    BuildIdIndex();
   return true;
 }
 
@@ -134,6 +171,8 @@ uint64 EbmlMaster::UpdateSize(bool bWithDefault, bool bForceRender)
   if (!IsFiniteSize())
     return (0-1);
 
+  ReadLazy();
+
   if (!bForceRender) {
     assert(CheckMandatory());
     }
@@ -188,6 +227,10 @@ bool EbmlMaster::ProcessMandatory()
 
   assert(Context.GetSize() != 0);
 
+  // room for one of each child, so that masters that are built rather than
+  // read allocate their list once
+  ElementList.reserve(EBML_CTX_SIZE(Context));
+
   unsigned int EltIdx;
   for (EltIdx = 0; EltIdx < EBML_CTX_SIZE(Context); EltIdx++) {
     if (EBML_CTX_IDX(Context,EltIdx).IsMandatory() && EBML_CTX_IDX(Context,EltIdx).IsUnique()) {
@@ -264,10 +307,55 @@ std::vector<std::string> EbmlMaster::FindAllMissingElements()
 }
 #endif
 
+static inline uint64 IdIndexKey(const EbmlId & Id)
+{
+  return (uint64(EBML_ID_LENGTH(Id)) << 32) | EBML_ID_VALUE(Id);
+}
+
+void EbmlMaster::BuildIdIndex()
+{
+  if (bIdIndexValid || ElementList.size() < IdIndexMinimumSize)
+    return;
+
+  IdIndex.reserve(ElementList.size());
+  IdIndexPlaces.reserve(ElementList.size());
+  for (size_t Index = 0; Index < ElementList.size(); Index++) {
+    if (ElementList[Index] == NULL)
+      continue;
+    IdIndexEntry Entry = {IdIndexKey(EbmlId(*ElementList[Index])), Index, ElementList[Index]};
+    IdIndexPlace Place = {ElementList[Index], Index};
+    IdIndex.push_back(Entry);
+    IdIndexPlaces.push_back(Place);
+  }
+  std::sort(IdIndex.begin(), IdIndex.end());
+  std::sort(IdIndexPlaces.begin(), IdIndexPlaces.end());
+  bIdIndexValid = true;
+}
+
+/*!
+  \note Position is the last one of the list, so the new entries usually go at
+  the end of the index
+*/
+void EbmlMaster::AddToIdIndex(EbmlElement & element, size_t Position)
+{
+  IdIndexEntry Entry = {IdIndexKey(EbmlId(element)), Position, &element};
+  IdIndexPlace Place = {&element, Position};
+  IdIndex.insert(std::upper_bound(IdIndex.begin(), IdIndex.end(), Entry), Entry);
+  IdIndexPlaces.insert(std::upper_bound(IdIndexPlaces.begin(), IdIndexPlaces.end(), Place), Place);
+}
+
 EbmlElement *EbmlMaster::FindElt(const EbmlCallbacks & Callbacks) const
 {
   size_t Index;
 
+  ReadLazy(EBML_INFO_ID(Callbacks));
+
+  if (bIdIndexValid) {
+    IdIndexEntry First = {IdIndexKey(EBML_INFO_ID(Callbacks)), 0, NULL};
+    std::vector<IdIndexEntry>::const_iterator SameId = std::lower_bound(IdIndex.begin(), IdIndex.end(), First);
+    return (SameId != IdIndex.end() && SameId->Key == First.Key) ? SameId->Element : NULL;
+  }
+
   for (Index = 0; Index < ElementList.size(); Index++) {
     EbmlElement * tmp = ElementList[Index];
     if (EbmlId(*tmp) == EBML_INFO_ID(Callbacks))
@@ -281,9 +369,18 @@ EbmlElement *EbmlMaster::FindFirstElt(const EbmlCallbacks & Callbacks, bool bCre
 {
   size_t Index;
 
-  for (Index = 0; Index < ElementList.size(); Index++) {
-    if (ElementList[Index] && EbmlId(*(ElementList[Index])) == EBML_INFO_ID(Callbacks))
-      return ElementList[Index];
+  ReadLazy(EBML_INFO_ID(Callbacks));
+  BuildIdIndex();
+
+  if (bIdIndexValid) {
+    EbmlElement *Found = FindElt(Callbacks);
+    if (Found != NULL)
+      return Found;
+  } else {
+    for (Index = 0; Index < ElementList.size(); Index++) {
+      if (ElementList[Index] && EbmlId(*(ElementList[Index])) == EBML_INFO_ID(Callbacks))
+        return ElementList[Index];
+    }
   }
 
   if (bCreateIfNull) {
@@ -306,6 +403,11 @@ EbmlElement *EbmlMaster::FindFirstElt(const EbmlCallbacks & Callbacks) const
 {
   size_t Index;
 
+  ReadLazy(EBML_INFO_ID(Callbacks));
+
+  if (bIdIndexValid)
+    return FindElt(Callbacks);
+
   for (Index = 0; Index < ElementList.size(); Index++) {
     if (EbmlId(*(ElementList[Index])) == EBML_INFO_ID(Callbacks))
       return ElementList[Index];
@@ -322,23 +424,32 @@ EbmlElement *EbmlMaster::FindNextElt(const EbmlElement & PastElt, bool bCreateIf
 {
   size_t Index;
 
-  for (Index = 0; Index < ElementList.size(); Index++) {
-    if ((ElementList[Index]) == &PastElt) {
-      // found past element, new one is :
+  ReadLazy(EbmlId(PastElt));
+  BuildIdIndex();
+
+  if (bIdIndexValid) {
+    EbmlElement *Found = static_cast<const EbmlMaster *>(this)->FindNextElt(PastElt);
+    if (Found != NULL)
+      return Found;
+  } else {
+    for (Index = 0; Index < ElementList.size(); Index++) {
+      if ((ElementList[Index]) == &PastElt) {
+        // found past element, new one is :
+        Index++;
+        break;
+      }
+    }
+
+    while (Index < ElementList.size()) {
+      if ((EbmlId)PastElt == (EbmlId)(*ElementList[Index]))
+        break;
       Index++;
-      break;
     }
-  }
 
-  while (Index < ElementList.size()) {
-    if ((EbmlId)PastElt == (EbmlId)(*ElementList[Index]))
-      break;
-    Index++;
+    if (Index != ElementList.size())
+      return ElementList[Index];
   }
 
-  if (Index != ElementList.size())
-    return ElementList[Index];
-
   if (bCreateIfNull) {
     // add the element
     EbmlElement *NewElt = &(PastElt.CreateElement());
@@ -359,6 +470,19 @@ EbmlElement *EbmlMaster::FindNextElt(const EbmlElement & PastElt) const
 {
   size_t Index;
 
+  ReadLazy(EbmlId(PastElt));
+
+  if (bIdIndexValid) {
+    // an element in the list twice is found at its first place, like in the list
+    IdIndexPlace First = {&PastElt, 0};
+    std::vector<IdIndexPlace>::const_iterator Place = std::lower_bound(IdIndexPlaces.begin(), IdIndexPlaces.end(), First);
+    if (Place == IdIndexPlaces.end() || Place->Element != &PastElt)
+      return NULL;
+    IdIndexEntry Past = {IdIndexKey(EbmlId(PastElt)), Place->Position, NULL};
+    std::vector<IdIndexEntry>::const_iterator Next = std::upper_bound(IdIndex.begin(), IdIndex.end(), Past);
+    return (Next != IdIndex.end() && Next->Key == Past.Key) ? Next->Element : NULL;
+  }
+
   for (Index = 0; Index < ElementList.size(); Index++) {
     if ((ElementList[Index]) == &PastElt) {
       // found past element, new one is :
@@ -392,7 +516,10 @@ EbmlElement *EbmlMaster::AddNewElt(const EbmlCallbacks & Callbacks)
 
 void EbmlMaster::Sort()
 {
+  ReadLazy();
   std::sort(ElementList.begin(), ElementList.end(), EbmlElement::CompareElements);
+  InvalidateIdIndex();
+  BuildIdIndex();
 }
 
 /*!
@@ -415,6 +542,8 @@ void EbmlMaster::Read(EbmlStream & inDataStream, const EbmlSemanticContext & sCo
     }
   }
   ElementList.clear();
+  InvalidateIdIndex();
+  DropLazy();
   uint64 MaxSizeToRead;
 
   if (IsFiniteSize())
@@ -422,6 +551,18 @@ void EbmlMaster::Read(EbmlStream & inDataStream, const EbmlSemanticContext & sCo
   else
     MaxSizeToRead = 0x7FFFFFFF;
 
+  // only note where the children are when they can all be found from the sizes
+  if (ReadFully == SCOPE_LAZY_DATA && IsFiniteSize() && MaxSizeToRead > 0) {
+    if (FindLazyChildren(inDataStream.I_O())) {
+      LazyInput = &inDataStream.I_O();
+      bLazyDummy = AllowDummyElt;
+      // the checksum is kept out of the list
+      ReadLazy(EBML_ID(EbmlCrc32));
+      inDataStream.I_O().setFilePointer(GetEndPosition(), seek_beginning);
+      goto processCrc;
+    }
+  }
+
   // read blocks and discard the ones we don't care about
   if (MaxSizeToRead > 0)
   {
@@ -439,15 +580,18 @@ void EbmlMaster::Read(EbmlStream & inDataStream, const EbmlSemanticContext & sCo
           break;
         }
       } else {
-        ElementLevelA->Read(inDataStream, EBML_CONTEXT(ElementLevelA), UpperEltFound, FoundElt, AllowDummyElt, ReadFully);
+        ScopeMode ReadChild = ReadFully;
+        if (ReadFully == SCOPE_LAZY_DATA && !ElementLevelA->IsMaster())
+          ReadChild = SCOPE_ALL_DATA;
+        ElementLevelA->Read(inDataStream, EBML_CONTEXT(ElementLevelA), UpperEltFound, FoundElt, AllowDummyElt, ReadChild);
 
         // Discard elements that couldn't be read properly if
         // SCOPE_ALL_DATA has been requested. This can happen
         // e.g. if block data is defective.
         bool DeleteElement = true;
 
-        if (ElementLevelA->ValueIsSet() || (ReadFully != SCOPE_ALL_DATA)) {
-          ElementList.push_back(ElementLevelA);
+        if (ElementLevelA->ValueIsSet() || (ReadChild != SCOPE_ALL_DATA && ReadChild != SCOPE_LAZY_DATA)) {
+          PushElement(*ElementLevelA);
           DeleteElement = false;
         }
 
@@ -512,14 +656,176 @@ processCrc:
   {
     delete *CrcItr;
     Remove(CrcItr);
+    BuildIdIndex();
   }
 
   SetValueIsSet();
 }
+
+static bool IsLazyChildId(const EbmlId & Id, const EbmlSemanticContext & Context)
+{
+  unsigned int ContextIndex;
+
+  for (ContextIndex = 0; ContextIndex < EBML_CTX_SIZE(Context); ContextIndex++) {
+    if (Id == EBML_CTX_IDX_ID(Context,ContextIndex))
+      return true;
+  }
+
+  const EbmlSemanticContext & GlobalContext = Context.GetGlobalContext();
+  if (GlobalContext != Context) {
+    for (ContextIndex = 0; ContextIndex < EBML_CTX_SIZE(GlobalContext); ContextIndex++) {
+      if (Id == EBML_CTX_IDX_ID(GlobalContext,ContextIndex))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+/*!
+  \note anything that needs the resynchronisation or the level handling of
+  FindNextElement (unknown IDs, unknown sizes, sizes going past the master) is
+  left to the normal reading
+*/
+bool EbmlMaster::FindLazyChildren(IOCallback & input)
+{
+  uint64 Position = GetSizePosition() + GetSizeLength();
+  uint64 EndPosition = GetEndPosition();
+
+  while (Position < EndPosition) {
+    binary Head[4 + 8];
+    uint32 HeadSize = sizeof(Head);
+    if (EndPosition - Position < HeadSize)
+      HeadSize = uint32(EndPosition - Position);
+
+    input.setFilePointer(Position, seek_beginning);
+    if (input.read(Head, HeadSize) != HeadSize)
+      break;
+
+    uint32 IdLength = 1;
+    while (IdLength <= 4 && !(Head[0] & (0x80 >> (IdLength - 1))))
+      IdLength++;
+    if (IdLength > 4 || IdLength >= HeadSize)
+      break;
+
+    uint32 IdValue = 0;
+    for (uint32 i = 0; i < IdLength; i++)
+      IdValue = (IdValue << 8) | Head[i];
+    EbmlId Id(IdValue, IdLength);
+    if (!IsLazyChildId(Id, Context))
+      break;
+
+    uint32 SizeLength = HeadSize - IdLength;
+    uint64 SizeUnknown;
+    uint64 Size = ReadCodedSizeValue(Head + IdLength, SizeLength, SizeUnknown);
+    if (SizeLength == 0 || Size == SizeUnknown)
+      break;
+
+    LazyChild Child;
+    Child.Position = Position;
+    Child.Size = IdLength + SizeLength + Size;
+    if (Child.Size > EndPosition - Position)
+      break;
+
+    LazyChildren[IdIndexKey(Id)].push_back(Child);
+    Position += Child.Size;
+  }
+
+  if (Position != EndPosition) {
+    LazyChildren.clear();
+    input.setFilePointer(GetSizePosition() + GetSizeLength(), seek_beginning);
+    return false;
+  }
+
+  return true;
+}
+
+static bool CompareElementPositions(const EbmlElement * A, const EbmlElement * B)
+{
+  return A->GetElementPosition() < B->GetElementPosition();
+}
+
+void EbmlMaster::ReadLazyChildren(const EbmlId * Id)
+{
+  std::vector<LazyChild> Children;
+
+  if (Id != NULL) {
+    std::map<uint64, std::vector<LazyChild> >::iterator SameId = LazyChildren.find(IdIndexKey(*Id));
+    if (SameId == LazyChildren.end())
+      return;
+    Children.swap(SameId->second);
+    LazyChildren.erase(SameId);
+  } else {
+    std::map<uint64, std::vector<LazyChild> >::const_iterator SameId;
+    for (SameId = LazyChildren.begin(); SameId != LazyChildren.end(); ++SameId)
+      Children.insert(Children.end(), SameId->second.begin(), SameId->second.end());
+    LazyChildren.clear();
+  }
+
+  IOCallback & input = *LazyInput;
+  if (LazyChildren.empty())
+    LazyInput = NULL;
+
+  // whoever is reading the input keeps its place
+  uint64 CurrentPosition = input.getFilePointer();
+  EbmlStream inDataStream(input);
+  size_t ReadSize = ElementList.size();
+  size_t Index;
+
+  for (Index = 0; Index < Children.size(); Index++) {
+    EbmlElement * Child = ReadLazyChild(inDataStream, Children[Index]);
+    if (Child != NULL)
+      ElementList.push_back(Child);
+  }
+  input.setFilePointer(CurrentPosition, seek_beginning);
+
+  // the list stays in file order
+  if (Id == NULL)
+    std::stable_sort(ElementList.begin() + ReadSize, ElementList.end(), CompareElementPositions);
+  std::inplace_merge(ElementList.begin(), ElementList.begin() + ReadSize, ElementList.end(), CompareElementPositions);
+  InvalidateIdIndex();
+  BuildIdIndex();
+}
+
+EbmlElement *EbmlMaster::ReadLazyChild(EbmlStream & inDataStream, const LazyChild & Child)
+{
+  int UpperEltFound = 0;
+  EbmlElement * FoundElt = NULL;
+
+  inDataStream.I_O().setFilePointer(Child.Position, seek_beginning);
+  EbmlElement * Result = inDataStream.FindNextElement(Context, UpperEltFound, Child.Size, bLazyDummy);
+  if (Result == NULL)
+    return NULL;
+  // global elements are found one level down, like in Read()
+  if (UpperEltFound > 0 || Result->GetElementPosition() != Child.Position) {
+    delete Result;
+    return NULL;
+  }
+
+  Result->Read(inDataStream, EBML_CONTEXT(Result), UpperEltFound, FoundElt, bLazyDummy, Result->IsMaster() ? SCOPE_LAZY_DATA : SCOPE_ALL_DATA);
+  if (UpperEltFound > 0 && FoundElt != NULL)
+    delete FoundElt;
+
+  if (!Result->ValueIsSet()) {
+    delete Result;
+    return NULL;
+  }
+  return Result;
+}
+#else
+/*!
+  \note without Read() no child is ever left to read lazily
+*/
+void EbmlMaster::ReadLazyChildren(const EbmlId * /* Id */)
+{
+  LazyChildren.clear();
+  LazyInput = NULL;
+}
 #endif
 
 void EbmlMaster::Remove(size_t Index)
 {
+  ReadLazy();
   if (Index < ElementList.size()) {
     std::vector<EbmlElement *>::iterator Itr = ElementList.begin();
     while (Index-- > 0) {
@@ -527,17 +833,20 @@ void EbmlMaster::Remove(size_t Index)
     }
 
     ElementList.erase(Itr);
+    InvalidateIdIndex();
   }
 }
 
 void EbmlMaster::Remove(EBML_MASTER_ITERATOR & Itr)
 {
   ElementList.erase(Itr);
+  InvalidateIdIndex();
 }
 
 void EbmlMaster::Remove(EBML_MASTER_RITERATOR & Itr)
 {
   ElementList.erase(Itr.base());
+  InvalidateIdIndex();
 }
 
 bool EbmlMaster::VerifyChecksum() const
@@ -545,19 +854,19 @@ bool EbmlMaster::VerifyChecksum() const
   if (!bChecksumUsed)
     return true;
 
-  EbmlCrc32 aChecksum;
   /// \todo remove the Checksum if it's in the list
   /// \todo find another way when not all default values are saved or (unknown from the reader !!!)
-  MemIOCallback TmpBuf(GetSize() - 6);
+  ReadLazy();
+  CrcIOCallback CrcOnly;
   for (size_t Index = 0; Index < ElementList.size(); Index++) {
-    (ElementList[Index])->Render(TmpBuf, true, false, true);
+    (ElementList[Index])->Render(CrcOnly, true, false, true);
   }
-  aChecksum.FillCRC32(TmpBuf.GetDataBuffer(), TmpBuf.GetDataBufferSize());
-  return (aChecksum.GetCrc32() == Checksum.GetCrc32());
+  return (CrcOnly.GetCrc32() == Checksum.GetCrc32());
 }
 
 bool EbmlMaster::InsertElement(EbmlElement & element, size_t position)
 {
+  ReadLazy();
   std::vector<EbmlElement *>::iterator Itr = ElementList.begin();
   while (Itr != ElementList.end() && position--)
   {
@@ -567,11 +876,13 @@ bool EbmlMaster::InsertElement(EbmlElement & element, size_t position)
     return false;
 
   ElementList.insert(Itr, &element);
+  InvalidateIdIndex();
   return true;
 }
 
 bool EbmlMaster::InsertElement(EbmlElement & element, const EbmlElement & before)
 {
+  ReadLazy();
   std::vector<EbmlElement *>::iterator Itr = ElementList.begin();
   while (Itr != ElementList.end() && *Itr != &before)
   {
@@ -581,6 +892,7 @@ bool EbmlMaster::InsertElement(EbmlElement & element, const EbmlElement & before
     return false;
 
   ElementList.insert(Itr, &element);
+  InvalidateIdIndex();
   return true;
 }
 
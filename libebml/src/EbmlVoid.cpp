@@ -48,7 +48,7 @@ EbmlVoid::EbmlVoid()
 filepos_t EbmlVoid::RenderData(IOCallback & output, bool /* bForceRender */, bool /* bWithDefault */)
 {
   // write dummy data by 4KB chunks
-  static binary DummyBuf[4*1024];
+  static const binary DummyBuf[4*1024] = {0};
 
   uint64 SizeToWrite = GetSize();
   while (SizeToWrite > 4*1024) {
@@ -63,6 +63,34 @@ void IOCallback::writeFully(const void*Buffer,size_t Size)
   }
 }
 
+size_t IOCallback::writev(const IOVector*Buffers,size_t Count)
+{
+  size_t Written = 0;
+  for (size_t i=0; i<Count; i++) {
+    size_t Result = write(Buffers[i].Buffer,Buffers[i].Size);
+    Written += Result;
+    if (Result != Buffers[i].Size)
+      break;
+  }
+  return Written;
+}
+
+void IOCallback::writeFully(const IOVector*Buffers,size_t Count)
+{
+  size_t Size = 0;
+  for (size_t i=0; i<Count; i++)
+    Size += Buffers[i].Size;
+
+  if (Size == 0)
+    return;
+
+  if(writev(Buffers,Count) != Size) {
+#if !defined(__GNUC__) || (__GNUC__ > 2)
+    throw mkv_error_exception("$EOF in writeFully");
+#endif // GCC2
+  }
+}
+
 
 #ifndef EBML_NO_READ
 void IOCallback::readFully(void*Buffer,size_t Size)
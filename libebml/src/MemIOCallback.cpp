@@ -107,6 +107,27 @@ size_t MemIOCallback::write(const void *Buffer, size_t Size)
   return Size;
 }
 
+size_t MemIOCallback::writev(const IOVector *Buffers, size_t Count)
+{
+  size_t Size = 0;
+  for (size_t i=0; i<Count; i++)
+    Size += Buffers[i].Size;
+
+  if (dataBufferMemorySize < dataBufferPos + Size) {
+    //We need more memory!
+    dataBuffer = (binary *)realloc((void *)dataBuffer, dataBufferPos + Size);
+    dataBufferMemorySize = dataBufferPos + Size;
+  }
+  for (size_t i=0; i<Count; i++) {
+    memcpy(dataBuffer+dataBufferPos, Buffers[i].Buffer, Buffers[i].Size);
+    dataBufferPos += Buffers[i].Size;
+  }
+  if (dataBufferPos > dataBufferTotalSize)
+    dataBufferTotalSize = dataBufferPos;
+
+  return Size;
+}
+
 #ifndef EBML_NO_READ
 uint32 MemIOCallback::write(IOCallback & IOToRead, size_t Size)
 {
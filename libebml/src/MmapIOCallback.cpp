@@ -0,0 +1,187 @@
+/****************************************************************************
+** libebml : parse EBML files, see http://embl.sourceforge.net/
+**
+** <file/class description>
+**
+** Copyright (C) 2002-2010 Steve Lhomme.  All rights reserved.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU Lesser General Public
+** License as published by the Free Software Foundation; either
+** version 2.1 of the License, or (at your option) any later version.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with this library; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+**
+** See http://www.gnu.org/licenses/lgpl-2.1.html for LGPL licensing information.
+**
+** Contact license@matroska.org if any conditions of this licensing are
+** not clear to you.
+**
+**********************************************************************/
+
+/*!
+  \file
+  \version \$Id$
+*/
+
+#include <cstring>
+#include <string>
+
+#include "ebml/MmapIOCallback.h"
+#include "ebml/StdIOCallback.h"
+
+#if !defined(EBML_NO_READ) && !defined(_WIN32)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+START_LIBEBML_NAMESPACE
+
+MmapIOCallback::MmapIOCallback(const char *Path, size_t aReadAhead)
+  :Base(NULL)
+  ,Length(0)
+  ,Position(0)
+  ,ReadAhead(aReadAhead)
+  ,AdviseStart(0)
+  ,AdviseEnd(0)
+{
+  assert(Path!=0);
+
+  int File = open(Path, O_RDONLY);
+  if (File < 0)
+    throw CRTError(std::string("Can't open file \"") + Path + "\"");
+
+  struct stat Stat;
+  if (fstat(File, &Stat) != 0) {
+    int Error = errno;
+    ::close(File);
+    throw CRTError(std::string("Can't get the size of \"") + Path + "\"", Error);
+  }
+  Length = Stat.st_size;
+
+  // an empty file can't be mapped, it is read as such
+  if (Length != 0) {
+    void * Map = mmap(NULL, Length, PROT_READ, MAP_SHARED, File, 0);
+    if (Map == MAP_FAILED) {
+      int Error = errno;
+      ::close(File);
+      throw CRTError(std::string("Can't map file \"") + Path + "\"", Error);
+    }
+    Base = static_cast<binary *>(Map);
+  }
+
+  // the mapping stays valid without the descriptor
+  ::close(File);
+}
+
+MmapIOCallback::~MmapIOCallback()
+{
+  close();
+}
+
+void MmapIOCallback::Advise(size_t Size)
+{
+  if (Base == NULL || Position >= Length)
+    return;
+
+  // still well inside the range asked for the last time
+  uint64 Needed = Position + Size + ReadAhead / 2;
+  if (Needed > Length)
+    Needed = Length;
+  if (Position >= AdviseStart && Needed <= AdviseEnd)
+    return;
+
+  uint64 End = Position + Size + ReadAhead;
+  if (End > Length)
+    End = Length;
+  uint64 Start = Position & ~uint64(sysconf(_SC_PAGESIZE) - 1);
+  madvise(Base + Start, size_t(End - Start), MADV_WILLNEED);
+  AdviseStart = Start;
+  AdviseEnd = End;
+}
+
+uint32 MmapIOCallback::read(void *Buffer, size_t Size)
+{
+  if (Position >= Length)
+    return 0;
+
+  if (Size > Length - Position)
+    Size = size_t(Length - Position);
+
+  Advise(Size);
+  memcpy(Buffer, Base + Position, Size);
+  Position += Size;
+  return uint32(Size);
+}
+
+void MmapIOCallback::setFilePointer(int64 Offset, seek_mode Mode)
+{
+  switch (Mode) {
+    case seek_beginning:
+      Position = Offset;
+      break;
+    case seek_current:
+      Position += Offset;
+      break;
+    case seek_end:
+      Position = Length + Offset;
+      break;
+  }
+  Advise(0);
+}
+
+size_t MmapIOCallback::write(const void * /* Buffer */, size_t /* Size */)
+{
+  return 0;
+}
+
+void MmapIOCallback::close()
+{
+  if (Base != NULL) {
+    munmap(Base, size_t(Length));
+    Base = NULL;
+  }
+  Length = 0;
+  Position = 0;
+}
+
+size_t MmapIOCallback::peek(const binary *&Buffer, size_t /* Size */)
+{
+  // everything up to the end of the file is there
+  if (Position >= Length) {
+    Buffer = Base + Length;
+    return 0;
+  }
+  Buffer = Base + Position;
+  return size_t(Length - Position);
+}
+
+void MmapIOCallback::consume(size_t Size)
+{
+  Position += Size;
+  Advise(0);
+}
+
+const binary *MmapIOCallback::readInPlace(size_t Size)
+{
+  if (Position >= Length || Size > Length - Position)
+    return NULL;
+
+  Advise(Size);
+  const binary * Result = Base + Position;
+  Position += Size;
+  return Result;
+}
+
+END_LIBEBML_NAMESPACE
+
+#endif // !EBML_NO_READ && !_WIN32
@@ -0,0 +1,174 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+//
+// crcbench - EbmlCrc32 throughput across buffer sizes
+//
+// Checks the bytewise, slice-by-8 and PCLMULQDQ paths against a byte-at-a-time
+// reference for random lengths, alignments and update splits, then reports
+// MB/s of each path for buffer sizes from 4 bytes to 16 MB. It is built with
+// EBML_CRC32_BENCH, which lets it pick the path of each CRC.
+//
+
+#include <ebml/EbmlCrc32.h>
+#include <lgpl/world.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace LIBEBML_NAMESPACE;
+
+extern "C" IWorld* my_world()
+{
+    return NULL;
+}
+
+static uint32_t ref_tab[256];
+
+static void ref_init()
+{
+    for (unsigned int i=0;i<256;i++)
+    {
+        uint32_t c = i;
+        for (unsigned int j=0;j<8;j++) c = (c&1) ? (0xEDB88320^(c>>1)) : (c>>1);
+        ref_tab[i] = c;
+    }
+}
+
+static uint32_t ref_crc(const uint8_t* Data,size_t Size)
+{
+    uint32_t crc = 0xffffffff;
+    while (Size--) crc = ref_tab[(crc^*Data++)&0xff]^(crc>>8);
+    return crc^0xffffffff;
+}
+
+// through the element, with the path the library picked
+static uint32_t lib_crc(const uint8_t* Data,size_t Size,size_t Split)
+{
+    EbmlCrc32 crc;
+    if (Split>Size) Split = Size;
+    crc.Update(Data,(uint32)Split);
+    crc.Update(Data+Split,(uint32)(Size-Split));
+    crc.Finalize();
+    return crc.GetCrc32();
+}
+
+// with or without the PCLMULQDQ path
+static uint32_t path_crc(const uint8_t* Data,size_t Size,size_t Split,bool Clmul)
+{
+    if (Split>Size) Split = Size;
+    uint32 crc = EbmlCrc32::BenchUpdateCRC(0xffffffff,Data,(uint32)Split,Clmul);
+    crc = EbmlCrc32::BenchUpdateCRC(crc,Data+Split,(uint32)(Size-Split),Clmul);
+    return crc^0xffffffff;
+}
+
+static double bench_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static bool verify(const std::vector<uint8_t>& Buffer,bool Clmul)
+{
+    srand(1);
+    for (unsigned int i=0;i<10000;i++)
+    {
+        size_t offset = rand()%64;
+        size_t size = (i<4096) ? i : (rand()%65536);
+        size_t split = rand()%(size+1);
+        if (i&1) split = size;
+
+        uint32_t expected = ref_crc(&Buffer[offset],size);
+        uint32_t got = path_crc(&Buffer[offset],size,split,Clmul);
+        if (got==expected) got = lib_crc(&Buffer[offset],size,split);
+        if (got!=expected)
+        {
+            printf("mismatch: offset %u size %u split %u crc %08x expected %08x\n",
+                (unsigned int)offset,(unsigned int)size,(unsigned int)split,got,expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+// MB/s over about 0.2 seconds of back to back CRCs of Size bytes, in one
+// element like a cluster's CRC-32 is
+static double measure(const std::vector<uint8_t>& Buffer,size_t Size,bool Reference,bool Clmul)
+{
+    volatile uint32_t sink = 0;
+    uint64_t bytes = 0;
+    unsigned int rounds = (unsigned int)((1<<20)/Size)+1;
+    double start = bench_time(),elapsed;
+
+    do
+    {
+        for (unsigned int i=0;i<rounds;i++)
+        {
+            if (Reference)
+            {
+                sink ^= ref_crc(&Buffer[1],Size);
+            } else {
+                sink ^= EbmlCrc32::BenchUpdateCRC(0xffffffff,&Buffer[1],(uint32)Size,Clmul);
+            }
+        }
+        bytes += (uint64_t)rounds*Size;
+        elapsed = bench_time()-start;
+    } while (elapsed<0.2);
+
+    return bytes/1e6/elapsed;
+}
+
+int main(int argc,char **argv)
+{
+    static const size_t sizes[] = { 4, 8, 16, 31, 32, 64, 256, 1024, 4096, 65536, 1<<20, 16<<20 };
+    std::vector<uint8_t> buffer((16<<20)+64);
+
+    ref_init();
+    for (size_t i=0;i<buffer.size();i++) buffer[i] = (uint8_t)(rand()>>7);
+
+    bool clmul = EbmlCrc32::HasClmul();
+
+    bool ok = verify(buffer,false);
+    if (clmul)
+    {
+        ok = ok && verify(buffer,true);
+    }
+    printf("verify:      %s\n",ok?"ok":"FAILED");
+    printf("pclmulqdq:   %s\n",clmul?"yes":"no");
+    printf("%10s %12s %12s %12s\n","size","bytewise","slice-by-8","pclmulqdq");
+
+    for (size_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++)
+    {
+        double ref = measure(buffer,sizes[i],true,false);
+        double slice = measure(buffer,sizes[i],false,false);
+        double fast = 0;
+        if (clmul)
+        {
+            fast = measure(buffer,sizes[i],false,true);
+        }
+        printf("%10u %9.0f MB/s %7.0f MB/s %7.0f MB/s\n",(unsigned int)sizes[i],ref,slice,fast);
+    }
+
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,319 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+//
+// lacebench - lace parsing of Matroska blocks
+//
+// Checks KaxBlockLaces against a reference that parses the lace the way
+// KaxInternalBlock::ReadData used to (ReadCodedSizeValue and a DataBuffer
+// allocated per frame) for random Xiph, EBML and fixed laces, makes sure
+// truncated laces never reach outside the block and that ParseHead() finds
+// the same sizes from the lace head alone, then reports the frames per
+// second of both for 8, 32 and 180 frames per block.
+//
+
+#include <matroska/KaxBlock.h>
+#include <lgpl/world.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace LIBMATROSKA_NAMESPACE;
+
+extern "C" IWorld* my_world()
+{
+    return NULL;
+}
+
+struct Block
+{
+    LacingType              lacing;
+    std::vector<uint32_t>   sizes;
+    std::vector<uint8_t>    data;   // the block data after the flags
+};
+
+static void make_block(Block& Blk,LacingType Lacing,unsigned int Frames)
+{
+    Blk.lacing = Lacing;
+    Blk.sizes.resize(Frames);
+    Blk.data.clear();
+
+    uint32_t fixed = 200 + rand()%1800;
+    for (unsigned int i=0;i<Frames;i++)
+    {
+        Blk.sizes[i] = (Lacing==LACING_FIXED) ? fixed : (uint32_t)(1 + rand()%3000);
+    }
+
+    Blk.data.push_back((uint8_t)(Frames-1));
+    switch(Lacing)
+    {
+    case LACING_XIPH:
+        for (unsigned int i=0;i<(Frames-1);i++)
+        {
+            uint32_t size = Blk.sizes[i];
+            while (size>=0xff)
+            {
+                Blk.data.push_back(0xff);
+                size -= 0xff;
+            }
+            Blk.data.push_back((uint8_t)size);
+        }
+        break;
+    case LACING_EBML:
+        {
+            binary head[8];
+            int len = CodedSizeLength(Blk.sizes[0],0);
+            CodedValueLength(Blk.sizes[0],len,head);
+            Blk.data.insert(Blk.data.end(),head,head+len);
+            for (unsigned int i=1;i<(Frames-1);i++)
+            {
+                int64 diff = int64(Blk.sizes[i]) - int64(Blk.sizes[i-1]);
+                len = CodedSizeLengthSigned(diff,0);
+                CodedValueLengthSigned(diff,len,head);
+                Blk.data.insert(Blk.data.end(),head,head+len);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    for (unsigned int i=0;i<Frames;i++)
+    {
+        for (uint32_t j=0;j<Blk.sizes[i];j++) Blk.data.push_back((uint8_t)(rand()>>7));
+    }
+}
+
+// the lace parsing of KaxInternalBlock::ReadData before KaxBlockLaces
+static bool ref_parse(const Block& Blk,std::vector<DataBuffer*>& Buffers,std::vector<int32>& SizeList)
+{
+    const binary* start = &Blk.data[0];
+    uint32 pos = 1;
+    uint32 last_size = (uint32)Blk.data.size() - 1;
+    uint8 frame_num = start[0];
+    int32 frame_size;
+    uint32 size_read;
+    uint64 size_unknown;
+    uint8 index;
+
+    SizeList.resize(frame_num + 1);
+
+    switch (Blk.lacing)
+    {
+    case LACING_XIPH:
+        for (index=0;index<frame_num;index++)
+        {
+            frame_size = 0;
+            uint8 value;
+            do
+            {
+                value = start[pos++];
+                frame_size += value;
+                last_size--;
+            } while (value==0xff);
+            SizeList[index] = frame_size;
+            last_size -= frame_size;
+        }
+        SizeList[index] = last_size;
+        break;
+    case LACING_EBML:
+        size_read = last_size;
+        frame_size = (int32)ReadCodedSizeValue(start+pos,size_read,size_unknown);
+        if (!frame_size || ((uint32)(frame_size+size_read)>last_size)) return false;
+        SizeList[0] = frame_size;
+        pos += size_read;
+        last_size -= frame_size + size_read;
+        for (index=1;index<frame_num;index++)
+        {
+            size_read = last_size;
+            frame_size += (int32)ReadCodedSizeSignedValue(start+pos,size_read,size_unknown);
+            if (!frame_size || ((uint32)(frame_size+size_read)>last_size)) return false;
+            SizeList[index] = frame_size;
+            pos += size_read;
+            last_size -= frame_size + size_read;
+        }
+        if (index<=frame_num) SizeList[index] = last_size;
+        break;
+    case LACING_FIXED:
+        for (index=0;index<=frame_num;index++)
+        {
+            SizeList[index] = last_size / (frame_num + 1);
+        }
+        break;
+    default:
+        return false;
+    }
+
+    for (index=0;index<=frame_num;index++)
+    {
+        Buffers.push_back(new DataBuffer(const_cast<binary*>(start)+pos,SizeList[index]));
+        pos += SizeList[index];
+    }
+    return true;
+}
+
+static void ref_release(std::vector<DataBuffer*>& Buffers)
+{
+    for (size_t i=0;i<Buffers.size();i++)
+    {
+        delete Buffers[i];
+    }
+    Buffers.clear();
+}
+
+static double bench_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static bool verify()
+{
+    static const LacingType lacings[] = { LACING_XIPH, LACING_EBML, LACING_FIXED };
+    Block blk;
+    KaxBlockLaces laces,heads;
+
+    srand(1);
+    for (unsigned int i=0;i<600;i++)
+    {
+        LacingType lacing = lacings[i%3];
+        unsigned int frames = 1 + rand()%256;
+        if (lacing==LACING_EBML && frames==1) frames = 2;
+        make_block(blk,lacing,frames);
+
+        const binary* data = &blk.data[0];
+        uint32 size = (uint32)blk.data.size();
+        std::vector<DataBuffer*> buffers;
+        std::vector<int32> size_list;
+
+        // the uint8 frame index of the reference never gets past 255 frames
+        bool with_ref = (frames<256);
+        bool ok = laces.Parse(data,size,lacing) && (laces.NumberFrames()==frames) &&
+            ( (!with_ref) || (ref_parse(blk,buffers,size_list) && (buffers.size()==frames)) );
+        for (unsigned int j=0;ok && j<frames;j++)
+        {
+            ok = (laces[j].Size==blk.sizes[j]) &&
+                ( (!with_ref) || ((laces[j].Size==buffers[j]->Size()) && (laces[j].Buffer==buffers[j]->Buffer())) );
+        }
+        ref_release(buffers);
+        if (!ok)
+        {
+            printf("mismatch: lacing %u frames %u size %u\n",(unsigned int)lacing,frames,size);
+            return false;
+        }
+
+        // the sizes from just the lace head, which can't be parsed from less
+        uint32 head = laces.HeadSize();
+        ok = heads.ParseHead(data,head,size,lacing) && (heads.NumberFrames()==frames) && (heads.HeadSize()==head);
+        for (unsigned int j=0;ok && j<frames;j++)
+        {
+            ok = (heads[j].Size==laces[j].Size) && (heads[j].Buffer==NULL);
+        }
+        if ( (!ok) || heads.ParseHead(data,head-1,size,lacing) )
+        {
+            printf("head mismatch: lacing %u frames %u head %u\n",(unsigned int)lacing,frames,head);
+            return false;
+        }
+
+        // any part of the block either fails or stays inside it
+        for (uint32 part=0;part<size && part<600;part++)
+        {
+            if (false==laces.Parse(data,part,lacing)) continue;
+            const binary* end = data + laces.HeadSize();
+            for (unsigned int j=0;j<laces.NumberFrames();j++)
+            {
+                if (laces[j].Buffer!=end) ok = false;
+                end += laces[j].Size;
+            }
+            if ( (!ok) || (end!=(data+part)) )
+            {
+                printf("out of bounds: lacing %u frames %u part %u\n",(unsigned int)lacing,frames,part);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// millions of frames per second over about 0.2 seconds of parsing Blocks
+static double measure(const std::vector<Block>& Blocks,bool Reference)
+{
+    volatile uint32_t sink = 0;
+    uint64_t frames = 0;
+    double start = bench_time(),elapsed;
+    KaxBlockLaces laces;
+
+    do
+    {
+        for (size_t i=0;i<Blocks.size();i++)
+        {
+            const Block& blk = Blocks[i];
+            if (Reference)
+            {
+                // a new block every time, like the reader creates
+                std::vector<DataBuffer*> block_buffers;
+                std::vector<int32> block_sizes;
+                ref_parse(blk,block_buffers,block_sizes);
+                sink ^= block_buffers.back()->Size();
+                frames += block_buffers.size();
+                ref_release(block_buffers);
+            } else {
+                laces.Parse(&blk.data[0],(uint32)blk.data.size(),blk.lacing);
+                sink ^= laces[laces.NumberFrames()-1].Size;
+                frames += laces.NumberFrames();
+            }
+        }
+        elapsed = bench_time()-start;
+    } while (elapsed<0.2);
+
+    return frames/1e6/elapsed;
+}
+
+int main(int argc,char **argv)
+{
+    static const LacingType lacings[] = { LACING_XIPH, LACING_EBML, LACING_FIXED };
+    static const char* names[] = { "xiph", "ebml", "fixed" };
+    static const unsigned int counts[] = { 8, 32, 180 };
+
+    bool ok = verify();
+    printf("verify:      %s\n",ok?"ok":"FAILED");
+    printf("%6s %7s %16s %16s\n","lacing","frames","reference","KaxBlockLaces");
+
+    for (size_t l=0;l<sizeof(lacings)/sizeof(lacings[0]);l++)
+    {
+        for (size_t c=0;c<sizeof(counts)/sizeof(counts[0]);c++)
+        {
+            std::vector<Block> blocks(64);
+            for (size_t i=0;i<blocks.size();i++)
+            {
+                make_block(blocks[i],lacings[l],counts[c]);
+            }
+            double ref = measure(blocks,true);
+            double fast = measure(blocks,false);
+            printf("%6s %7u %9.1f Mfr/s %9.1f Mfr/s\n",names[l],counts[c],ref,fast);
+        }
+    }
+
+    return ok ? 0 : 2;
+}
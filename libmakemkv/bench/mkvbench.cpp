@@ -0,0 +1,1139 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+//
+// mkvbench - synthetic MkvCreateFile throughput benchmark
+//
+// Muxes generated tracks (video GOPs, laced audio, zlib compressed
+// subtitles) into a null or memory write target and reports frames/s,
+// MB/s, heap allocations per frame and per cluster once warmed up, and
+// write target call counts. Every mux gets its own world through the World
+// parameter, -j runs several of them at once on their own threads.
+//
+
+#include <libmkv/libmkv.h>
+#include <lgpl/world.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <new>
+#include <vector>
+#include <zlib.h>
+#include <pthread.h>
+
+// heap allocations of all libraries. With glibc malloc itself is replaced,
+// which also counts the malloc/realloc calls of libebml and libmatroska,
+// elsewhere only operator new is. Sanitizers replace them themselves, under
+// those nothing is counted.
+static volatile uint64_t bench_allocs = 0;
+
+static inline void bench_count_alloc()
+{
+    __atomic_add_fetch(&bench_allocs,1,__ATOMIC_RELAXED);
+}
+
+static inline uint64_t bench_alloc_count()
+{
+    return __atomic_load_n(&bench_allocs,__ATOMIC_RELAXED);
+}
+
+#if defined(__SANITIZE_THREAD__) || defined(__SANITIZE_ADDRESS__)
+#define MKVBENCH_NO_ALLOC_COUNT
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer) || __has_feature(address_sanitizer)
+#define MKVBENCH_NO_ALLOC_COUNT
+#endif
+#endif
+
+#if defined(MKVBENCH_NO_ALLOC_COUNT)
+
+#elif defined(__GLIBC__)
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count,size_t size);
+extern "C" void* __libc_realloc(void* p,size_t size);
+
+extern "C" void* malloc(size_t size) throw()
+{
+    bench_count_alloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count,size_t size) throw()
+{
+    bench_count_alloc();
+    return __libc_calloc(count,size);
+}
+
+extern "C" void* realloc(void* p,size_t size) throw()
+{
+    bench_count_alloc();
+    return __libc_realloc(p,size);
+}
+
+#else
+
+void* operator new(size_t size)
+{
+    bench_count_alloc();
+    void* p = malloc(size?size:1);
+    if (NULL==p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    bench_count_alloc();
+    void* p = malloc(size?size:1);
+    if (NULL==p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size,const std::nothrow_t&) throw()
+{
+    bench_count_alloc();
+    return malloc(size?size:1);
+}
+
+void* operator new[](size_t size,const std::nothrow_t&) throw()
+{
+    bench_count_alloc();
+    return malloc(size?size:1);
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    free(p);
+}
+
+void operator delete(void* p,size_t) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p,size_t) throw()
+{
+    free(p);
+}
+
+void operator delete(void* p,const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p,const std::nothrow_t&) throw()
+{
+    free(p);
+}
+
+#endif
+
+//
+// world
+//
+// Each mux passes its own world to MkvCreateFileResumable and the process
+// world stays world.cpp's default one, which drops chunk refs. A ref released
+// through any world but the one of its mux never comes back to its source.
+// The muxer, compression and prefetch threads of a mux all call its world.
+class CBenchWorld : public IWorld
+{
+private:
+    uint32_t                m_Seed;
+public:
+    volatile uint64_t       releases;
+    volatile uint64_t       foreign;    // refs of another mux's chunks
+public:
+    CBenchWorld() : m_Seed(1) , releases(0) , foreign(0) {}
+    void  __cdecl debug_trace(const char *str) { if (getenv("MKVBENCH_TRACE")) fprintf(stderr,"trace: %s\n",str); }
+    uint8_t __cdecl random_byte() { m_Seed = m_Seed*1103515245+12345; return (uint8_t)(m_Seed>>16); }
+    void  __cdecl uc_progress(IMkvTrack* track,uint64_t* value) {}
+    void  __cdecl uc_emptytrack(IMkvTrack* input,unsigned int id,struct _MkvTrackInfo *info) {}
+    void  __cdecl free_chunk_ref(void* ref);
+    void  __cdecl iso6392T(char* lang) {}
+};
+
+//
+// memory
+//
+// kB of a Vm* line of /proc/self/status, 0 where there is none
+static uint64_t bench_vm_kb(const char* Name)
+{
+    char line[128];
+    uint64_t kb = 0;
+    size_t len = strlen(Name);
+    FILE* f = fopen("/proc/self/status","r");
+    if (NULL==f) return 0;
+    while (fgets(line,sizeof(line),f))
+    {
+        if ( (0==strncmp(line,Name,len)) && (line[len]==':') )
+        {
+            kb = strtoull(line+len+1,NULL,10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// peak resident size of the process, the kernel keeps it so nothing is missed
+// between two samples
+static uint64_t bench_peak_kb()
+{
+    struct rusage usage;
+    if (0!=getrusage(RUSAGE_SELF,&usage)) return 0;
+    return (uint64_t)usage.ru_maxrss;
+}
+
+// MaxPeak is a budget in bytes, -1 for none
+static bool bench_peak_ok(uint64_t PeakKb,int64_t MaxPeak)
+{
+    return (MaxPeak<0) || ( (0!=PeakKb) && ((PeakKb*1024)<=(uint64_t)MaxPeak) );
+}
+
+static void bench_print_peak(uint64_t PeakKb,int64_t MaxPeak)
+{
+    printf("memory:      peak %.1f MB",PeakKb*1024/1e6);
+    if (MaxPeak>=0)
+    {
+        printf(" (budget %.1f MB%s)",MaxPeak/1e6,bench_peak_ok(PeakKb,MaxPeak)?"":", too much");
+    }
+}
+
+// resident size and heap allocations once a quarter of the synthetic video is
+// generated and at its last frame, what keeps growing between the two grows
+// with the title
+static uint64_t rss_quarter_kb = 0;
+static uint64_t rss_end_kb = 0;
+static uint64_t allocs_quarter = 0;
+static uint64_t allocs_end = 0;
+
+//
+// frames
+//
+// chunk timecode units per second
+static const int64_t MKV_CLOCK = 1080000000;
+
+// nanoseconds the sources sleep per MB they generate, to stand in for the
+// latency of a disc read
+static uint64_t input_latency_ns = 0;
+
+class CBenchSource;
+
+// a chunk goes back to its source's free list once the queue and every
+// get_ref holder let go of it, which with -p may be on another thread
+class CBenchChunk : public IMkvChunk
+{
+public:
+    CBenchSource*           owner;
+    volatile unsigned int   refs;
+    std::vector<uint8_t>    data;
+    std::vector<uint8_t>    comp;
+    bool                    compressed;
+    z_stream                zs;         // kept across recycles, compress2 allocates per call
+    int                     zs_level;   // 0 until zs is initialized
+public:
+    CBenchChunk() : zs_level(0) {}
+    virtual ~CBenchChunk() { if (0!=zs_level) deflateEnd(&zs); }
+    const uint8_t*  get_data() { return compressed ? &comp[0] : &data[0]; }
+    unsigned int    get_size() { return (unsigned int)(compressed ? comp.size() : data.size()); }
+    void*           get_ref() { __atomic_add_fetch(&refs,1,__ATOMIC_RELAXED); return this; }
+    void            release();
+    bool            compress_start(unsigned int compressionType,unsigned int compressionLevel);
+    bool            compress_wait() { return true; }
+    unsigned int    compress_srcsize() { return (unsigned int)data.size(); }
+};
+
+bool CBenchChunk::compress_start(unsigned int compressionType,unsigned int compressionLevel)
+{
+    if ( (compressionType!=MKV_TRACK_COMPRESSION_ZLIB) || compressed ) return true;
+
+    int level = compressionLevel?compressionLevel:6;
+    if (level!=zs_level)
+    {
+        if (0!=zs_level) deflateEnd(&zs);
+        zs_level = 0;
+        memset(&zs,0,sizeof(zs));
+        if (Z_OK!=deflateInit(&zs,level)) return false;
+        zs_level = level;
+    } else {
+        if (Z_OK!=deflateReset(&zs)) return false;
+    }
+
+    comp.resize(compressBound((uLong)data.size()));
+    zs.next_in = &data[0];
+    zs.avail_in = (uInt)data.size();
+    zs.next_out = &comp[0];
+    zs.avail_out = (uInt)comp.size();
+    if (Z_STREAM_END!=deflate(&zs,Z_FINISH)) return false;
+    comp.resize(zs.total_out);
+    compressed = true;
+    return true;
+}
+
+class CBenchSource : public IMkvFrameSource
+{
+private:
+    MkvTrackType                m_Type;
+    unsigned int                m_Index;
+    int64_t                     m_Next;
+    int64_t                     m_Count;
+    int64_t                     m_Duration;
+    uint32_t                    m_Seed;
+    uint64_t                    m_Latency;      // ns owed to input_latency_ns
+    pthread_mutex_t             m_FreeLock;
+    std::vector<CBenchChunk*>   m_Free;
+    std::vector<CBenchChunk*>   m_Queue;
+    size_t                      m_Head;
+    size_t                      m_Created;
+    bool                        m_Probe;        // records the memory globals
+public:
+    CBenchWorld*                world;
+    uint64_t                    bytes;
+    uint64_t                    frames;
+public:
+    CBenchSource(MkvTrackType Type,unsigned int Index,int64_t Seconds,CBenchWorld* World,bool Probe);
+    virtual ~CBenchSource();
+    unsigned int    GetAvailableFramesCount() { return (unsigned int)(m_Queue.size()-m_Head); }
+    void            PopFrame();
+    bool            SourceFinished() { return (m_Next>=m_Count) && (m_Head==m_Queue.size()); }
+    bool            FetchFrames(unsigned int Count,bool Force);
+    IMkvChunk*      PeekFrame(unsigned int Index) { return m_Queue[m_Head+Index]; }
+    bool            UpdateTrackInfo(MkvTrackInfo* Info);
+    void            Recycle(CBenchChunk* Chunk);
+    void            Skip(uint64_t Frames);
+    // chunks the muxer still holds a ref of
+    size_t          Held() { return m_Created - m_Free.size() - (m_Queue.size()-m_Head); }
+private:
+    void            Generate();
+};
+
+void CBenchChunk::release()
+{
+    if (0==__atomic_sub_fetch(&refs,1,__ATOMIC_ACQ_REL)) owner->Recycle(this);
+}
+
+void __cdecl CBenchWorld::free_chunk_ref(void* ref)
+{
+    CBenchChunk* chunk = (CBenchChunk*)ref;
+    __atomic_add_fetch(&releases,1,__ATOMIC_RELAXED);
+    if (chunk->owner->world!=this) __atomic_add_fetch(&foreign,1,__ATOMIC_RELAXED);
+    chunk->release();
+}
+
+CBenchSource::CBenchSource(MkvTrackType Type,unsigned int Index,int64_t Seconds,CBenchWorld* World,bool Probe)
+    : m_Type(Type) , m_Index(Index) , m_Next(0) , m_Seed(Index*7+1) , m_Latency(0) , m_Head(0) , m_Created(0) ,
+      m_Probe(Probe) , world(World) , bytes(0) , frames(0)
+{
+    switch(m_Type)
+    {
+    case mttVideo: m_Duration = MKV_CLOCK/24; break;
+    case mttAudio: m_Duration = MKV_CLOCK*32/1000; break;
+    default: m_Duration = MKV_CLOCK*2; break;
+    }
+    m_Count = (Seconds*MKV_CLOCK)/m_Duration;
+    if (m_Type==mttSubtitle) m_Count /= 3;
+    pthread_mutex_init(&m_FreeLock,NULL);
+}
+
+CBenchSource::~CBenchSource()
+{
+    for (size_t i=m_Head;i<m_Queue.size();i++) delete m_Queue[i];
+    for (size_t i=0;i<m_Free.size();i++) delete m_Free[i];
+    pthread_mutex_destroy(&m_FreeLock);
+}
+
+void CBenchSource::Recycle(CBenchChunk* Chunk)
+{
+    pthread_mutex_lock(&m_FreeLock);
+    m_Free.push_back(Chunk);
+    pthread_mutex_unlock(&m_FreeLock);
+}
+
+void CBenchSource::PopFrame()
+{
+    m_Queue[m_Head++]->release();
+    // the muxer looks ahead, so the queue rarely runs empty
+    if ( (m_Head==m_Queue.size()) || (m_Head>=256) )
+    {
+        m_Queue.erase(m_Queue.begin(),m_Queue.begin()+m_Head);
+        m_Head=0;
+    }
+}
+
+// a resumed mux starts each stream after the frames already in the file,
+// they are generated again so that the later ones come out the same
+void CBenchSource::Skip(uint64_t Frames)
+{
+    for (uint64_t i=0;i<Frames;i++)
+    {
+        if (m_Next>=m_Count) break;
+        Generate();
+        PopFrame();
+    }
+}
+
+bool CBenchSource::FetchFrames(unsigned int Count,bool Force)
+{
+    uint64_t start = bytes;
+    while ( (GetAvailableFramesCount()<Count) && (m_Next<m_Count) )
+    {
+        Generate();
+    }
+
+    // sleeps are at least a millisecond, so that both the muxer and the
+    // prefetch thread sleep the same in total
+    m_Latency += (bytes-start)*input_latency_ns/1000000;
+    if (m_Latency>=1000000)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t)(m_Latency/1000000000);
+        ts.tv_nsec = (long)(m_Latency%1000000000);
+        nanosleep(&ts,NULL);
+        m_Latency = 0;
+    }
+    return true;
+}
+
+void CBenchSource::Generate()
+{
+    static const int gop_order[4] = { 0, 3, 1, 2 };
+    static const int64_t cluster_period = 2*MKV_CLOCK;
+    static const int64_t video_delay = MKV_CLOCK/10;
+
+    CBenchChunk* chunk = NULL;
+    int64_t k = m_Next++;
+    size_t size;
+
+    pthread_mutex_lock(&m_FreeLock);
+    if (!m_Free.empty())
+    {
+        chunk = m_Free.back();
+        m_Free.pop_back();
+    }
+    pthread_mutex_unlock(&m_FreeLock);
+    if (NULL==chunk)
+    {
+        chunk = new CBenchChunk();
+        chunk->owner = this;
+        m_Created++;
+    }
+    chunk->refs = 1;
+    chunk->compressed = false;
+    // a caller's chunk may have the reserved bit set, libmkv has to ignore it
+    chunk->flags = MKV_CHUNK_LIBMKV_REF;
+    chunk->duration = m_Duration;
+
+    switch(m_Type)
+    {
+    case mttVideo:
+        // IBBP GOPs in decode order, a keyframe and cluster every 2 seconds
+        chunk->timecode = ((k/4)*4+gop_order[k%4])*m_Duration+video_delay;
+        if ((k%48)==0) chunk->flags |= MKV_CHUNK_KEYFRAME|MKV_CHUNK_CLUSTER_START;
+        if ( ((k%4)==1) || ((k%4)==2) ) chunk->flags |= MKV_CHUNK_DISCARDABLE;
+        if ((k%3)==0) chunk->flags |= MKV_CHUNK_OLD_BLOCK;
+        if ((k%480)==0) chunk->flags |= MKV_CHUNK_CHAPTER_MARK;
+        size = ((k%48)==0) ? 60000 : (12000+(k%7)*1000);
+        break;
+    case mttAudio:
+        // audio follows the video cluster starts
+        chunk->timecode = k*m_Duration;
+        chunk->flags |= MKV_CHUNK_KEYFRAME;
+        if ( (k>0) && (chunk->timecode>=video_delay) &&
+            ( ((chunk->timecode-video_delay)/cluster_period) != (((k-1)*m_Duration-video_delay)/cluster_period) ||
+              (((k-1)*m_Duration)<video_delay) ) )
+        {
+            chunk->flags |= MKV_CHUNK_CLUSTER_START;
+        }
+        size = (m_Index&1) ? 768 : (640+(k%3));
+        break;
+    default:
+        chunk->timecode = k*m_Duration*3+MKV_CLOCK;
+        chunk->flags |= MKV_CHUNK_KEYFRAME;
+        if ((k%5)==4) chunk->flags |= MKV_CHUNK_AUTO_DURATION|MKV_CHUNK_OLD_BLOCK;
+        size = 8000;
+        break;
+    }
+
+    chunk->data.resize(size);
+    if (m_Type==mttSubtitle)
+    {
+        for (size_t i=0;i<size;i++) chunk->data[i] = (uint8_t)(i%17);
+    } else {
+        for (size_t i=0;i<size;i++)
+        {
+            m_Seed = m_Seed*1664525+1013904223;
+            chunk->data[i] = (uint8_t)(m_Seed>>24);
+        }
+        if (m_Type==mttAudio)
+        {
+            chunk->data[0]=0x0b;
+            chunk->data[1]=0x77;
+        }
+    }
+
+    bytes += size;
+    frames++;
+    m_Queue.push_back(chunk);
+
+    if ( m_Probe && (m_Type==mttVideo) )
+    {
+        if (k==(m_Count/4))
+        {
+            rss_quarter_kb = bench_vm_kb("VmRSS");
+            allocs_quarter = bench_alloc_count();
+        }
+        if (k==(m_Count-1))
+        {
+            rss_end_kb = bench_vm_kb("VmRSS");
+            allocs_end = bench_alloc_count();
+        }
+    }
+}
+
+bool CBenchSource::UpdateTrackInfo(MkvTrackInfo* Info)
+{
+    static const MkvProfileTrackInfo zlib_profile = { MKV_TRACK_COMPRESSION_ZLIB, 9 };
+    static const uint8_t codec_private[4] = { 1, 2, 3, 4 };
+
+    Info->type = m_Type;
+    Info->default_duration = m_Duration;
+    switch(m_Type)
+    {
+    case mttVideo:
+        Info->codec_id = "V_MPEG4/ISO/AVC";
+        Info->codec_private = codec_private;
+        Info->codec_private_size = sizeof(codec_private);
+        Info->mkv_flags = MKV_TRACK_FLAG_DEFAULT;
+        Info->u.video.pixel_h = Info->u.video.display_h = 1920;
+        Info->u.video.pixel_v = Info->u.video.display_v = 1080;
+        Info->u.video.fps_n = 24;
+        Info->u.video.fps_d = 1;
+        break;
+    case mttAudio:
+        Info->codec_id = "A_AC3";
+        Info->lang = "eng";
+        Info->mkv_flags = MKV_TRACK_FLAG_LACING;
+        Info->u.audio.sample_rate = 48000;
+        Info->u.audio.channels_count = 6;
+        break;
+    default:
+        Info->codec_id = "S_HDMV/PGS";
+        Info->lang = "fre";
+        Info->default_duration = 0;
+        Info->profile_track_info = &zlib_profile;
+        break;
+    }
+    return true;
+}
+
+class CBenchTrack : public IMkvTrack
+{
+public:
+    std::vector<CBenchSource*>  streams;
+public:
+    // only one track at a time may Probe the memory use
+    CBenchTrack(int64_t Seconds,unsigned int AudioCount,unsigned int SubCount,CBenchWorld* World,bool Probe)
+    {
+        streams.push_back(new CBenchSource(mttVideo,0,Seconds,World,Probe));
+        for (unsigned int i=0;i<AudioCount;i++)
+        {
+            streams.push_back(new CBenchSource(mttAudio,1+i,Seconds,World,false));
+        }
+        for (unsigned int i=0;i<SubCount;i++)
+        {
+            streams.push_back(new CBenchSource(mttSubtitle,1+AudioCount+i,Seconds,World,false));
+        }
+    }
+    virtual ~CBenchTrack()
+    {
+        for (size_t i=0;i<streams.size();i++)
+        {
+            delete streams[i];
+        }
+    }
+    unsigned int MkvGetStreamCount() { return (unsigned int)streams.size(); }
+    IMkvFrameSource* MkvGetStream(unsigned int Index) { return streams[Index]; }
+};
+
+class CBenchTitle : public IMkvTitleInfo
+{
+public:
+    unsigned int    chapters;
+    uint64_t        duration;
+public:
+    unsigned int GetChapterCount() { return chapters; }
+    void GetChapterInfo(MkvChapterInfo *info,unsigned int chapter_id) {}
+    void GetMkvTitleInfo(MkvTitleInfo *info) { info->name = "mkvbench"; info->duration = duration; }
+    unsigned int GetAttachmentCount() { return 0; }
+    void GetAttachmentInfo(MkvAttachmentInfo* info,unsigned int attachment_id) {}
+};
+
+//
+// remux input
+//
+class CBenchFile : public IMkvReadSource
+{
+public:
+    FILE*       file;
+    uint64_t    bytes;
+public:
+    CBenchFile() : file(NULL) , bytes(0) {}
+    ~CBenchFile() { if (file) fclose(file); }
+    bool Read(void *Data,unsigned int Size,unsigned int* ReadSize)
+    {
+        *ReadSize = (unsigned int)fread(Data,1,Size,file);
+        bytes += *ReadSize;
+        return (*ReadSize==Size) || (0==ferror(file));
+    }
+    bool Seek(uint64_t Offset) { return 0==fseeko(file,(off_t)Offset,SEEK_SET); }
+};
+
+//
+// output
+//
+class CBenchTarget : public IMkvWriteTarget
+{
+public:
+    bool                    keep;
+    bool                    sequential;
+    IMkvWriteTarget*        file;
+    std::vector<uint8_t>    data;
+    uint64_t                size;
+    uint64_t                writes;
+    uint64_t                overwrites;
+    uint64_t                fail_at;    // writes past this size fail, 0 for never
+public:
+    CBenchTarget(bool Keep,bool Sequential) : keep(Keep) , sequential(Sequential) , file(NULL) , size(0) , writes(0) , overwrites(0) , fail_at(0) {}
+    bool Write(const void *Data,unsigned int Size)
+    {
+        if ( (0!=fail_at) && ((size+Size)>fail_at) ) return false;
+        writes++;
+        size += Size;
+        if (keep) data.insert(data.end(),(const uint8_t*)Data,((const uint8_t*)Data)+Size);
+        return (NULL==file) || file->Write(Data,Size);
+    }
+    bool Overwrite(uint64_t Offset,const void *Data,unsigned int Size)
+    {
+        overwrites++;
+        if (sequential) return false;
+        if ((Offset+Size)>size) return false;
+        if (keep) memcpy(&data[(size_t)Offset],Data,Size);
+        return (NULL==file) || file->Overwrite(Offset,Data,Size);
+    }
+};
+
+//
+// resume
+//
+class CBenchCheckpoint : public IMkvCheckpoint
+{
+public:
+    CBenchTarget*           target;
+    std::vector<uint8_t>    data;           // the last checkpoint
+    bool                    snapshot;       // keep the output at the first checkpoint
+    std::vector<uint8_t>    first_data;
+    std::vector<uint8_t>    first_output;
+public:
+    CBenchCheckpoint(CBenchTarget* Target,bool Snapshot) : target(Target) , snapshot(Snapshot) {}
+    bool SaveCheckpoint(const void* Data,unsigned int Size)
+    {
+        data.assign((const uint8_t*)Data,((const uint8_t*)Data)+Size);
+        if (snapshot && first_data.empty())
+        {
+            first_data = data;
+            first_output = target->data;
+        }
+        return true;
+    }
+};
+
+// continues the mux of Checkpoint with Target holding what was written
+// before, cut down to the size the checkpoint was taken at
+static bool bench_resume(CBenchTarget* Target,const std::vector<uint8_t>& Checkpoint,CBenchCheckpoint* NewCheckpoint,
+    int64_t Seconds,unsigned int AudioCount,unsigned int SubCount,IMkvTitleInfo* Title,MkvFormatInfo* Format)
+{
+    CBenchWorld world;
+    CBenchTrack track(Seconds,AudioCount,SubCount,&world,false);
+    std::vector<MkvResumeStream> streams(track.streams.size());
+    MkvResumeInfo info;
+
+    if (false==MkvGetResumeInfo(&Checkpoint[0],(unsigned int)Checkpoint.size(),&info,&streams[0],(unsigned int)streams.size())) return false;
+    if ( (info.stream_count!=streams.size()) || (info.file_size>Target->data.size()) ) return false;
+
+    Target->data.resize((size_t)info.file_size);
+    Target->size = info.file_size;
+    for (size_t i=0;i<streams.size();i++)
+    {
+        track.streams[i]->Skip(streams[i].frames);
+    }
+    return MkvCreateFileResumable(Target,&track,"mkvbench",Title,Format,&world,NULL,NewCheckpoint,&Checkpoint[0],(unsigned int)Checkpoint.size());
+}
+
+static double bench_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//
+// concurrent muxes
+//
+// one of the muxes of -j, with its own world, input and output
+class CBenchJob
+{
+public:
+    int64_t         seconds;
+    unsigned int    audio_count;
+    unsigned int    sub_count;
+    bool            prefetch;
+    MkvFormatInfo   format;
+    CBenchWorld     world;
+    CBenchTarget    target;
+    size_t          held;
+    bool            started;
+    bool            ok;
+    pthread_t       thread;
+public:
+    CBenchJob(int64_t Seconds,unsigned int AudioCount,unsigned int SubCount,bool Prefetch,const MkvFormatInfo* Format)
+        : seconds(Seconds) , audio_count(AudioCount) , sub_count(SubCount) , prefetch(Prefetch) ,
+          target(false,Format->profile.streamingOutput) , held(0) , started(false) , ok(false)
+    {
+        memcpy(&format,Format,sizeof(format));
+    }
+    void Run();
+    static void* RunStatic(void* Job)
+    {
+        ((CBenchJob*)Job)->Run();
+        return NULL;
+    }
+};
+
+void CBenchJob::Run()
+{
+    CBenchTrack track(seconds,audio_count,sub_count,&world,false);
+    CBenchTitle title;
+    title.chapters = (unsigned int)(seconds/20)+2;
+    title.duration = seconds*MKV_CLOCK;
+
+    IMkvTrack* input = &track;
+    IMkvPrefetchTrack* prefetch_track = NULL;
+    if (prefetch)
+    {
+        CThreadWorld thread_world(&world);
+        prefetch_track = MkvCreatePrefetchTrack(&track,NULL);
+        if (NULL==prefetch_track) return;
+        input = prefetch_track;
+    }
+
+    ok = MkvCreateFileResumable(&target,input,"mkvbench",&title,&format,&world,NULL,NULL,NULL,0);
+
+    if (prefetch_track)
+    {
+        CThreadWorld thread_world(&world);
+        prefetch_track->Release();
+    }
+    for (size_t i=0;i<track.streams.size();i++)
+    {
+        held += track.streams[i]->Held();
+    }
+    if ( (0!=held) || (0!=world.foreign) ) ok = false;
+}
+
+// runs Count muxes of the same title at once, they all have to come out the
+// same size with the same writes
+static bool bench_concurrent(unsigned int Count,int64_t Seconds,unsigned int AudioCount,unsigned int SubCount,bool Prefetch,const MkvFormatInfo* Format,int64_t MaxPeak)
+{
+    std::vector<CBenchJob*> jobs;
+    double time_start = bench_time();
+
+    for (unsigned int i=0;i<Count;i++)
+    {
+        CBenchJob* job = new CBenchJob(Seconds,AudioCount,SubCount,Prefetch,Format);
+        job->started = (0==pthread_create(&job->thread,NULL,CBenchJob::RunStatic,job));
+        jobs.push_back(job);
+    }
+    for (unsigned int i=0;i<Count;i++)
+    {
+        if (jobs[i]->started) pthread_join(jobs[i]->thread,NULL);
+    }
+
+    double elapsed = bench_time() - time_start;
+    if (elapsed<=0) elapsed=1e-9;
+
+    bool ok = true;
+    for (unsigned int i=0;i<Count;i++)
+    {
+        CBenchJob* job = jobs[i];
+        if ( (!job->started) || (!job->ok) ) ok = false;
+        if ( (job->target.size!=jobs[0]->target.size) || (job->target.writes!=jobs[0]->target.writes) ||
+            (job->target.overwrites!=jobs[0]->target.overwrites) )
+        {
+            ok = false;
+        }
+    }
+
+    uint64_t peak_kb = bench_peak_kb();
+    if (!bench_peak_ok(peak_kb,MaxPeak)) ok = false;
+
+    printf("result:      %s\n",ok?"ok":"FAILED");
+    printf("jobs:        %u concurrent muxes of %u seconds in %.3f s\n",Count,(unsigned int)Seconds,elapsed);
+    bench_print_peak(peak_kb,MaxPeak);
+    printf("\n");
+    for (unsigned int i=0;i<Count;i++)
+    {
+        CBenchJob* job = jobs[i];
+        char label[32];
+        sprintf(label,"job %u:",i);
+        printf("%-13s%s, %.1f MB, %llu writes, %llu overwrites, %llu refs released",label,
+            (job->started && job->ok)?"ok":"FAILED",job->target.size/1e6,(unsigned long long)job->target.writes,
+            (unsigned long long)job->target.overwrites,(unsigned long long)job->world.releases);
+        if ( (0!=job->held) || (0!=job->world.foreign) )
+        {
+            printf(", %u chunks not released, %llu released through another world",
+                (unsigned int)job->held,(unsigned long long)job->world.foreign);
+        }
+        printf("\n");
+        delete job;
+    }
+    return ok;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: mkvbench [-t seconds] [-a audio_tracks] [-s subtitle_tracks] [-c compress_threads] [-l 0|1] [-f 0|1] [-h 0|1] [-p 0|1] [-e us] [-i file] [-o file] [-w file] [-d 0|1] [-m bytes] [-b bytes] [-r 0|1] [-j jobs]\n"
+        "  -t  title length in seconds (default 600)\n"
+        "  -a  number of laced audio tracks (default 4)\n"
+        "  -s  number of zlib compressed subtitle tracks (default 2)\n"
+        "  -c  compression worker threads (default 0)\n"
+        "  -l  streaming output, the target rejects overwrites (default 0)\n"
+        "  -f  cues at the front of the file (default 0)\n"
+        "  -h  automatic header stripping (default 0)\n"
+        "  -p  read the input ahead on a prefetch thread (default 0)\n"
+        "  -e  input latency, the synthetic sources sleep this many microseconds per MB\n"
+        "      they generate (default 0)\n"
+        "  -i  remux an existing MKV file instead of the synthetic title\n"
+        "  -o  keep output in memory and write it to file\n"
+        "  -w  write output to file through the library's file target, with write-behind\n"
+        "  -d  O_DIRECT for -w (default 0)\n"
+        "  -m  fail if resident memory grows by more than this many bytes per cluster\n"
+        "      over the last three quarters of the synthetic title\n"
+        "  -b  fail if the peak resident size of the process is above this many bytes,\n"
+        "      the output kept in memory for -o and -r counts too\n"
+        "  -r  resume test: mux the synthetic title in memory, then again resuming from\n"
+        "      its first checkpoint, interrupted at 3/4 of the size and resumed from the\n"
+        "      last checkpoint, and compare the two files (default 0)\n"
+        "  -j  run this many muxes of the synthetic title at once, each on its own thread\n"
+        "      with its own world and output, and check they all come out the same\n"
+        "      (default 0, build out/mkvbench_tsan to run them under ThreadSanitizer)\n");
+}
+
+int main(int argc,char **argv)
+{
+    int64_t seconds = 600;
+    unsigned int audio_count = 4,sub_count = 2,compress_threads = 0;
+    bool streaming = false,cues_front = false,header_strip = false,prefetch = false;
+    const char* out_name = NULL;
+    const char* file_name = NULL;
+    bool direct_io = false;
+    const char* in_name = NULL;
+    int64_t max_growth = -1;
+    int64_t max_peak = -1;
+    bool resume = false;
+    unsigned int jobs = 0;
+
+    for (int i=1;i<argc;i++)
+    {
+        if ( (argv[i][0]!='-') || (argv[i][2]!=0) || ((i+1)>=argc) )
+        {
+            usage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        switch(argv[i-1][1])
+        {
+        case 't': seconds = atoll(value); break;
+        case 'a': audio_count = atoi(value); break;
+        case 's': sub_count = atoi(value); break;
+        case 'c': compress_threads = atoi(value); break;
+        case 'l': streaming = (0!=atoi(value)); break;
+        case 'f': cues_front = (0!=atoi(value)); break;
+        case 'h': header_strip = (0!=atoi(value)); break;
+        case 'p': prefetch = (0!=atoi(value)); break;
+        case 'e': input_latency_ns = strtoull(value,NULL,10)*1000; break;
+        case 'i': in_name = value; break;
+        case 'o': out_name = value; break;
+        case 'w': file_name = value; break;
+        case 'd': direct_io = (0!=atoi(value)); break;
+        case 'm': max_growth = atoll(value); break;
+        case 'b': max_peak = atoll(value); break;
+        case 'r': resume = (0!=atoi(value)); break;
+        case 'j': jobs = atoi(value); break;
+        default: usage(); return 1;
+        }
+    }
+
+    if ( resume && ( (NULL!=in_name) || streaming || (NULL!=file_name) ) )
+    {
+        fprintf(stderr,"-r needs the synthetic title and in memory output that can be overwritten\n");
+        return 1;
+    }
+    if ( (0!=jobs) && ( (NULL!=in_name) || (NULL!=out_name) || (NULL!=file_name) || resume ) )
+    {
+        fprintf(stderr,"-j muxes the synthetic title into a null target, without -i, -o, -w or -r\n");
+        return 1;
+    }
+
+    CBenchWorld world;
+    CBenchTrack track(seconds,audio_count,sub_count,&world,true);
+
+    CBenchTitle title;
+    title.chapters = (unsigned int)(seconds/20)+2;
+    title.duration = seconds*MKV_CLOCK;
+
+    MkvFormatInfo format;
+    memset(&format,0,sizeof(format));
+    format.profile.version = MKV_PROFILE_VERSION;
+    format.profile.streamingOutput = streaming;
+    format.profile.cuesAtFront = cues_front;
+    format.profile.autoHeaderStripping = header_strip;
+    format.compressionThreads = compress_threads;
+
+    if (0!=jobs)
+    {
+        return bench_concurrent(jobs,seconds,audio_count,sub_count,prefetch,&format,max_peak) ? 0 : 2;
+    }
+
+    IMkvTrack* input = &track;
+    IMkvTitleInfo* title_info = &title;
+    IMkvReader* reader = NULL;
+    CBenchFile in_file;
+    uint64_t in_size = 0;
+    if (NULL!=in_name)
+    {
+        in_file.file = fopen(in_name,"rb");
+        if ( in_file.file && (0==fseeko(in_file.file,0,SEEK_END)) )
+        {
+            in_size = (uint64_t)ftello(in_file.file);
+            rewind(in_file.file);
+            reader = MkvOpenReader(&in_file);
+        }
+        if (NULL==reader)
+        {
+            fprintf(stderr,"can't read %s\n",in_name);
+            return 1;
+        }
+        input = reader;
+        title_info = reader;
+    }
+
+    IMkvPrefetchTrack* prefetch_track = NULL;
+    if (prefetch)
+    {
+        // the producer thread makes its callbacks to the world of this thread
+        CThreadWorld thread_world(&world);
+        prefetch_track = MkvCreatePrefetchTrack(input,NULL);
+        if (NULL==prefetch_track)
+        {
+            fprintf(stderr,"can't create prefetch track\n");
+            return 1;
+        }
+        input = prefetch_track;
+    }
+
+    CBenchTarget target( (out_name!=NULL) || resume ,streaming);
+    CBenchCheckpoint checkpoint(&target,true);
+
+    IMkvFileTarget* file_target = NULL;
+    if (NULL!=file_name)
+    {
+        MkvFileTargetOptions file_options;
+        memset(&file_options,0,sizeof(file_options));
+        file_options.direct_io = direct_io;
+        file_options.write_behind = true;
+        // a remux comes out about as large as its input
+        file_options.expected_size = in_size;
+        file_target = MkvCreateFileTarget(file_name,&file_options);
+        if (NULL==file_target)
+        {
+            fprintf(stderr,"can't create %s\n",file_name);
+            return 1;
+        }
+        target.file = file_target;
+    }
+
+    uint64_t allocs_start = bench_alloc_count();
+    // frames are generated on demand, so time and allocations include the
+    // source side; the generator recycles its chunks and zlib streams and
+    // adds little
+    double time_start = bench_time();
+
+    MkvMuxStats stats;
+    bool ok = MkvCreateFileResumable(&target,input,"mkvbench",title_info,&format,&world,&stats,resume?&checkpoint:NULL,NULL,0);
+    if (file_target)
+    {
+        if (false==file_target->Close()) ok = false;
+        file_target->Release();
+    }
+
+    double elapsed = bench_time() - time_start;
+    uint64_t allocs = bench_alloc_count() - allocs_start;
+
+    // every chunk ref is released once the prefetch track is gone too, a ref
+    // released the wrong way never comes back
+    MkvPrefetchStats pstats;
+    if (prefetch_track)
+    {
+        CThreadWorld thread_world(&world);
+        prefetch_track->GetPrefetchStats(&pstats);
+        prefetch_track->Release();
+    }
+    size_t held = 0;
+    for (size_t i=0;i<track.streams.size();i++)
+    {
+        held += track.streams[i]->Held();
+    }
+    if ( (0!=held) || (0!=world.foreign) ) ok = false;
+
+    uint64_t frames = 0,bytes = 0;
+    for (size_t i=0;i<track.streams.size();i++)
+    {
+        frames += track.streams[i]->frames;
+        bytes += track.streams[i]->bytes;
+    }
+    if (reader)
+    {
+        frames = stats.frames;
+        bytes = in_file.bytes;
+    }
+    if (elapsed<=0) elapsed=1e-9;
+
+    uint64_t peak_kb = bench_peak_kb();
+    if (!bench_peak_ok(peak_kb,max_peak)) ok = false;
+    double growth = 0;
+    bool have_growth = (NULL==reader) && (!resume) && (0!=rss_quarter_kb) && (0!=rss_end_kb) && (stats.clusters>=4);
+    bool growth_ok = true;
+    if (have_growth)
+    {
+        // clusters are evenly spread over the synthetic title
+        growth = ((double)rss_end_kb-(double)rss_quarter_kb)*1024/(stats.clusters*0.75);
+        growth_ok = (max_growth<0) || (growth<=max_growth);
+    }
+    if (!growth_ok) ok = false;
+
+    printf("result:      %s\n",ok?"ok":"FAILED");
+    if (reader)
+    {
+        printf("streams:     %u from %s\n",reader->MkvGetStreamCount(),in_name);
+    } else {
+        printf("streams:     %u video, %u audio, %u subtitle, %u seconds\n",1,audio_count,sub_count,(unsigned int)seconds);
+    }
+    printf("frames:      %llu (%.0f frames/s)\n",(unsigned long long)frames,frames/elapsed);
+    printf("input:       %.1f MB (%.1f MB/s)\n",bytes/1e6,bytes/1e6/elapsed);
+    printf("output:      %.1f MB (%.1f MB/s)\n",target.size/1e6,target.size/1e6/elapsed);
+    printf("time:        %.3f s\n",elapsed);
+    printf("allocs:      %llu (%.2f per frame",(unsigned long long)allocs,frames?((double)allocs/frames):0.0);
+    if (have_growth)
+    {
+        printf(", %.2f per cluster after the first quarter",(allocs_end-allocs_quarter)/(stats.clusters*0.75));
+    }
+    printf(")\n");
+    printf("writes:      %llu\n",(unsigned long long)target.writes);
+    printf("overwrites:  %llu\n",(unsigned long long)target.overwrites);
+    printf("stages:      total %.1f ms, fetch %.1f ms, compress %.1f ms, render %.1f ms, write %.1f ms\n",
+        stats.total.time_ns/1e6,stats.fetch.time_ns/1e6,stats.compress.time_ns/1e6,
+        stats.render.time_ns/1e6,stats.write.time_ns/1e6);
+    printf("blocks:      %llu in %llu clusters, %llu block heap allocations\n",
+        (unsigned long long)stats.blocks,(unsigned long long)stats.clusters,
+        (unsigned long long)stats.block_heap_allocs);
+    bench_print_peak(peak_kb,max_peak);
+    if (have_growth)
+    {
+        printf(", %.0f bytes per cluster after the first quarter%s",growth,growth_ok?"":" (too much)");
+    }
+    printf("\n");
+    if ( (0!=held) || (0!=world.foreign) )
+    {
+        printf("refs:        %u chunks not released, %llu released through another world\n",
+            (unsigned int)held,(unsigned long long)world.foreign);
+    }
+    if (prefetch_track)
+    {
+        printf("prefetch:    max %u frames / %.1f MB queued, fetch %.1f ms, producer wait %.1f ms, muxer wait %.1f ms\n",
+            pstats.max_frames,pstats.max_bytes/1e6,pstats.fetch.time_ns/1e6,
+            pstats.producer_wait.time_ns/1e6,pstats.consumer_wait.time_ns/1e6);
+    }
+
+    if (ok && resume)
+    {
+        // the second mux resumes the first at its first checkpoint, which
+        // keeps the time of the first, is interrupted at 3/4 of the file
+        // and resumed again from the last checkpoint it saved
+        CBenchTarget resumed(true,false);
+        CBenchCheckpoint resumed_checkpoint(&resumed,false);
+        const char* error = NULL;
+        if (checkpoint.first_data.empty())
+        {
+            error = "no checkpoint, the title is too short";
+        } else {
+            resumed.data.swap(checkpoint.first_output);
+            resumed.fail_at = target.size/4*3;
+            if (bench_resume(&resumed,checkpoint.first_data,&resumed_checkpoint,seconds,audio_count,sub_count,&title,&format))
+            {
+                error = "not interrupted";
+            } else {
+                const std::vector<uint8_t>& last = resumed_checkpoint.data.empty() ? checkpoint.first_data : resumed_checkpoint.data;
+                resumed.fail_at = 0;
+                if (false==bench_resume(&resumed,last,NULL,seconds,audio_count,sub_count,&title,&format))
+                {
+                    error = "resume failed";
+                } else if (resumed.data!=target.data) {
+                    error = "output differs";
+                }
+            }
+        }
+        printf("resume:      %s%s\n",error?"FAILED, ":"ok",error?error:"");
+        if (NULL!=error) ok = false;
+    }
+
+    if (ok && (NULL!=out_name))
+    {
+        FILE* f = fopen(out_name,"wb");
+        if ( (NULL==f) || (fwrite(&target.data[0],1,target.data.size(),f)!=target.data.size()) )
+        {
+            fprintf(stderr,"can't write %s\n",out_name);
+            ok = false;
+        }
+        if (f) fclose(f);
+    }
+
+    if (reader) reader->Release();
+
+    return ok ? 0 : 2;
+}
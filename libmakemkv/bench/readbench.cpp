@@ -0,0 +1,549 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+//
+// readbench - reading Matroska files back
+//
+// The library builds libebml with EBML_NO_READ, this program builds it with
+// the read side. It writes a test file with libmatroska and a copy of it with
+// damaged bytes, then checks against plain StdIOCallback reads that
+//  - FindNextElement through BufferedIOCallback, with buffers from 16 bytes
+//    up, finds the same elements at the same positions,
+//  - MmapIOCallback finds them too and returns the same binary payloads and
+//    block frames, read in place,
+//  - a segment read with SCOPE_LAZY_DATA gives the same tree as one read
+//    with SCOPE_ALL_DATA, and the Find methods give the info, tracks and cues
+//    that were written.
+// It then reports the time of a scan of the whole file, of a full segment
+// read and of a lazy read of the info, tracks and cues through each callback.
+//
+
+#include <ebml/StdIOCallback.h>
+#include <ebml/BufferedIOCallback.h>
+#include <ebml/MmapIOCallback.h>
+#include <ebml/EbmlStream.h>
+#include <ebml/EbmlHead.h>
+#include <ebml/EbmlSubHead.h>
+#include <ebml/EbmlUInteger.h>
+#include <ebml/EbmlFloat.h>
+#include <ebml/EbmlString.h>
+#include <ebml/EbmlUnicodeString.h>
+#include <ebml/EbmlBinary.h>
+#include <matroska/KaxSegment.h>
+#include <matroska/KaxInfo.h>
+#include <matroska/KaxInfoData.h>
+#include <matroska/KaxTracks.h>
+#include <matroska/KaxCluster.h>
+#include <matroska/KaxBlock.h>
+#include <matroska/KaxCues.h>
+#include <matroska/KaxCuesData.h>
+#include <matroska/KaxContexts.h>
+#include <lgpl/world.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+using namespace LIBMATROSKA_NAMESPACE;
+
+extern "C" IWorld* my_world()
+{
+    return NULL;
+}
+
+static const uint64_t TIMECODE_SCALE = 1000000;
+static const unsigned int TRACKS = 3;
+static const unsigned int CLUSTERS = 200;
+static const unsigned int CLUSTER_BLOCKS = 8;      // per track
+static const unsigned int CLUSTER_DURATION = 1000; // in TIMECODE_SCALE units
+
+template <class Tv,class Te>
+static inline Tv& GetChild(EbmlMaster &node)
+{
+    return * (static_cast<Tv *>(&GetChild<Te>( node )));
+}
+
+static double bench_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static uint32_t hash_data(uint32_t Hash,const binary* Data,uint64 Size)
+{
+    for (uint64 i=0;i<Size;i++)
+    {
+        Hash = Hash*31 + Data[i];
+    }
+    return Hash;
+}
+
+static bool write_file(const char* Path,std::vector<uint8_t>& Pool)
+{
+    Pool.resize(4<<20);
+    for (size_t i=0;i<Pool.size();i++) Pool[i] = (uint8_t)(rand()>>7);
+
+    StdIOCallback file(Path,MODE_CREATE);
+
+    EbmlHead head;
+    *static_cast<EbmlString *>(&GetChild<EDocType>(head)) = "matroska";
+    GetChild<EbmlUInteger,EDocTypeVersion>(head) = 2;
+    GetChild<EbmlUInteger,EDocTypeReadVersion>(head) = 2;
+    if (0==head.Render(file,true)) return false;
+
+    KaxSegment segment;
+
+    KaxInfo& info = GetChild<KaxInfo>(segment);
+    info.EnableChecksum();
+    GetChild<EbmlUInteger,KaxTimecodeScale>(info) = TIMECODE_SCALE;
+    GetChild<EbmlFloat,KaxDuration>(info) = (double)(CLUSTERS*CLUSTER_DURATION);
+    GetChild<EbmlUnicodeString,KaxMuxingApp>(info) = L"readbench";
+    GetChild<EbmlUnicodeString,KaxWritingApp>(info) = L"readbench";
+
+    KaxTracks& tracks = GetChild<KaxTracks>(segment);
+    tracks.EnableChecksum();
+    KaxTrackEntry* entries[TRACKS];
+    for (unsigned int t=0;t<TRACKS;t++)
+    {
+        KaxTrackEntry& entry = (t==0) ? GetChild<KaxTrackEntry>(tracks) : AddNewChild<KaxTrackEntry>(tracks);
+        GetChild<EbmlUInteger,KaxTrackNumber>(entry) = t+1;
+        GetChild<EbmlUInteger,KaxTrackUID>(entry) = 1000+t;
+        GetChild<EbmlUInteger,KaxTrackType>(entry) = (t==0) ? 1 : 2;
+        *static_cast<EbmlString *>(&GetChild<KaxCodecID>(entry)) = (t==0) ? "V_MPEG4/ISO/AVC" : "A_AC3";
+        GetChild<KaxCodecPrivate>(entry).CopyBuffer(&Pool[t*1000],100+t*300);
+        entries[t] = &entry;
+    }
+
+    KaxCues cues;
+    cues.SetGlobalTimecodeScale(TIMECODE_SCALE);
+
+    size_t pos = 0;
+    for (unsigned int c=0;c<CLUSTERS;c++)
+    {
+        KaxCluster& cluster = AddNewChild<KaxCluster>(segment);
+        cluster.SetParent(segment);
+        cluster.InitTimecode(c*CLUSTER_DURATION,TIMECODE_SCALE);
+        GetChild<EbmlUInteger,KaxClusterTimecode>(cluster) = c*CLUSTER_DURATION;
+
+        for (unsigned int b=0;b<CLUSTER_BLOCKS;b++)
+        {
+            for (unsigned int t=0;t<TRACKS;t++)
+            {
+                KaxSimpleBlock& block = AddNewChild<KaxSimpleBlock>(cluster);
+                block.SetParent(cluster);
+                block.SetKeyframe(b==0);
+
+                // single frames, EBML and fixed laces
+                unsigned int frames = (t==0) ? 1 : 1 + rand()%8;
+                uint32 fixed = 200 + rand()%1500;
+                LacingType lacing = (t==2) ? LACING_FIXED : LACING_EBML;
+                for (unsigned int f=0;f<frames;f++)
+                {
+                    uint32 size = (t==0) ? (uint32)(2000 + rand()%30000) : (t==2) ? fixed : (uint32)(1 + rand()%3000);
+                    if (pos+size>Pool.size()) pos = 0;
+                    uint64 timecode = (c*CLUSTER_DURATION + b*(CLUSTER_DURATION/CLUSTER_BLOCKS)) * TIMECODE_SCALE;
+                    block.AddFrame(*entries[t],timecode,*new DataBuffer(&Pool[pos],size),lacing);
+                    pos += size;
+                }
+            }
+        }
+
+        KaxCuePoint& point = AddNewChild<KaxCuePoint>(cues);
+        GetChild<EbmlUInteger,KaxCueTime>(point) = c*CLUSTER_DURATION;
+        KaxCueTrackPositions& positions = GetChild<KaxCueTrackPositions>(point);
+        GetChild<EbmlUInteger,KaxCueTrack>(positions) = 1;
+        GetChild<EbmlUInteger,KaxCueClusterPosition>(positions) = c;
+    }
+
+    // the cues are rendered as part of the segment, then given back
+    segment.PushElement(cues);
+    bool ok = (0!=segment.Render(file));
+    segment.Remove(segment.ListSize()-1);
+    file.close();
+    return ok;
+}
+
+struct Found
+{
+    uint32_t    id;
+    uint64      pos;
+    uint64      size;
+    uint32_t    hash;   // of the payload, when read
+
+    bool operator==(const Found& Other) const
+    {
+        return (id==Other.id) && (pos==Other.pos) && (size==Other.size) && (hash==Other.hash);
+    }
+};
+
+struct Payloads
+{
+    unsigned int    read;
+    unsigned int    in_place;
+};
+
+//
+// Walks every element of the segment with FindNextElement, the way a reader
+// looking for clusters does. With Read set, binary elements and blocks are
+// read and counted in it. Returns false when a block has frames outside its
+// data.
+//
+static bool scan(IOCallback& Io,std::vector<Found>& List,Payloads* Read)
+{
+    struct Level
+    {
+        const EbmlSemanticContext*  context;
+        uint64                      end;
+    };
+    std::vector<Level> levels;
+
+    List.clear();
+    if (NULL!=Read) memset(Read,0,sizeof(*Read));
+
+    Io.setFilePointer(0,seek_end);
+    Level top = { &EBML_CLASS_CONTEXT(KaxSegment), Io.getFilePointer() };
+    levels.push_back(top);
+    Io.setFilePointer(0);
+
+    while (true)
+    {
+        uint64 pos = Io.getFilePointer();
+        while ( (!levels.empty()) && (pos>=levels.back().end) ) levels.pop_back();
+        if (levels.empty()) break;
+
+        int upper = 0;
+        EbmlElement* elt = EbmlElement::FindNextElement(Io,*levels.back().context,upper,levels.back().end-pos,true);
+        if (NULL==elt)
+        {
+            if (Io.getFilePointer()<=pos) Io.setFilePointer(pos+1);
+            continue;
+        }
+
+        Found found = { EBML_ID_VALUE(EbmlId(*elt)), elt->GetElementPosition(), elt->GetSize(), 0 };
+        EbmlBinary* binary_elt = dynamic_cast<EbmlBinary*>(elt);
+
+        if (elt->IsMaster() && elt->IsFiniteSize())
+        {
+            Level level = { &EBML_CONTEXT(elt), elt->GetEndPosition() };
+            levels.push_back(level);
+        } else if ((NULL!=Read) && (NULL!=binary_elt) && elt->IsFiniteSize() && (elt->GetSize()<(64<<20))) {
+            elt->ReadData(Io);
+            if ( (NULL!=binary_elt->GetBuffer()) && binary_elt->ValueIsSet() )
+            {
+                found.hash = hash_data(1,binary_elt->GetBuffer(),elt->GetSize());
+                Read->read++;
+                if (binary_elt->IsDataInPlace()) Read->in_place++;
+            }
+            KaxInternalBlock* block = dynamic_cast<KaxInternalBlock*>(elt);
+            if ( (NULL!=block) && block->ValueIsSet() )
+            {
+                const binary* start = binary_elt->GetBuffer();
+                const binary* end = start + elt->GetSize();
+                const KaxBlockLaces& laces = block->GetReadLaces();
+                for (unsigned int i=0;i<block->NumberFrames();i++)
+                {
+                    // the DataBuffers made on demand are the same frames
+                    DataBuffer& frame = block->GetBuffer(i);
+                    if ( (laces[i].Buffer<start) || ((laces[i].Buffer+laces[i].Size)>end) ||
+                        (frame.Buffer()!=laces[i].Buffer) || (frame.Size()!=laces[i].Size) )
+                    {
+                        delete elt;
+                        return false;
+                    }
+                    found.hash = found.hash*7 + laces[i].Size;
+                }
+            }
+            Io.setFilePointer(elt->GetEndPosition());
+        } else if (elt->IsFiniteSize()) {
+            Io.setFilePointer(elt->GetEndPosition());
+        }
+
+        List.push_back(found);
+        delete elt;
+    }
+    return true;
+}
+
+static void dump(std::string& Out,EbmlElement* Elt,unsigned int Depth,unsigned int& InPlace)
+{
+    char line[256];
+    sprintf(line,"%*s%x pos %llu size %llu",Depth,"",(unsigned int)EBML_ID_VALUE(EbmlId(*Elt)),
+        (unsigned long long)Elt->GetElementPosition(),(unsigned long long)Elt->GetSize());
+    Out += line;
+
+    if (Elt->IsMaster())
+    {
+        EbmlMaster* master = static_cast<EbmlMaster*>(Elt);
+        sprintf(line," crc %d %x children %u\n",(int)master->HasChecksum(),master->GetCrc32(),(unsigned int)master->ListSize());
+        Out += line;
+        for (EBML_MASTER_ITERATOR it=master->begin();it!=master->end();++it)
+        {
+            dump(Out,*it,Depth+1,InPlace);
+        }
+        return;
+    }
+
+    line[0] = 0;
+    if (EbmlUInteger* value = dynamic_cast<EbmlUInteger*>(Elt))
+    {
+        sprintf(line," u %llu",(unsigned long long)uint64(*value));
+    } else if (EbmlFloat* value = dynamic_cast<EbmlFloat*>(Elt)) {
+        sprintf(line," f %g",double(*value));
+    } else if (EbmlString* value = dynamic_cast<EbmlString*>(Elt)) {
+        sprintf(line," s %.64s",value->GetValue().c_str());
+    } else if (EbmlBinary* value = dynamic_cast<EbmlBinary*>(Elt)) {
+        if (NULL!=value->GetBuffer()) sprintf(line," b %x",hash_data(1,value->GetBuffer(),value->GetSize()));
+        if (value->IsDataInPlace()) InPlace++;
+    }
+    Out += line;
+    Out += "\n";
+}
+
+struct Index
+{
+    double          duration;
+    unsigned int    tracks;
+    unsigned int    cues;
+};
+
+//
+// Reads the segment with Scope. With Lookup the info, tracks and cues are
+// looked for first, then the whole tree is dumped when Out is given.
+//
+static bool read_segment(IOCallback& Io,ScopeMode Scope,Index* Lookup,std::string* Out,unsigned int& InPlace)
+{
+    Io.setFilePointer(0);
+    EbmlStream stream(Io);
+    InPlace = 0;
+
+    EbmlElement* head = stream.FindNextID(EBML_INFO(EbmlHead),0xFFFFFFFFL);
+    if (NULL==head) return false;
+    head->SkipData(stream,EBML_CONTEXT(head));
+    delete head;
+
+    EbmlElement* elt = stream.FindNextID(EBML_INFO(KaxSegment),0xFFFFFFFFFFFFFFFFLL);
+    if (NULL==elt) return false;
+
+    int upper = 0;
+    EbmlElement* found = NULL;
+    elt->Read(stream,EBML_CONTEXT(elt),upper,found,true,Scope);
+    delete found;
+    KaxSegment& segment = *static_cast<KaxSegment*>(elt);
+
+    if (NULL!=Lookup)
+    {
+        memset(Lookup,0,sizeof(*Lookup));
+        KaxInfo* info = FindChild<KaxInfo>(segment);
+        KaxDuration* duration = (NULL!=info) ? FindChild<KaxDuration>(*info) : NULL;
+        if (NULL!=duration) Lookup->duration = double(*duration);
+        KaxTracks* tracks = FindChild<KaxTracks>(segment);
+        for (EbmlElement* e = (NULL!=tracks) ? tracks->FindFirstElt(EBML_INFO(KaxTrackEntry)) : NULL;e!=NULL;e=tracks->FindNextElt(*e))
+        {
+            Lookup->tracks++;
+        }
+        KaxCues* cues = FindChild<KaxCues>(segment);
+        for (EbmlElement* e = (NULL!=cues) ? cues->FindFirstElt(EBML_INFO(KaxCuePoint)) : NULL;e!=NULL;e=cues->FindNextElt(*e))
+        {
+            Lookup->cues++;
+        }
+    }
+
+    if (NULL!=Out)
+    {
+        Out->clear();
+        dump(*Out,elt,0,InPlace);
+    }
+
+    delete elt;
+    return true;
+}
+
+//
+// The same file with the heads of some of the Elements overwritten by a few
+// random bytes, so that readers have to find the next element, and a longer
+// run of garbage in the middle
+//
+static bool damage_file(const char* Path,const char* DamagedPath,const std::vector<Found>& Elements)
+{
+    FILE* in = fopen(Path,"rb");
+    if (NULL==in) return false;
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n=fread(buf,1,sizeof(buf),in))>0) data.insert(data.end(),buf,buf+n);
+    fclose(in);
+
+    size_t middle = Elements.size()/2;
+    for (size_t i=5;i<Elements.size();i+=37)
+    {
+        size_t pos = (size_t)Elements[i].pos + rand()%4;
+        size_t run = ((i>=middle) && (i<(middle+37))) ? 3000 : 1 + rand()%8;
+        for (size_t j=0;j<run && (pos+j)<data.size();j++) data[pos+j] = (uint8_t)rand();
+    }
+
+    FILE* out = fopen(DamagedPath,"wb");
+    if (NULL==out) return false;
+    bool ok = (fwrite(&data[0],1,data.size(),out)==data.size());
+    return (0==fclose(out)) && ok;
+}
+
+static bool verify_file(const char* Path,bool Intact,std::vector<Found>* Elements)
+{
+    static const size_t buffer_sizes[] = { 16, 100, 4096, 64*1024 };
+    std::vector<Found> ref,list;
+    Payloads read;
+    unsigned int in_place;
+    bool ok = true;
+
+    StdIOCallback file(Path,MODE_READ);
+
+    // FindNextElement through a buffer, IDs and sizes only
+    scan(file,ref,NULL);
+    if (NULL!=Elements) *Elements = ref;
+    for (size_t i=0;i<sizeof(buffer_sizes)/sizeof(buffer_sizes[0]);i++)
+    {
+        BufferedIOCallback buffered(file,buffer_sizes[i]);
+        scan(buffered,list,NULL);
+        if (list!=ref)
+        {
+            printf("buffered scan mismatch: %s buffer %u\n",Path,(unsigned int)buffer_sizes[i]);
+            ok = false;
+        }
+    }
+
+    // payloads in place from the mapping
+    if (!scan(file,ref,&read))
+    {
+        printf("block frames out of bounds: %s\n",Path);
+        ok = false;
+    }
+    if (read.in_place!=0)
+    {
+        printf("stdio payloads in place: %u\n",read.in_place);
+        ok = false;
+    }
+    {
+        MmapIOCallback mapped(Path);
+        if (!scan(mapped,list,&read))
+        {
+            printf("block frames out of bounds: %s mmap\n",Path);
+            ok = false;
+        }
+        if (list!=ref)
+        {
+            printf("mmap scan mismatch: %s\n",Path);
+            ok = false;
+        }
+        if ( (read.in_place!=read.read) || (Intact && (read.read<(TRACKS*CLUSTERS*CLUSTER_BLOCKS))) )
+        {
+            printf("mmap payloads in place: %u of %u\n",read.in_place,read.read);
+            ok = false;
+        }
+    }
+
+    // lazy segment reads
+    std::string full,lazy;
+    Index index;
+    read_segment(file,SCOPE_ALL_DATA,NULL,&full,in_place);
+    {
+        BufferedIOCallback buffered(file);
+        read_segment(buffered,SCOPE_LAZY_DATA,&index,&lazy,in_place);
+        if (lazy!=full)
+        {
+            printf("lazy read mismatch: %s\n",Path);
+            ok = false;
+        }
+    }
+    {
+        MmapIOCallback mapped(Path);
+        read_segment(mapped,SCOPE_LAZY_DATA,NULL,&lazy,in_place);
+        if (lazy!=full)
+        {
+            printf("lazy read mismatch: %s mmap\n",Path);
+            ok = false;
+        }
+    }
+    if ( Intact && ( (index.duration!=(double)(CLUSTERS*CLUSTER_DURATION)) || (index.tracks!=TRACKS) || (index.cues!=CLUSTERS) ) )
+    {
+        printf("lazy lookup: duration %g tracks %u cues %u\n",index.duration,index.tracks,index.cues);
+        ok = false;
+    }
+
+    return ok;
+}
+
+static void measure(const char* Name,IOCallback& Io)
+{
+    std::vector<Found> list;
+    unsigned int in_place;
+    Index index;
+
+    double start = bench_time();
+    scan(Io,list,NULL);
+    double scan_time = bench_time()-start;
+
+    start = bench_time();
+    read_segment(Io,SCOPE_ALL_DATA,NULL,NULL,in_place);
+    double full_time = bench_time()-start;
+
+    start = bench_time();
+    read_segment(Io,SCOPE_LAZY_DATA,&index,NULL,in_place);
+    double lazy_time = bench_time()-start;
+
+    printf("%10s %9.2f ms %9.2f ms %9.2f ms\n",Name,scan_time*1e3,full_time*1e3,lazy_time*1e3);
+}
+
+int main(int argc,char **argv)
+{
+    const char* path = (argc>1) ? argv[1] : "readbench.mkv";
+    std::string damaged_path = std::string(path) + ".damaged";
+    std::vector<uint8_t> pool;
+    std::vector<Found> elements;
+
+    srand(1);
+    bool ok = write_file(path,pool) && verify_file(path,true,&elements);
+    ok = ok && damage_file(path,damaged_path.c_str(),elements) && verify_file(damaged_path.c_str(),false,NULL);
+    printf("verify:      %s\n",ok?"ok":"FAILED");
+
+    if (ok)
+    {
+        printf("%10s %12s %12s %12s\n","callback","scan","full read","lazy index");
+
+        StdIOCallback file(path,MODE_READ);
+        measure("stdio",file);
+        {
+            BufferedIOCallback buffered(file);
+            measure("buffered",buffered);
+        }
+        {
+            MmapIOCallback mapped(path);
+            measure("mmap",mapped);
+        }
+    }
+
+    remove(damaged_path.c_str());
+    remove(path);
+
+    return ok ? 0 : 2;
+}
@@ -64,6 +64,27 @@ public:
 extern "C" IWorld* my_world();
 extern "C" bool __cdecl set_world(IWorld* new_world,int world_name=WORLD_NAME);
 
+// overrides the process world for the calling thread only, returns the
+// previous override (NULL if none)
+IWorld* set_thread_world(IWorld* new_world);
+
+class CThreadWorld
+{
+private:
+    IWorld* m_Prev;
+    bool    m_Set;
+public:
+    CThreadWorld(IWorld* new_world)
+        : m_Prev(NULL) , m_Set(NULL!=new_world)
+    {
+        if (m_Set) m_Prev = set_thread_world(new_world);
+    }
+    ~CThreadWorld()
+    {
+        if (m_Set) set_thread_world(m_Prev);
+    }
+};
+
 static inline void lgpl_trace(const char *str)
 {
     my_world()->debug_trace(str);
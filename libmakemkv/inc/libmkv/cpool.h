@@ -0,0 +1,76 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef MKV_CPOOL_INCLUDED
+#define MKV_CPOOL_INCLUDED
+
+#include <vector>
+
+//
+// Runs IMkvChunk::compress_start/compress_wait on worker threads so that
+// frames in the lookahead window are compressed while the mux thread is
+// busy rendering. A chunk passed to Start() must not be touched (other than
+// reading flags/timecode/duration) until Wait() returns for it. Wait() only
+// waits for the pool, the caller still calls compress_wait() as usual.
+// Workers run in the world of the thread that created the pool, an
+// exception thrown by a job is traced there and rethrown by Wait().
+//
+class CCompressPool
+{
+private:
+    typedef struct _Job
+    {
+        IMkvChunk*      chunk;
+        unsigned int    type;
+        unsigned int    level;
+        unsigned int    state;
+        bool            result;
+        bool            failed;
+        struct _Job*    next;       // queued jobs, oldest first
+        struct _Job*    prev;
+    } Job;
+
+    std::vector<Job>    m_Jobs;
+    std::vector<Job*>   m_FreeJobs;
+    std::vector<Job*>   m_Index;    // open addressing by chunk, power of 2
+    Job*                m_QueueHead;
+    Job*                m_QueueTail;
+    IWorld*             m_World;
+    unsigned int        m_ThreadCount;
+    void*               m_Sys;
+public:
+    CCompressPool(unsigned int ThreadCount,unsigned int QueueDepth);
+    ~CCompressPool();
+public:
+    bool Start(IMkvChunk* Chunk,unsigned int Type,unsigned int Level);
+    bool Wait(IMkvChunk* Chunk);
+private:
+    size_t IndexSlot(IMkvChunk* Chunk);
+    Job* FindJob(IMkvChunk* Chunk);
+    void AddJob(Job* job);
+    void RemoveJob(Job* job);
+    void Enqueue(Job* job);
+    void Dequeue(Job* job);
+    static void RunJob(Job* job);
+    void WorkerProc();
+    static void* WorkerProcStatic(void* Context);
+};
+
+#endif // MKV_CPOOL_INCLUDED
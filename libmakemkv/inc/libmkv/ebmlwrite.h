@@ -21,27 +21,66 @@
 #ifndef MKV_EBMLWRITE_INCLUDED
 #define MKV_EBMLWRITE_INCLUDED
 
+#include <vector>
+
 class CEbmlWrite : public IOCallback
 {
+private:
+    typedef struct _Patch
+    {
+        uint64_t        offset;
+        unsigned int    size;
+        size_t          data;
+    } Patch;
 private:
     IMkvWriteTarget*    m_Writer;
+    MkvMuxStats*        m_Stats;
     uint64_t            m_Offset;
     uint64_t            m_OvrOffset;
     bool                m_OvrOffsetSet;
+    bool                m_Replay;
+    bool                m_Streaming;
+    uint8_t*            m_BufferAlloc;
+    uint8_t*            m_Buffer;
+    size_t              m_BufferSize;
+    size_t              m_BufferUsed;
+    std::vector<Patch>  m_Patches;
+    std::vector<uint8_t> m_PatchData;
 public:
-    CEbmlWrite(IMkvWriteTarget *Writer)
+    CEbmlWrite(IMkvWriteTarget *Writer,MkvMuxStats* Stats=NULL)
         : m_Writer(Writer) ,
+          m_Stats(Stats) ,
           m_Offset(0) ,
-          m_OvrOffsetSet(false)
+          m_OvrOffsetSet(false) ,
+          m_Replay(false) ,
+          m_Streaming(false) ,
+          m_BufferAlloc(NULL) ,
+          m_Buffer(NULL) ,
+          m_BufferSize(0) ,
+          m_BufferUsed(0)
     {
     }
+    ~CEbmlWrite();
 public:
 	uint32 read(void*Buffer,size_t Size);
 	void setFilePointer(int64 Offset,seek_mode Mode=seek_beginning);
 	size_t write(const void*Buffer,size_t Size);
+	size_t writev(const IOVector*Buffers,size_t Count);
 	uint64 getFilePointer();
 	void close();
+	bool canOverwrite();
+public:
+    void SetStreaming(bool Streaming);
+    bool Flush();
+    void StartReplay();
+    bool EndReplay(uint64_t Offset);
+private:
+    bool Append(const void*Buffer,size_t Size);
+    bool Overwrite(uint64_t Offset,const void*Buffer,size_t Size);
+    bool FlushBuffer();
+    bool FlushPatches();
+    bool WriteTarget(const void*Buffer,size_t Size);
+    bool OverwriteTarget(uint64_t Offset,const void*Buffer,unsigned int Size);
 };
 
-
 #endif // MKV_EBMLWRITE_INCLUDED
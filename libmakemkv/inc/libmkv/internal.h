@@ -24,6 +24,7 @@
 #include "ebml/EbmlHead.h"
 #include "ebml/EbmlSubHead.h"
 #include "ebml/EbmlVoid.h"
+#include "ebml/EbmlArena.h"
 #include <ebml/EbmlString.h>
 #include <ebml/EbmlVersion.h>
 
@@ -50,7 +51,11 @@
 #include "matroska/KaxAttachments.h"
 #include "matroska/KaxAttached.h"
 
+#include <lgpl/world.h>
 #include <time.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#endif
 
 using namespace LIBEBML_NAMESPACE;
 using namespace LIBMATROSKA_NAMESPACE;
@@ -88,5 +93,121 @@ static inline struct tm *libmkv_gmtime_r(uint64_t atime, struct tm *result)
 
 #endif
 
+#ifdef _MSC_VER
+
+#include <windows.h>
+
+static inline uint64_t libmkv_clock_ns()
+{
+    LARGE_INTEGER cnt,freq;
+    QueryPerformanceCounter(&cnt);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t) ( ((double)cnt.QuadPart) * 1000000000.0 / ((double)freq.QuadPart) );
+}
+
+#else
+
+static inline uint64_t libmkv_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((uint64_t)ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+#endif
+
+// Chunks created inside the library (the MKV reader) carry MKV_CHUNK_LIBMKV_REF,
+// their get_ref() is an ILibmkvChunkRef released here instead of through the
+// world. The flag is only trusted on chunks of the frame sources the library
+// registered, a caller's source may have set the bit.
+class ILibmkvChunkRef
+{
+public:
+    virtual void ReleaseRef()=0;
+};
+
+// releases a ref returned by IMkvChunk::get_ref()
+static inline void libmkv_free_chunk_ref(void* Ref,bool LibmkvRef)
+{
+    if (LibmkvRef)
+    {
+        ((ILibmkvChunkRef*)Ref)->ReleaseRef();
+    } else {
+        lgpl_free_chunk_ref(Ref);
+    }
+}
+
+// a source is registered for as long as it exists
+void libmkv_register_source(IMkvFrameSource* Source,bool Register);
+bool libmkv_is_own_source(IMkvFrameSource* Source);
+
+// true when the ref of Chunk, a chunk of a source checked with
+// libmkv_is_own_source(), is an ILibmkvChunkRef
+static inline bool libmkv_is_chunk_ref(IMkvChunk* Chunk,bool OwnSource)
+{
+    return OwnSource && (0!=(Chunk->flags&MKV_CHUNK_LIBMKV_REF));
+}
+
+// chunk refs may be taken and released on different threads (prefetch)
+#ifdef _MSC_VER
+
+static inline unsigned int libmkv_atomic_add(volatile unsigned int* Value,int Add)
+{
+    return ((unsigned int)InterlockedExchangeAdd((volatile LONG*)Value,Add)) + Add;
+}
+
+class CLibmkvLock
+{
+private:
+    CRITICAL_SECTION    m_Cs;
+public:
+    CLibmkvLock() { InitializeCriticalSection(&m_Cs); }
+    ~CLibmkvLock() { DeleteCriticalSection(&m_Cs); }
+    void Lock() { EnterCriticalSection(&m_Cs); }
+    void Unlock() { LeaveCriticalSection(&m_Cs); }
+};
+
+#else
+
+static inline unsigned int libmkv_atomic_add(volatile unsigned int* Value,int Add)
+{
+    return __atomic_add_fetch(Value,Add,__ATOMIC_SEQ_CST);
+}
+
+class CLibmkvLock
+{
+private:
+    pthread_mutex_t     m_Mutex;
+public:
+    CLibmkvLock() { pthread_mutex_init(&m_Mutex,NULL); }
+    ~CLibmkvLock() { pthread_mutex_destroy(&m_Mutex); }
+    void Lock() { pthread_mutex_lock(&m_Mutex); }
+    void Unlock() { pthread_mutex_unlock(&m_Mutex); }
+};
+
+#endif
+
+// adds the lifetime of the object to a stage, Stage may be NULL
+class CStageTimer
+{
+private:
+    MkvStageStats*  m_Stage;
+    uint64_t        m_Start;
+public:
+    CStageTimer(MkvStageStats* Stage)
+        : m_Stage(Stage)
+    {
+        if (m_Stage) m_Start = libmkv_clock_ns();
+    }
+    ~CStageTimer()
+    {
+        if (m_Stage)
+        {
+            m_Stage->time_ns += libmkv_clock_ns() - m_Start;
+            m_Stage->calls++;
+        }
+    }
+};
+
 #endif // LIBMKV_INTERNAL_H_INCLUDED
 
@@ -32,6 +32,9 @@ static const unsigned int MKV_CHUNK_CHAPTER_MARK=4;
 static const unsigned int MKV_CHUNK_DISCARDABLE=8;
 static const unsigned int MKV_CHUNK_OLD_BLOCK=16;
 static const unsigned int MKV_CHUNK_AUTO_DURATION=32;
+// reserved, libmkv sets it on the chunks of the tracks it creates itself
+// (MkvOpenReader) and ignores it on all other chunks
+static const unsigned int MKV_CHUNK_LIBMKV_REF=0x80000000;
 
 static const unsigned int MKV_TRACK_COMPRESSION_ZLIB=0;
 static const unsigned int MKV_TRACK_COMPRESSION_BZ2=1;
@@ -169,6 +172,14 @@ public:
     virtual IMkvFrameSource* MkvGetStream(unsigned int Index)=0;
 };
 
+class IMkvReadSource
+{
+public:
+    // ReadSize is less than Size only at the end of the file
+    virtual bool            Read(void *Data,unsigned int Size,unsigned int* ReadSize)=0;
+    virtual bool            Seek(uint64_t Offset)=0;
+};
+
 typedef struct _MkvChapterInfo
 {
     unsigned int                name_count;
@@ -188,6 +199,7 @@ typedef struct _MkvTitleInfo
 {
     const mkv_utf8_t*   metadata_lang;
     const mkv_utf8_t*   name;
+    uint64_t            duration;   // expected title duration in chunk timecode units, 0 if unknown
 } MkvTitleInfo;
 
 class IMkvTitleInfo
@@ -206,23 +218,224 @@ typedef struct _MkvDebugInfo
     unsigned int        compatFlags;
 } MkvDebugInfo;
 
+// MkvProfileInfo::version. A field is read only when the caller sets version
+// to at least the version that added it, older callers leave garbage in the
+// struct padding these fields took over.
+static const int MKV_PROFILE_VERSION_STREAMING=2;       // streamingOutput
+static const int MKV_PROFILE_VERSION_CUES_AT_FRONT=3;   // cuesAtFront
+static const int MKV_PROFILE_VERSION_HEADER_STRIPPING=4; // autoHeaderStripping
+static const int MKV_PROFILE_VERSION_COMPRESSION_POOL=5; // MkvFormatInfo::compressionThreads/compressionQueueDepth
+static const int MKV_PROFILE_VERSION=5;
+
 typedef struct _MkvProfileInfo
 {
     int     version;
     bool    useISO639Type2T;
+    bool    streamingOutput;    // never call IMkvWriteTarget::Overwrite, see below
+    bool    cuesAtFront;        // reserve space for cues after the header, needs MkvTitleInfo::duration
+    bool    autoHeaderStripping; // strip the bytes every frame of a track starts with, see below
 } MkvProfileInfo;
 
 typedef struct _MkvFormatInfo
 {
     MkvProfileInfo      profile;
     MkvDebugInfo        debug;
+    // frames of compressed tracks are compressed on compressionThreads worker
+    // threads, at most compressionQueueDepth frames (0 for the default) ahead
+    // of the muxer. 0 threads compresses on the calling thread.
+    unsigned int        compressionThreads;
+    unsigned int        compressionQueueDepth;
 } MkvFormatInfo;
 
+typedef struct _MkvStageStats
+{
+    uint64_t        time_ns;
+    uint64_t        calls;
+} MkvStageStats;
+
+typedef struct _MkvTrackStats
+{
+    uint64_t        frames;
+    uint64_t        blocks;
+    uint64_t        bytes;
+    MkvStageStats   fetch;
+    MkvStageStats   compress;
+} MkvTrackStats;
+
+static const unsigned int MKV_STATS_MAX_TRACKS=64;
+
+typedef struct _MkvMuxStats
+{
+    MkvStageStats   total;
+    MkvStageStats   fetch;          // IMkvFrameSource::FetchFrames
+    MkvStageStats   compress;       // compress_start/compress_wait and pool waits on the mux thread
+    MkvStageStats   render;         // EBML rendering of blocks and clusters, not counting write
+    MkvStageStats   write;          // IMkvWriteTarget::Write and Overwrite
+    uint64_t        write_bytes;
+    uint64_t        overwrite_calls;
+    uint64_t        frames;
+    uint64_t        blocks;
+    uint64_t        clusters;
+    uint64_t        block_heap_allocs;  // by the block and frame buffer pools, warm-up only;
+                                        // the mux loop still allocates each cluster's child list
+    unsigned int    track_count;
+    MkvTrackStats   track[MKV_STATS_MAX_TRACKS]; // tracks past the limit count only in the totals
+} MkvMuxStats;
+
+// Receives the muxer state every few tens of megabytes, at a cluster
+// boundary. Everything up to the checkpoint's file size has been handed to
+// the write target before SaveCheckpoint is called, so an implementation
+// should make the output durable first and then store Data, e.g. in a
+// sidecar file.
+class IMkvCheckpoint
+{
+public:
+    virtual bool SaveCheckpoint(const void* Data,unsigned int Size)=0;
+};
+
+typedef struct _MkvResumeInfo
+{
+    uint64_t        file_size;      // truncate the output to this size before resuming
+    unsigned int    stream_count;
+} MkvResumeInfo;
+
+typedef struct _MkvResumeStream
+{
+    uint64_t        frames;         // frames of the stream already in the file
+    int64_t         timecode;       // timecode of the last of them, -1 if none
+} MkvResumeStream;
+
 #ifndef _MSC_VER
 #define __cdecl
 #endif
 
+// With FormatInfo->profile.streamingOutput set the file is written strictly
+// sequentially, so Output may be a pipe. The segment and clusters have unknown
+// size, the segment info carries no duration, chapters and the seek head are
+// written at the end together with cues and tags, and automatic block
+// durations and codec private data updates are not back-patched.
+//
+// With FormatInfo->profile.autoHeaderStripping set, the first frames of each
+// uncompressed track are sampled before the header is written, and a byte
+// prefix they all share (sync words, fixed frame headers) is stripped with
+// header compression when it saves enough. Tracks that request
+// MKV_TRACK_COMPRESSION_HEADERS without header_comp_data are sampled the same
+// way. Every later frame of such a track must start with the same bytes.
 extern "C"
 bool __cdecl MkvCreateFile(IMkvWriteTarget* Output,IMkvTrack *Input,const mkv_utf8_t *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo) throw();
 
+class IWorld;
+
+// Same as MkvCreateFile, but all callbacks made while creating this file
+// (traces, progress, random bytes, chunk release, empty tracks) go to World
+// instead of the process world. Several files may be created concurrently
+// on different threads, each with its own World. World may be NULL.
+// If Stats is not NULL it receives the time spent in each stage of the mux,
+// also when the call fails.
+extern "C"
+bool __cdecl MkvCreateFileEx(IMkvWriteTarget* Output,IMkvTrack *Input,const mkv_utf8_t *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,IWorld* World,MkvMuxStats* Stats) throw();
+
+// Same as MkvCreateFileEx, with checkpoints. If Checkpoint is not NULL it
+// receives the resumable state as the file is written. If ResumeData is not
+// NULL the mux continues from that state: Output must have been truncated to
+// the size MkvGetResumeInfo returns and every stream of Input must start
+// right after the frames already in the file. TitleInfo and the track info
+// must be the same as in the interrupted run.
+extern "C"
+bool __cdecl MkvCreateFileResumable(IMkvWriteTarget* Output,IMkvTrack *Input,const mkv_utf8_t *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,IWorld* World,MkvMuxStats* Stats,IMkvCheckpoint* Checkpoint,const void* ResumeData,unsigned int ResumeSize) throw();
+
+// Decodes the resume point of a checkpoint. Streams may be NULL, otherwise
+// the first StreamCount entries are filled in.
+extern "C"
+bool __cdecl MkvGetResumeInfo(const void* ResumeData,unsigned int ResumeSize,MkvResumeInfo* Info,MkvResumeStream* Streams,unsigned int StreamCount) throw();
+
+
+// An existing Matroska file as input for MkvCreateFile, both the streams and
+// the title info (name, chapters of the default edition, attachments).
+// Clusters are read sequentially as the muxer asks for frames, so memory use
+// is bounded by how far apart the streams are interleaved in the file. Input
+// is only seeked to reach chapters and attachments that a seek head in front
+// of the clusters places after them.
+// Frames keep the file's clusters, keyframe flags and compression; compressed
+// tracks are copied without recompressing. Tracks of unknown type are dropped
+// and encrypted tracks are not supported.
+class IMkvReader : public IMkvTrack , public IMkvTitleInfo
+{
+public:
+    virtual void Release()=0;
+};
+
+// returns NULL if Input is not a Matroska file that can be read
+extern "C"
+IMkvReader* __cdecl MkvOpenReader(IMkvReadSource* Input) throw();
+
+typedef struct _MkvPrefetchLimits
+{
+    unsigned int    high_frames;    // a stream stops being read ahead at this many queued frames
+    unsigned int    low_frames;     // and is read again once its queue is down to this many
+    uint64_t        high_bytes;     // the same for the frames queued in all streams together
+    uint64_t        low_bytes;
+} MkvPrefetchLimits;
+
+typedef struct _MkvPrefetchStats
+{
+    uint64_t        frames;         // frames handed to the muxer
+    uint64_t        bytes;
+    unsigned int    queued_frames;  // frames queued now, all streams
+    unsigned int    max_frames;     // most frames queued in one stream
+    uint64_t        queued_bytes;
+    uint64_t        max_bytes;      // most bytes queued in all streams
+    MkvStageStats   fetch;          // input FetchFrames calls on the producer thread
+    MkvStageStats   producer_wait;  // producer paused at a high watermark
+    MkvStageStats   consumer_wait;  // muxer waited for frames not read yet
+} MkvPrefetchStats;
+
+// Reads Input ahead on a producer thread so that input latency (disc reads,
+// decryption, demuxing) overlaps with muxing and writing. Once the prefetch
+// track is created Input is only called from the producer thread until all
+// streams end; chunk refs are taken there and released on the muxer thread.
+// Video and audio streams are read ahead up to the limits, other streams
+// only as the muxer asks for them. Each stream only shows the muxer the
+// frames it asked for, so the output doesn't depend on how far ahead the
+// producer got and a prefetch track can be used with MkvCreateFileResumable.
+// An exception Input throws on the producer thread is thrown again on the
+// muxer thread. The producer thread makes its callbacks to the world of the
+// thread that creates the track, refs still queued when the track is released
+// go to the world of the releasing thread. GetPrefetchStats is called on the
+// muxer thread, the producer side of the stats is as of its last pause or
+// every few hundred reads. Limits may be NULL for the defaults. Release stops
+// the producer and must be called before Input is destroyed.
+class IMkvPrefetchTrack : public IMkvTrack
+{
+public:
+    virtual void GetPrefetchStats(MkvPrefetchStats* Stats)=0;
+    virtual void Release()=0;
+};
+
+extern "C"
+IMkvPrefetchTrack* __cdecl MkvCreatePrefetchTrack(IMkvTrack* Input,const MkvPrefetchLimits* Limits) throw();
+
+typedef struct _MkvFileTargetOptions
+{
+    uint64_t        expected_size;  // allocated up front if not 0
+    unsigned int    buffer_size;    // bytes per write, 0 for the default
+    bool            direct_io;      // O_DIRECT, falls back to buffered writes if not supported
+    bool            write_behind;   // start writeback behind the writes and drop written pages from the cache
+} MkvFileTargetOptions;
+
+// Writes the output to a file through a large aligned buffer, Overwrite
+// patches the file in place. With expected_size the file is as long as that
+// until Close truncates it to the bytes written. Close returns false if any
+// write failed. Only implemented for Linux and other POSIX systems, returns
+// NULL elsewhere. Options may be NULL for the defaults.
+class IMkvFileTarget : public IMkvWriteTarget
+{
+public:
+    virtual bool Close()=0;
+    virtual void Release()=0;
+};
+
+extern "C"
+IMkvFileTarget* __cdecl MkvCreateFileTarget(const char* Name,const MkvFileTargetOptions* Options) throw();
+
 #endif // LIBMKV_H_INCLUDED
@@ -0,0 +1,332 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include <libmkv/libmkv.h>
+#include <libmkv/cpool.h>
+#include <lgpl/cassert>
+#include <exception>
+#include <lgpl/world.h>
+#include <string.h>
+
+#ifndef _MSC_VER
+#define MKV_CPOOL_THREADS 1
+#include <pthread.h>
+#endif
+
+static const unsigned int JobFree = 0;
+static const unsigned int JobQueued = 1;
+static const unsigned int JobRunning = 2;
+static const unsigned int JobDone = 3;
+
+#ifdef MKV_CPOOL_THREADS
+
+typedef struct _CPoolSys
+{
+    pthread_mutex_t             lock;
+    pthread_cond_t              queued;
+    pthread_cond_t              done;
+    std::vector<pthread_t>      threads;
+    bool                        stop;
+} CPoolSys;
+
+#define SYS ((CPoolSys*)m_Sys)
+
+#endif
+
+CCompressPool::CCompressPool(unsigned int ThreadCount,unsigned int QueueDepth)
+    : m_QueueHead(NULL) , m_QueueTail(NULL) , m_World(my_world()) , m_ThreadCount(0) , m_Sys(NULL)
+{
+#ifdef MKV_CPOOL_THREADS
+    if ( (0==ThreadCount) || (0==QueueDepth) ) return;
+
+    Job job;
+    memset(&job,0,sizeof(job));
+    m_Jobs.resize(QueueDepth,job);
+    m_FreeJobs.reserve(QueueDepth);
+    for (size_t i=m_Jobs.size();i>0;i--)
+    {
+        m_FreeJobs.push_back(&m_Jobs[i-1]);
+    }
+
+    // at most half full, so that probes stay short
+    size_t index_size = 1;
+    while (index_size<(2*(size_t)QueueDepth)) index_size *= 2;
+    m_Index.resize(index_size,(Job*)NULL);
+
+    m_Sys = new CPoolSys;
+    pthread_mutex_init(&SYS->lock,NULL);
+    pthread_cond_init(&SYS->queued,NULL);
+    pthread_cond_init(&SYS->done,NULL);
+    SYS->stop = false;
+
+    for (unsigned int i=0;i<ThreadCount;i++)
+    {
+        pthread_t thread;
+        if (0!=pthread_create(&thread,NULL,WorkerProcStatic,this)) break;
+        SYS->threads.push_back(thread);
+    }
+    m_ThreadCount = (unsigned int)SYS->threads.size();
+#endif
+}
+
+CCompressPool::~CCompressPool()
+{
+#ifdef MKV_CPOOL_THREADS
+    if (NULL==m_Sys) return;
+
+    // jobs still queued are dropped, running ones are allowed to finish
+    pthread_mutex_lock(&SYS->lock);
+    SYS->stop = true;
+    pthread_cond_broadcast(&SYS->queued);
+    pthread_mutex_unlock(&SYS->lock);
+
+    for (size_t i=0;i<SYS->threads.size();i++)
+    {
+        pthread_join(SYS->threads[i],NULL);
+    }
+
+    pthread_cond_destroy(&SYS->done);
+    pthread_cond_destroy(&SYS->queued);
+    pthread_mutex_destroy(&SYS->lock);
+    delete SYS;
+#endif
+}
+
+size_t CCompressPool::IndexSlot(IMkvChunk* Chunk)
+{
+    // chunks are heap objects, their low address bits are always the same
+    uint64_t key = ((uint64_t)(uintptr_t)Chunk)>>4;
+    return (size_t)((key*0x9e3779b97f4a7c15ull)>>32) & (m_Index.size()-1);
+}
+
+CCompressPool::Job* CCompressPool::FindJob(IMkvChunk* Chunk)
+{
+    size_t mask = m_Index.size()-1;
+    for (size_t i=IndexSlot(Chunk);;i=(i+1)&mask)
+    {
+        Job* job = m_Index[i];
+        if ( (NULL==job) || (job->chunk==Chunk) ) return job;
+    }
+}
+
+void CCompressPool::AddJob(Job* job)
+{
+    size_t mask = m_Index.size()-1;
+    size_t i = IndexSlot(job->chunk);
+    while (NULL!=m_Index[i])
+    {
+        i = (i+1)&mask;
+    }
+    m_Index[i] = job;
+}
+
+void CCompressPool::RemoveJob(Job* job)
+{
+    size_t mask = m_Index.size()-1;
+    size_t i = IndexSlot(job->chunk);
+    while (m_Index[i]!=job)
+    {
+        i = (i+1)&mask;
+    }
+
+    // moves back the jobs after the hole that can't be found past it
+    for (size_t j=(i+1)&mask;NULL!=m_Index[j];j=(j+1)&mask)
+    {
+        size_t home = IndexSlot(m_Index[j]->chunk);
+        if (((j-home)&mask)>=((j-i)&mask))
+        {
+            m_Index[i] = m_Index[j];
+            i = j;
+        }
+    }
+    m_Index[i] = NULL;
+}
+
+void CCompressPool::Enqueue(Job* job)
+{
+    job->state = JobQueued;
+    job->next = NULL;
+    job->prev = m_QueueTail;
+    if (NULL!=m_QueueTail)
+    {
+        m_QueueTail->next = job;
+    } else {
+        m_QueueHead = job;
+    }
+    m_QueueTail = job;
+}
+
+void CCompressPool::Dequeue(Job* job)
+{
+    MKV_ASSERT(job->state==JobQueued);
+    if (NULL!=job->prev)
+    {
+        job->prev->next = job->next;
+    } else {
+        m_QueueHead = job->next;
+    }
+    if (NULL!=job->next)
+    {
+        job->next->prev = job->prev;
+    } else {
+        m_QueueTail = job->prev;
+    }
+    job->next = NULL;
+    job->prev = NULL;
+    job->state = JobRunning;
+}
+
+void CCompressPool::RunJob(Job* job)
+{
+    try
+    {
+        job->result = job->chunk->compress_start(job->type,job->level);
+        if (job->result)
+        {
+            job->result = job->chunk->compress_wait();
+        }
+    } catch(std::exception &Ex)
+    {
+        // Wait() rethrows on the mux thread, the message is traced here
+        // as the pool is gone by the time the mux catches it
+        char tstr[512];
+        strcpy(tstr,"Exception in compression: ");
+        strncat(tstr,Ex.what(),sizeof(tstr)-strlen(tstr)-1);
+        lgpl_trace(tstr);
+        job->result = false;
+        job->failed = true;
+    } catch(...)
+    {
+        lgpl_trace("Exception in compression: unknown");
+        job->result = false;
+        job->failed = true;
+    }
+}
+
+bool CCompressPool::Start(IMkvChunk* Chunk,unsigned int Type,unsigned int Level)
+{
+#ifdef MKV_CPOOL_THREADS
+    if (0!=m_ThreadCount)
+    {
+        pthread_mutex_lock(&SYS->lock);
+        if (NULL!=FindJob(Chunk))
+        {
+            pthread_mutex_unlock(&SYS->lock);
+            return true;
+        }
+        if (false==m_FreeJobs.empty())
+        {
+            Job* job = m_FreeJobs.back();
+            m_FreeJobs.pop_back();
+
+            job->chunk = Chunk;
+            job->type = Type;
+            job->level = Level;
+            job->result = false;
+            job->failed = false;
+            AddJob(job);
+            Enqueue(job);
+            pthread_cond_signal(&SYS->queued);
+            pthread_mutex_unlock(&SYS->lock);
+            return true;
+        }
+        pthread_mutex_unlock(&SYS->lock);
+    }
+#endif
+    // queue is full, compress on the calling thread
+    return Chunk->compress_start(Type,Level);
+}
+
+bool CCompressPool::Wait(IMkvChunk* Chunk)
+{
+#ifdef MKV_CPOOL_THREADS
+    if (0!=m_ThreadCount)
+    {
+        pthread_mutex_lock(&SYS->lock);
+        Job* job = FindJob(Chunk);
+        if (NULL!=job)
+        {
+            if (job->state==JobQueued)
+            {
+                // no worker picked it up yet, don't wait for one
+                Dequeue(job);
+                pthread_mutex_unlock(&SYS->lock);
+                RunJob(job);
+                pthread_mutex_lock(&SYS->lock);
+                job->state = JobDone;
+            }
+            while (job->state!=JobDone)
+            {
+                pthread_cond_wait(&SYS->done,&SYS->lock);
+            }
+            bool result = job->result;
+            bool failed = job->failed;
+            RemoveJob(job);
+            job->state = JobFree;
+            job->chunk = NULL;
+            m_FreeJobs.push_back(job);
+            pthread_mutex_unlock(&SYS->lock);
+            if (failed)
+            {
+                throw mkv_error_exception("Frame compression failed");
+            }
+            return result;
+        }
+        pthread_mutex_unlock(&SYS->lock);
+    }
+#endif
+    return true;
+}
+
+void CCompressPool::WorkerProc()
+{
+#ifdef MKV_CPOOL_THREADS
+    CThreadWorld world(m_World);
+
+    pthread_mutex_lock(&SYS->lock);
+    while (true)
+    {
+        if (SYS->stop) break;
+
+        Job* job = m_QueueHead;
+        if (NULL==job)
+        {
+            pthread_cond_wait(&SYS->queued,&SYS->lock);
+            continue;
+        }
+
+        Dequeue(job);
+        pthread_mutex_unlock(&SYS->lock);
+
+        RunJob(job);
+
+        pthread_mutex_lock(&SYS->lock);
+        job->state = JobDone;
+        pthread_cond_broadcast(&SYS->done);
+    }
+    pthread_mutex_unlock(&SYS->lock);
+#endif
+}
+
+void* CCompressPool::WorkerProcStatic(void* Context)
+{
+    ((CCompressPool*)Context)->WorkerProc();
+    return NULL;
+}
@@ -23,6 +23,21 @@
 #include <libmkv/ebmlwrite.h>
 #include <exception>
 
+//
+// Sequential writes are collected in a staging buffer and handed to the
+// write target in large blocks. Overwrites of data still in the buffer are
+// applied in place, overwrites of data already written are journaled and
+// sent to the target after the next buffer flush.
+//
+static const size_t EbmlWriteBufferSize = 4*1024*1024;
+static const size_t EbmlWriteBufferAlign = 4096;
+static const size_t EbmlWriteMaxPatchData = 256*1024;
+
+CEbmlWrite::~CEbmlWrite()
+{
+    delete[] m_BufferAlloc;
+}
+
 uint32 CEbmlWrite::read(void*Buffer,size_t Size)
 {
     throw mkv_error_exception("CEbmlWrite::read");
@@ -60,13 +75,31 @@ size_t CEbmlWrite::write(const void*Buffer,size_t Size)
     if (false==m_OvrOffsetSet)
     {
         m_Offset += Size;
-        return (m_Writer->Write(Buffer,(unsigned int)Size)) ? Size : 0;
+        return Append(Buffer,Size) ? Size : 0;
     } else {
         int64_t toff = m_OvrOffset;
         MKV_ASSERT(true==m_OvrOffsetSet);
         m_OvrOffset += Size;
-        return (m_Writer->Overwrite(toff,Buffer,(unsigned int)Size)) ? Size : 0;
+        return Overwrite(toff,Buffer,Size) ? Size : 0;
+    }
+}
+
+size_t CEbmlWrite::writev(const IOVector*Buffers,size_t Count)
+{
+    if (true==m_OvrOffsetSet)
+    {
+        return IOCallback::writev(Buffers,Count);
+    }
+
+    size_t size = 0;
+    for (size_t i=0;i<Count;i++)
+    {
+        if (0==Buffers[i].Size) continue;
+        m_Offset += Buffers[i].Size;
+        if (false==Append(Buffers[i].Buffer,Buffers[i].Size)) return size;
+        size += Buffers[i].Size;
     }
+    return size;
 }
 
 uint64 CEbmlWrite::getFilePointer()
@@ -79,3 +112,159 @@ uint64 CEbmlWrite::getFilePointer()
     }
 }
 
+
+// a streaming target takes appends only, so checksums are computed before
+// the data is written
+bool CEbmlWrite::canOverwrite()
+{
+    return !m_Streaming;
+}
+
+void CEbmlWrite::SetStreaming(bool Streaming)
+{
+    m_Streaming = Streaming;
+}
+
+//
+// While replaying, everything written is already in the target (the
+// elements are only rendered again to restore their positions), so data is
+// dropped and only the offset moves. EndReplay continues appending at the
+// end of the data the target has.
+//
+void CEbmlWrite::StartReplay()
+{
+    MKV_ASSERT( (0==m_BufferUsed) && m_Patches.empty() );
+    m_Replay = true;
+}
+
+bool CEbmlWrite::EndReplay(uint64_t Offset)
+{
+    MKV_ASSERT(false==m_OvrOffsetSet);
+    if (Offset<m_Offset) return false;
+    m_Offset = Offset;
+    m_Replay = false;
+    return true;
+}
+
+bool CEbmlWrite::Append(const void*Buffer,size_t Size)
+{
+    if (m_Replay) return true;
+
+    if (NULL==m_BufferAlloc)
+    {
+        m_BufferAlloc = new uint8_t[EbmlWriteBufferSize+EbmlWriteBufferAlign];
+        m_Buffer = m_BufferAlloc + ( EbmlWriteBufferAlign - (((uintptr_t)m_BufferAlloc)%EbmlWriteBufferAlign) );
+        m_BufferSize = EbmlWriteBufferSize;
+    }
+
+    const uint8_t* data = (const uint8_t*)Buffer;
+    while (Size!=0)
+    {
+        if ( (0==m_BufferUsed) && (Size>=m_BufferSize) )
+        {
+            // large block, don't copy it
+            if (false==WriteTarget(data,Size)) return false;
+            return FlushPatches();
+        }
+
+        size_t len = m_BufferSize - m_BufferUsed;
+        if (len>Size) len=Size;
+
+        memcpy(m_Buffer+m_BufferUsed,data,len);
+        m_BufferUsed += len;
+        data += len;
+        Size -= len;
+
+        if (m_BufferUsed==m_BufferSize)
+        {
+            if (false==FlushBuffer()) return false;
+        }
+    }
+    return true;
+}
+
+bool CEbmlWrite::Overwrite(uint64_t Offset,const void*Buffer,size_t Size)
+{
+    if (m_Replay) return true;
+
+    uint64_t buffer_start = m_Offset - m_BufferUsed;
+    const uint8_t* data = (const uint8_t*)Buffer;
+
+    MKV_ASSERT((Offset+Size)<=m_Offset);
+
+    if ((Offset+Size)>buffer_start)
+    {
+        // tail of the patch is still in the staging buffer
+        size_t skip = (Offset<buffer_start) ? (size_t)(buffer_start-Offset) : 0;
+        memcpy(m_Buffer+(size_t)(Offset+skip-buffer_start),data+skip,Size-skip);
+        Size = skip;
+        if (0==Size) return true;
+    }
+
+    if (false==m_Patches.empty())
+    {
+        Patch& last = m_Patches.back();
+        if ( (last.offset+last.size)==Offset )
+        {
+            m_PatchData.insert(m_PatchData.end(),data,data+Size);
+            last.size += (unsigned int)Size;
+            return true;
+        }
+    }
+
+    Patch patch;
+    patch.offset = Offset;
+    patch.size = (unsigned int)Size;
+    patch.data = m_PatchData.size();
+    m_Patches.push_back(patch);
+    m_PatchData.insert(m_PatchData.end(),data,data+Size);
+
+    if (m_PatchData.size()>EbmlWriteMaxPatchData)
+    {
+        return FlushPatches();
+    }
+    return true;
+}
+
+bool CEbmlWrite::FlushBuffer()
+{
+    if (0!=m_BufferUsed)
+    {
+        if (false==WriteTarget(m_Buffer,m_BufferUsed)) return false;
+        m_BufferUsed = 0;
+    }
+    return FlushPatches();
+}
+
+bool CEbmlWrite::FlushPatches()
+{
+    for (size_t i=0;i<m_Patches.size();i++)
+    {
+        if (false==OverwriteTarget(m_Patches[i].offset,&m_PatchData[m_Patches[i].data],m_Patches[i].size))
+        {
+            return false;
+        }
+    }
+    m_Patches.clear();
+    m_PatchData.clear();
+    return true;
+}
+
+bool CEbmlWrite::Flush()
+{
+    return FlushBuffer();
+}
+
+bool CEbmlWrite::WriteTarget(const void*Buffer,size_t Size)
+{
+    CStageTimer timer(m_Stats?&m_Stats->write:NULL);
+    if (m_Stats) m_Stats->write_bytes += Size;
+    return m_Writer->Write(Buffer,(unsigned int)Size);
+}
+
+bool CEbmlWrite::OverwriteTarget(uint64_t Offset,const void*Buffer,unsigned int Size)
+{
+    CStageTimer timer(m_Stats?&m_Stats->write:NULL);
+    if (m_Stats) m_Stats->overwrite_calls++;
+    return m_Writer->Overwrite(Offset,Buffer,Size);
+}
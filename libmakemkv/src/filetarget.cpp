@@ -0,0 +1,318 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include <libmkv/libmkv.h>
+#include <lgpl/cassert>
+#include <lgpl/sstring.h>
+#include <lgpl/world.h>
+
+#ifndef _MSC_VER
+#define MKV_FILE_TARGET 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+// O_DIRECT needs the buffer, offsets and sizes aligned to the logical block
+// size, a page covers every device in use
+#define FILE_TARGET_ALIGN           4096
+#define FILE_TARGET_BUFFER_SIZE     (4*1024*1024)
+
+#ifdef MKV_FILE_TARGET
+
+class CFileTarget : public IMkvFileTarget
+{
+private:
+    int             m_Fd;
+    uint8_t*        m_Buffer;
+    unsigned int    m_BufferSize;
+    unsigned int    m_Used;
+    uint64_t        m_Flushed;
+    uint64_t        m_Behind;
+    bool            m_Direct;
+    bool            m_WriteBehind;
+    bool            m_Error;
+public:
+    CFileTarget();
+    virtual ~CFileTarget();
+    bool Open(const char* Name,const MkvFileTargetOptions* Options);
+public:
+    bool Write(const void *Data,unsigned int Size);
+    bool Overwrite(uint64_t Offset,const void *Data,unsigned int Size);
+    bool Close();
+    void Release()
+    {
+        delete this;
+    }
+private:
+    bool WriteAt(uint64_t Offset,const void* Data,size_t Size);
+    bool PatchAt(uint64_t Offset,const uint8_t* Data,unsigned int Size);
+    bool Flush();
+    void WriteBehind(uint64_t Offset,uint64_t Size);
+    bool Fail(const char* What);
+};
+
+CFileTarget::CFileTarget()
+    : m_Fd(-1) , m_Buffer(NULL) , m_BufferSize(0) , m_Used(0) , m_Flushed(0) , m_Behind(0) ,
+      m_Direct(false) , m_WriteBehind(false) , m_Error(false)
+{
+}
+
+CFileTarget::~CFileTarget()
+{
+    if (m_Fd>=0) Close();
+    free(m_Buffer);
+}
+
+bool CFileTarget::Open(const char* Name,const MkvFileTargetOptions* Options)
+{
+    MkvFileTargetOptions options;
+
+    if (NULL!=Options)
+    {
+        options = *Options;
+    } else {
+        memset(&options,0,sizeof(options));
+    }
+
+    int flags = O_WRONLY|O_CREAT|O_TRUNC;
+#ifdef _linux_
+    if (options.direct_io)
+    {
+        // unaligned overwrites read the blocks around them
+        m_Fd = open(Name,O_RDWR|O_CREAT|O_TRUNC|O_DIRECT,0666);
+        m_Direct = (m_Fd>=0);
+    }
+    m_WriteBehind = options.write_behind;
+#endif
+    if (m_Fd<0)
+    {
+        m_Fd = open(Name,flags,0666);
+    }
+    if (m_Fd<0) return Fail("open");
+
+    m_BufferSize = options.buffer_size ? options.buffer_size : FILE_TARGET_BUFFER_SIZE;
+    m_BufferSize = (m_BufferSize+(FILE_TARGET_ALIGN-1)) & ~(FILE_TARGET_ALIGN-1);
+
+    void* buffer;
+    if (0!=posix_memalign(&buffer,FILE_TARGET_ALIGN,m_BufferSize)) return Fail("allocate");
+    m_Buffer = (uint8_t*)buffer;
+
+#ifdef _linux_
+    // an error only means the filesystem can't preallocate
+    if (0!=options.expected_size)
+    {
+        fallocate(m_Fd,0,0,(off_t)options.expected_size);
+    }
+#endif
+    return true;
+}
+
+bool CFileTarget::Fail(const char* What)
+{
+    char tstr[256];
+
+    sprintf_s(tstr,sizeof(tstr),"libmkv: file target %s failed: %s",What,strerror(errno));
+    lgpl_trace(tstr);
+    m_Error = true;
+    return false;
+}
+
+bool CFileTarget::WriteAt(uint64_t Offset,const void* Data,size_t Size)
+{
+    const uint8_t* p = (const uint8_t*)Data;
+
+    while (Size!=0)
+    {
+        ssize_t done = pwrite(m_Fd,p,Size,(off_t)Offset);
+        if (done<0)
+        {
+            if (errno==EINTR) continue;
+#ifdef _linux_
+            // some filesystems accept O_DIRECT on open but not on write
+            if ( (errno==EINVAL) && m_Direct )
+            {
+                m_Direct = false;
+                if (0==fcntl(m_Fd,F_SETFL,fcntl(m_Fd,F_GETFL)&~O_DIRECT)) continue;
+            }
+#endif
+            return false;
+        }
+        p += done;
+        Offset += done;
+        Size -= done;
+    }
+    return true;
+}
+
+// with O_DIRECT the blocks around an overwrite are read, patched and written back
+bool CFileTarget::PatchAt(uint64_t Offset,const uint8_t* Data,unsigned int Size)
+{
+    if (!m_Direct) return WriteAt(Offset,Data,Size);
+
+    uint64_t start = Offset & ~((uint64_t)FILE_TARGET_ALIGN-1);
+    uint64_t end = (Offset+Size+(FILE_TARGET_ALIGN-1)) & ~((uint64_t)FILE_TARGET_ALIGN-1);
+    size_t size = (size_t)(end-start);
+    void* block;
+    bool ok = true;
+
+    MKV_ASSERT(end<=m_Flushed);
+
+    if (0!=posix_memalign(&block,FILE_TARGET_ALIGN,size)) return false;
+
+    for (size_t done=0;ok && (done<size);)
+    {
+        ssize_t n = pread(m_Fd,((uint8_t*)block)+done,size-done,(off_t)(start+done));
+        if ( (n<0) && (errno==EINTR) ) continue;
+        if (n<=0) ok = false;
+        done += (n>0) ? n : 0;
+    }
+    if (ok)
+    {
+        memcpy(((uint8_t*)block)+(Offset-start),Data,Size);
+        ok = WriteAt(start,block,size);
+    }
+    free(block);
+    return ok;
+}
+
+bool CFileTarget::Flush()
+{
+    if (false==WriteAt(m_Flushed,m_Buffer,m_Used)) return false;
+
+    WriteBehind(m_Flushed,m_Used);
+    m_Flushed += m_Used;
+    m_Used = 0;
+    return true;
+}
+
+// starts writeback of the range just written and waits for the ranges
+// before it, so that dirty pages don't pile up and written ones can be dropped
+void CFileTarget::WriteBehind(uint64_t Offset,uint64_t Size)
+{
+#ifdef _linux_
+    if ( (!m_WriteBehind) || m_Direct ) return;
+
+    sync_file_range(m_Fd,(off64_t)Offset,(off64_t)Size,SYNC_FILE_RANGE_WRITE);
+    if (Offset>m_Behind)
+    {
+        sync_file_range(m_Fd,(off64_t)m_Behind,(off64_t)(Offset-m_Behind),
+            SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(m_Fd,(off_t)m_Behind,(off_t)(Offset-m_Behind),POSIX_FADV_DONTNEED);
+        m_Behind = Offset;
+    }
+#endif
+}
+
+bool CFileTarget::Write(const void *Data,unsigned int Size)
+{
+    const uint8_t* p = (const uint8_t*)Data;
+
+    if (m_Error) return false;
+
+    while (Size!=0)
+    {
+        unsigned int size = m_BufferSize - m_Used;
+        if (size>Size) size = Size;
+
+        memcpy(m_Buffer+m_Used,p,size);
+        m_Used += size;
+        p += size;
+        Size -= size;
+
+        if ( (m_Used==m_BufferSize) && (false==Flush()) ) return Fail("write");
+    }
+    return true;
+}
+
+bool CFileTarget::Overwrite(uint64_t Offset,const void *Data,unsigned int Size)
+{
+    const uint8_t* p = (const uint8_t*)Data;
+
+    if (m_Error) return false;
+    if ((Offset+Size)>(m_Flushed+m_Used)) return false;
+
+    // the part that is still in the buffer
+    if ((Offset+Size)>m_Flushed)
+    {
+        uint64_t start = (Offset>m_Flushed) ? Offset : m_Flushed;
+        memcpy(m_Buffer+(start-m_Flushed),p+(start-Offset),(size_t)(Offset+Size-start));
+        if (Offset>=m_Flushed) return true;
+        Size = (unsigned int)(m_Flushed-Offset);
+    }
+
+    if (false==PatchAt(Offset,p,Size)) return Fail("overwrite");
+    return true;
+}
+
+bool CFileTarget::Close()
+{
+    if (m_Fd<0) return !m_Error;
+
+    if ( (!m_Error) && (m_Used!=0) )
+    {
+        size_t size = m_Used;
+        if (m_Direct)
+        {
+            // the padding is cut off below
+            size = (size+(FILE_TARGET_ALIGN-1)) & ~(FILE_TARGET_ALIGN-1);
+            memset(m_Buffer+m_Used,0,size-m_Used);
+        }
+        if (WriteAt(m_Flushed,m_Buffer,size))
+        {
+            m_Flushed += m_Used;
+            m_Used = 0;
+        } else {
+            Fail("write");
+        }
+    }
+
+    // drops the preallocated space that wasn't used
+    if ( (!m_Error) && (0!=ftruncate(m_Fd,(off_t)m_Flushed)) ) Fail("truncate");
+
+    if (0!=close(m_Fd)) Fail("close");
+    m_Fd = -1;
+
+    return !m_Error;
+}
+
+#endif // MKV_FILE_TARGET
+
+extern "C"
+IMkvFileTarget* __cdecl MkvCreateFileTarget(const char* Name,const MkvFileTargetOptions* Options) throw()
+{
+#ifdef MKV_FILE_TARGET
+    try
+    {
+        CFileTarget* target = new CFileTarget();
+        if (target->Open(Name,Options))
+        {
+            return target;
+        }
+        delete target;
+    } catch(...)
+    {
+        lgpl_trace("libmkv: can't create file target");
+    }
+#endif
+    return NULL;
+}
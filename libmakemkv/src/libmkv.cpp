@@ -21,11 +21,14 @@
 #include <libmkv/libmkv.h>
 #include <libmkv/internal.h>
 #include <libmkv/ebmlwrite.h>
+#include <libmkv/cpool.h>
 #include <lgpl/cassert>
 #include <exception>
 #include <lgpl/sstring.h>
 #include <lgpl/world.h>
+#include <stddef.h>
 #include <vector>
+#include <algorithm>
 #include <lgpl/apdefs.h>
 
 #ifndef __STDC_FORMAT_MACROS
@@ -39,6 +42,28 @@
 #define AUTO_DURATION_TIMECODE      4500000000ll
 #define BAD_TIMECODE                ((1ll<<62)+1)
 
+#define COMPRESS_POOL_DEPTH         64
+
+// front cues space, a cue point takes at most 22 bytes and clusters rarely
+// start more than twice a second
+#define CUES_RESERVE_POINT_SIZE     24
+#define CUES_RESERVE_PER_SECOND     2
+#define CUES_RESERVE_MIN            4096
+
+// automatic header stripping, a prefix is used when all sampled frames share
+// it and it is at least 1/HEADER_STRIP_MIN_RATIO of the average frame
+#define HEADER_STRIP_SAMPLE_FRAMES  64
+#define HEADER_STRIP_MIN_FRAMES     16
+#define HEADER_STRIP_MIN_SIZE       2
+#define HEADER_STRIP_MAX_SIZE       64
+#define HEADER_STRIP_MIN_RATIO      1000
+
+// output written between two checkpoints
+#define CHECKPOINT_INTERVAL         (64*1024*1024)
+#define CHECKPOINT_MAGIC            0x31544b43564b4d00ull
+#define CHECKPOINT_VERSION          1
+
+
 #define CNZ(x) if (!(x)) { throw mkv_error_exception( "Error in " #x ); };
 
 template <class Tv,class Te>
@@ -86,6 +111,33 @@ static inline KaxSeek* AddSeekEntry(KaxSeekHead& Seek)
     return CreateSeekEntry(Seek,EBML_ID(Te));
 }
 
+// drops a child that was never written, used instead of VoidElement when
+// the output can't be overwritten
+static void RemoveElement(EbmlMaster& Parent,EbmlElement* Element)
+{
+    std::vector<EbmlElement*> &list = Parent.GetElementList();
+    for (size_t i=0;i<list.size();i++)
+    {
+        if (list[i]==Element)
+        {
+            Parent.Remove(i);
+            delete Element;
+            return;
+        }
+    }
+}
+
+// frees children that were written and are not needed any more
+static void DeleteChildren(EbmlMaster& Parent)
+{
+    std::vector<EbmlElement*> &list = Parent.GetElementList();
+    for (size_t i=0;i<list.size();i++)
+    {
+        delete list[i];
+    }
+    Parent.RemoveAll();
+}
+
 static inline void UpdateSeekEntry(KaxSeek* Seek,IOCallback &File,const EbmlElement & aElt, const KaxSegment & ParentSegment)
 {
     GetChild<EbmlUInteger,KaxSeekPosition>(Seek) = ParentSegment.GetRelativePosition(aElt);
@@ -119,9 +171,83 @@ static void OverwriteIntegerData(IOCallback & output, uint64_t Value, uint64_t P
     output.setFilePointer(CurrentPosition);
 }
 
-static void FinishCluster(KaxCluster *cluster,IOCallback *File,KaxSegment *Segment);
+typedef struct _MkvClusterRecord
+{
+    uint64_t    position;
+    int64_t     timecode;
+} MkvClusterRecord;
+
+static void FinishCluster(KaxCluster *cluster,IOCallback *File,KaxSegment *Segment,MkvClusterRecord *Record,bool Streaming);
+
+//
+// Per-stage counters for one mux. Track stages are summed into the totals
+// by Finish(), render time excludes the write target time spent inside it.
+//
+class CMuxStats
+{
+private:
+    MkvMuxStats     m_Stats;
+    MkvTrackStats   m_Overflow;
+public:
+    CMuxStats()
+    {
+        memset(&m_Stats,0,sizeof(m_Stats));
+        memset(&m_Overflow,0,sizeof(m_Overflow));
+    }
+    MkvMuxStats* Get()
+    {
+        return &m_Stats;
+    }
+    MkvTrackStats* Track(unsigned int Id)
+    {
+        return (Id<MKV_STATS_MAX_TRACKS) ? &m_Stats.track[Id] : &m_Overflow;
+    }
+    void Finish(unsigned int TrackCount)
+    {
+        m_Stats.track_count = (TrackCount<MKV_STATS_MAX_TRACKS) ? TrackCount : MKV_STATS_MAX_TRACKS;
+        m_Stats.fetch = m_Overflow.fetch;
+        m_Stats.compress = m_Overflow.compress;
+        m_Stats.frames = m_Overflow.frames;
+        m_Stats.blocks = m_Overflow.blocks;
+        for (unsigned int i=0;i<m_Stats.track_count;i++)
+        {
+            Add(&m_Stats.fetch,&m_Stats.track[i].fetch);
+            Add(&m_Stats.compress,&m_Stats.track[i].compress);
+            m_Stats.frames += m_Stats.track[i].frames;
+            m_Stats.blocks += m_Stats.track[i].blocks;
+        }
+    }
+private:
+    static void Add(MkvStageStats* Dst,const MkvStageStats* Src)
+    {
+        Dst->time_ns += Src->time_ns;
+        Dst->calls += Src->calls;
+    }
+};
+
+class CRenderTimer
+{
+private:
+    MkvMuxStats*    m_Stats;
+    uint64_t        m_Start;
+    uint64_t        m_WriteStart;
+public:
+    CRenderTimer(CMuxStats* Stats)
+        : m_Stats(Stats->Get())
+    {
+        m_WriteStart = m_Stats->write.time_ns;
+        m_Start = libmkv_clock_ns();
+    }
+    ~CRenderTimer()
+    {
+        uint64_t elapsed = libmkv_clock_ns() - m_Start;
+        uint64_t write = m_Stats->write.time_ns - m_WriteStart;
+        m_Stats->render.time_ns += (elapsed>write) ? (elapsed-write) : 0;
+        m_Stats->render.calls++;
+    }
+};
 
-static int64_t GetClusterTimecode(IMkvTrack *Input)
+static int64_t GetClusterTimecode(IMkvTrack *Input,CMuxStats* Stats)
 {
     int64_t rtn = -1;
     for (unsigned int i=0;i<Input->MkvGetStreamCount();i++)
@@ -131,11 +257,14 @@ static int64_t GetClusterTimecode(IMkvTrack *Input)
 
         p = Input->MkvGetStream(i);
 
-        if (i==0)
         {
-            CNZ(p->FetchFrames(2,true));
-        } else {
-            CNZ(p->FetchFrames(1,false));
+            CStageTimer timer(&Stats->Track(i)->fetch);
+            if (i==0)
+            {
+                CNZ(p->FetchFrames(2,true));
+            } else {
+                CNZ(p->FetchFrames(1,false));
+            }
         }
 
         frameCount = p->GetAvailableFramesCount();
@@ -175,37 +304,157 @@ static UTFstring UTF8string(const char *str)
     return rtn;
 }
 
-static uint64_t Rand64()
+//
+// Random values used while building the header. They are logged so that a
+// checkpoint can rebuild an identical header when the mux is resumed. Header
+// values sampled from the input (which a resumed mux can't sample again) are
+// logged the same way with Value.
+//
+class CHeaderRandom
 {
-    uint64_t value;
-    for (unsigned int k=0;k<sizeof(value);k++)
+private:
+    std::vector<uint8_t>    m_Log;
+    size_t                  m_ReplayPos;
+    bool                    m_Replay;
+public:
+    CHeaderRandom()
+        : m_ReplayPos(0) , m_Replay(false)
     {
-        ((uint8_t*)&value)[k]=lgpl_get_random_byte();
     }
-    return value;
-}
+    uint8_t Byte()
+    {
+        if (m_Replay)
+        {
+            if (m_ReplayPos>=m_Log.size()) throw mkv_error_exception("Checkpoint doesn't match the title");
+            return m_Log[m_ReplayPos++];
+        }
+        uint8_t value = lgpl_get_random_byte();
+        m_Log.push_back(value);
+        return value;
+    }
+    uint64_t Get64()
+    {
+        uint64_t value;
+        for (unsigned int k=0;k<sizeof(value);k++)
+        {
+            ((uint8_t*)&value)[k]=Byte();
+        }
+        return value;
+    }
+    void Value(std::vector<uint8_t>& Data)
+    {
+        if (m_Replay)
+        {
+            size_t size = Byte();
+            if ((m_ReplayPos+size)>m_Log.size()) throw mkv_error_exception("Checkpoint doesn't match the title");
+            Data.assign(m_Log.begin()+m_ReplayPos,m_Log.begin()+m_ReplayPos+size);
+            m_ReplayPos += size;
+            return;
+        }
+        MKV_ASSERT(Data.size()<256);
+        m_Log.push_back((uint8_t)Data.size());
+        m_Log.insert(m_Log.end(),Data.begin(),Data.end());
+    }
+    void Replay(const std::vector<uint8_t>& Log)
+    {
+        m_Log = Log;
+        m_ReplayPos = 0;
+        m_Replay = true;
+    }
+    bool ReplayDone() const
+    {
+        return (false==m_Replay) || (m_ReplayPos==m_Log.size());
+    }
+    const std::vector<uint8_t>& Log() const
+    {
+        return m_Log;
+    }
+};
+
+class CCheckpointData
+{
+private:
+    std::vector<uint8_t>    m_Data;
+    size_t                  m_Pos;
+public:
+    CCheckpointData()
+        : m_Pos(0)
+    {
+    }
+    void Clear()
+    {
+        m_Data.clear();
+        m_Pos = 0;
+    }
+    void Assign(const void* Data,size_t Size)
+    {
+        m_Data.assign((const uint8_t*)Data,((const uint8_t*)Data)+Size);
+        m_Pos = 0;
+    }
+    const void* Data() const
+    {
+        return m_Data.empty() ? NULL : &m_Data[0];
+    }
+    size_t Size() const
+    {
+        return m_Data.size();
+    }
+    void Put(uint64_t Value)
+    {
+        for (unsigned int i=0;i<8;i++)
+        {
+            m_Data.push_back((uint8_t)(Value>>(i*8)));
+        }
+    }
+    uint64_t Get()
+    {
+        uint64_t value = 0;
+        if ((m_Pos+8)>m_Data.size()) throw mkv_error_exception("Bad checkpoint data");
+        for (unsigned int i=0;i<8;i++)
+        {
+            value |= ((uint64_t)m_Data[m_Pos++])<<(i*8);
+        }
+        return value;
+    }
+    void PutBytes(const std::vector<uint8_t>& Bytes)
+    {
+        Put(Bytes.size());
+        m_Data.insert(m_Data.end(),Bytes.begin(),Bytes.end());
+    }
+    void GetBytes(std::vector<uint8_t>& Bytes)
+    {
+        uint64_t size = Get();
+        if (size>(m_Data.size()-m_Pos)) throw mkv_error_exception("Bad checkpoint data");
+        Bytes.assign(m_Data.begin()+m_Pos,m_Data.begin()+m_Pos+(size_t)size);
+        m_Pos += (size_t)size;
+    }
+};
 
 class CChapters
 {
 private:
     KaxChapters         m_Chapters;
+    KaxEditionEntry*    m_Edition;
     std::vector<KaxChapterAtom*> m_Atoms;
     unsigned int        m_RealCount;
     bool                m_DoRender;
+    bool                m_Streaming;
     IMkvTitleInfo*      m_TitleInfo;
     MkvFormatInfo*      m_FormatInfo;
 public:
-    CChapters(IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo)
-        : m_RealCount(0) , m_TitleInfo(TitleInfo) , m_FormatInfo(FormatInfo)
+    CChapters(IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,CHeaderRandom* Random)
+        : m_Edition(NULL) , m_RealCount(0) , m_TitleInfo(TitleInfo) , m_FormatInfo(FormatInfo)
     {
         MkvChapterInfo  ti;
         unsigned int chap_count = m_TitleInfo->GetChapterCount();
 
         m_DoRender=false;
+        m_Streaming=m_FormatInfo->profile.streamingOutput;
 
         if (chap_count==0) return;
 
-        KaxEditionEntry &edit = CreateEdition();
+        KaxEditionEntry &edit = CreateEdition(Random);
+        m_Edition = &edit;
 
         for (unsigned int i=0;i<chap_count;i++)
         {
@@ -215,7 +464,7 @@ public:
             m_TitleInfo->GetChapterInfo(&ti,i);
 
             atom = & AddNewChild<KaxChapterAtom>(edit);
-            GetChild<EbmlUInteger,KaxChapterUID>( *atom ) = Rand64();
+            GetChild<EbmlUInteger,KaxChapterUID>( *atom ) = Random->Get64();
 
             GetChild<EbmlUInteger,KaxChapterTimeStart>( *atom ) = 0;
             GetChild<EbmlUInteger,KaxChapterTimeStart>( *atom ).SetDefaultSize(MAX_TIMECODE_SIZE_BYTES);
@@ -233,6 +482,9 @@ public:
     }
     void Render(IOCallback &File,KaxSeek* Seek,const KaxSegment & FileSegment)
     {
+        // chapter times are not known yet, streaming output writes them last
+        if (m_Streaming) return;
+
         if (m_DoRender)
         {
             CNZ(m_Chapters.Render(File,true));
@@ -250,30 +502,71 @@ public:
         if (m_RealCount>0)
         {
             GetChild<EbmlUInteger,KaxChapterTimeEnd>( *(m_Atoms[m_RealCount-1]) ) = TimecodeFromClock(Timecode);
-            CNZ(m_Atoms[m_RealCount-1]->OverwriteData(File,true));
+            if (!m_Streaming) CNZ(m_Atoms[m_RealCount-1]->OverwriteData(File,true));
         }
         GetChild<EbmlUInteger,KaxChapterTimeStart>( *(m_Atoms[m_RealCount]) ) = TimecodeFromClock(Timecode);
-        CNZ(m_Atoms[m_RealCount]->OverwriteData(File,true));
+        if (!m_Streaming) CNZ(m_Atoms[m_RealCount]->OverwriteData(File,true));
         m_RealCount++;
     }
-    void Finalize(IOCallback &File,KaxSeek* Seek,uint64_t Duration)
+    void Save(CCheckpointData& Data)
     {
-        if (!m_DoRender) return;
+        Data.Put(m_RealCount);
+        for (unsigned int i=0;i<m_RealCount;i++)
+        {
+            Data.Put(GetChild<EbmlUInteger,KaxChapterTimeStart>(m_Atoms[i]));
+            Data.Put(GetChild<EbmlUInteger,KaxChapterTimeEnd>(m_Atoms[i]));
+        }
+    }
+    void Load(CCheckpointData& Data)
+    {
+        uint64_t count = Data.Get();
+        if ( (count>m_Atoms.size()) || ((count!=0) && (!m_DoRender)) )
+        {
+            throw mkv_error_exception("Checkpoint doesn't match the title");
+        }
+        m_RealCount = (unsigned int)count;
+        for (unsigned int i=0;i<m_RealCount;i++)
+        {
+            GetChild<EbmlUInteger,KaxChapterTimeStart>(m_Atoms[i]) = Data.Get();
+            GetChild<EbmlUInteger,KaxChapterTimeEnd>(m_Atoms[i]) = Data.Get();
+        }
+    }
+    // returns false if the file ends up without chapters
+    bool Finalize(IOCallback &File,KaxSeek* Seek,uint64_t Duration,const KaxSegment & FileSegment)
+    {
+        if (!m_DoRender) return false;
 
         if (m_RealCount<2)
         {
-            VoidElement(&m_Chapters,File);
-            VoidElement(Seek,File);
-            return;
+            if (!m_Streaming)
+            {
+                VoidElement(&m_Chapters,File);
+                VoidElement(Seek,File);
+            }
+            return false;
         }
 
         GetChild<EbmlUInteger,KaxChapterTimeEnd>( *m_Atoms[m_RealCount-1] ) = TimecodeFromClock(Duration);
+
+        if (m_Streaming)
+        {
+            for (unsigned int i=m_RealCount;i<m_Atoms.size();i++)
+            {
+                RemoveElement(*m_Edition,m_Atoms[i]);
+            }
+            m_Atoms.resize(m_RealCount);
+            CNZ(m_Chapters.Render(File,true));
+            UpdateSeekEntry(Seek,File,m_Chapters,FileSegment);
+            return true;
+        }
+
         CNZ(m_Atoms[m_RealCount-1]->OverwriteData(File,true));
 
         for (unsigned int i=m_RealCount;i<m_Atoms.size();i++)
         {
             VoidElement(m_Atoms[i],File);
         }
+        return true;
     }
 private:
     void SetChapterName(KaxChapterAtom* atom,const char *lang,const mkv_utf8_t* name)
@@ -289,11 +582,11 @@ private:
         GetChild<EbmlString,KaxChapterLanguage>(disp) = lang;
         GetChild<EbmlUnicodeString,KaxChapterString>(disp) = UTF8string(name);
     }
-    KaxEditionEntry& CreateEdition()
+    KaxEditionEntry& CreateEdition(CHeaderRandom* Random)
     {
         KaxEditionEntry &edit = GetChild<KaxEditionEntry>(m_Chapters);
         GetChild<EbmlUInteger,KaxEditionFlagDefault>(edit) = 1;
-        GetChild<EbmlUInteger,KaxEditionUID>(edit) = Rand64();
+        GetChild<EbmlUInteger,KaxEditionUID>(edit) = Random->Get64();
 
         return edit;
     }
@@ -327,7 +620,42 @@ public:
     uint64_t        stat_bytes_out;
     int64_t         stat_time_start;
     int64_t         stat_time_end;
+    uint64_t        frames_done;
+    int64_t         last_timecode;
+    bool            own_source;     // a source of the library, see libmkv_is_own_source
+    std::vector<uint8_t> header_strip;
 public:
+    void FrameDone(IMkvChunk*  frame)
+    {
+        frames_done++;
+        last_timecode = frame->timecode;
+    }
+    void Save(CCheckpointData& Data)
+    {
+        Data.Put(duration_pos);
+        Data.Put(duration_time);
+        Data.Put(duration_size);
+        Data.Put(refs[0]);
+        Data.Put(refs[1]);
+        Data.Put(stat_frames);
+        Data.Put(stat_bytes);
+        Data.Put(stat_bytes_out);
+        Data.Put(stat_time_start);
+        Data.Put(stat_time_end);
+    }
+    void Load(CCheckpointData& Data)
+    {
+        duration_pos = Data.Get();
+        duration_time = Data.Get();
+        duration_size = (unsigned int)Data.Get();
+        refs[0] = Data.Get();
+        refs[1] = Data.Get();
+        stat_frames = Data.Get();
+        stat_bytes = Data.Get();
+        stat_bytes_out = Data.Get();
+        stat_time_start = Data.Get();
+        stat_time_end = Data.Get();
+    }
     void UpdateStat(IMkvChunk*  frame)
     {
         int64_t time_end = frame->timecode + frame->duration;
@@ -440,32 +768,517 @@ public:
     }
 };
 
+//
+// The frame sources created by the library, only their chunks may carry
+// MKV_CHUNK_LIBMKV_REF
+//
+static CLibmkvLock                      own_sources_lock;
+static std::vector<IMkvFrameSource*>    own_sources;
+
+void libmkv_register_source(IMkvFrameSource* Source,bool Register)
+{
+    own_sources_lock.Lock();
+    std::vector<IMkvFrameSource*>::iterator it = std::find(own_sources.begin(),own_sources.end(),Source);
+    if (Register)
+    {
+        if (it==own_sources.end()) own_sources.push_back(Source);
+    } else {
+        if (it!=own_sources.end()) own_sources.erase(it);
+    }
+    own_sources_lock.Unlock();
+}
+
+bool libmkv_is_own_source(IMkvFrameSource* Source)
+{
+    own_sources_lock.Lock();
+    bool rtn = (std::find(own_sources.begin(),own_sources.end(),Source)!=own_sources.end());
+    own_sources_lock.Unlock();
+    return rtn;
+}
+
+class CDataBufferPool;
+
 class MyDataBuffer : public DataBuffer
 {
 private:
     void*   ref;
+    bool    libmkv_ref;
 public:
-    MyDataBuffer(IMkvChunk* aChunk,unsigned int aOffset=0);
+    MyDataBuffer(IMkvChunk* aChunk,bool OwnSource,unsigned int aOffset=0);
+public:
+    // libmatroska deletes frame buffers through DataBuffer*, the virtual
+    // destructor routes that delete back into the owning pool
+    static void* operator new(size_t Size,CDataBufferPool* Pool);
+    static void operator delete(void* Ptr,CDataBufferPool* Pool);
+    static void operator delete(void* Ptr);
 private:
     bool FreeBuffer() const
     {
-        lgpl_free_chunk_ref(ref);
-        return true;
+        libmkv_free_chunk_ref(ref,libmkv_ref);
+        return true;
+    }
+    static bool MyFreeBufferStatic(const DataBuffer & aBuffer)
+    {
+        const DataBuffer* p = &aBuffer;
+        const MyDataBuffer* pm = static_cast<const MyDataBuffer*>(p);
+        return pm->FreeBuffer();
+    }
+};
+
+MyDataBuffer::MyDataBuffer(IMkvChunk* aChunk,bool OwnSource,unsigned int aOffset)
+ : DataBuffer((binary*)aChunk->get_data()+aOffset,aChunk->get_size()-aOffset,MyFreeBufferStatic)
+{
+    ref = aChunk->get_ref();
+    libmkv_ref = libmkv_is_chunk_ref(aChunk,OwnSource);
+}
+
+class CFrameScheduler
+{
+private:
+    class CHeap
+    {
+    private:
+        std::vector<unsigned int>   m_Items;
+        std::vector<int>*           m_Pos;
+        const std::vector<int64_t>* m_Key;
+    public:
+        void Init(const std::vector<int64_t>* Key,std::vector<int>* Pos,unsigned int Count)
+        {
+            m_Key = Key;
+            m_Pos = Pos;
+            m_Pos->assign(Count,-1);
+            m_Items.reserve(Count);
+        }
+        bool Empty() const
+        {
+            return m_Items.empty();
+        }
+        unsigned int Top() const
+        {
+            return m_Items[0];
+        }
+        void Update(unsigned int Id,bool Present)
+        {
+            int pos = (*m_Pos)[Id];
+            if (pos<0)
+            {
+                if (!Present) return;
+                m_Items.push_back(Id);
+                pos = (int)(m_Items.size()-1);
+                (*m_Pos)[Id] = pos;
+                SiftUp(pos);
+                return;
+            }
+            if (!Present)
+            {
+                unsigned int last = m_Items.back();
+                m_Items.pop_back();
+                (*m_Pos)[Id] = -1;
+                if (last==Id) return;
+                m_Items[pos] = last;
+                (*m_Pos)[last] = pos;
+                Id = last;
+            }
+            SiftUp(pos);
+            SiftDown((*m_Pos)[Id]);
+        }
+    private:
+        // ties are broken by stream index, same as a linear scan with strict compare
+        bool Less(unsigned int a,unsigned int b) const
+        {
+            if ((*m_Key)[a]!=(*m_Key)[b]) return ((*m_Key)[a]<(*m_Key)[b]);
+            return (a<b);
+        }
+        void Place(int pos,unsigned int Id)
+        {
+            m_Items[pos] = Id;
+            (*m_Pos)[Id] = pos;
+        }
+        void SiftUp(int pos)
+        {
+            unsigned int id = m_Items[pos];
+            while (pos>0)
+            {
+                int parent = (pos-1)/2;
+                if (!Less(id,m_Items[parent])) break;
+                Place(pos,m_Items[parent]);
+                pos = parent;
+            }
+            Place(pos,id);
+        }
+        void SiftDown(int pos)
+        {
+            unsigned int id = m_Items[pos];
+            int count = (int)m_Items.size();
+            while (true)
+            {
+                int child = pos*2+1;
+                if (child>=count) break;
+                if ( ((child+1)<count) && Less(m_Items[child+1],m_Items[child]) ) child++;
+                if (!Less(m_Items[child],id)) break;
+                Place(pos,m_Items[child]);
+                pos = child;
+            }
+            Place(pos,id);
+        }
+    };
+private:
+    IMkvTrack*                      m_Input;
+    std::vector<MyMkvTrackInfo>*    m_TrackInfo;
+    CCompressPool*                  m_Pool;
+    CMuxStats*                      m_Stats;
+    std::vector<int64_t>            m_Dts;
+    std::vector<unsigned int>       m_Scanned;
+    std::vector<uint8_t>            m_State;
+    std::vector<int>                m_HeapPos[2];
+    std::vector<unsigned int>       m_Pending;
+    CHeap                           m_Heap[2];
+    unsigned int                    m_ClusterStart;
+    unsigned int                    m_ClusterCont;
+
+    static const uint8_t StateDirty = 1;
+    static const uint8_t StateQueued = 2;
+    static const uint8_t StateClusterStart = 4;
+    static const uint8_t StateClusterCont = 8;
+public:
+    void Init(IMkvTrack *Input,std::vector<MyMkvTrackInfo>* TrackInfo,CCompressPool* Pool,CMuxStats* Stats)
+    {
+        unsigned int count = Input->MkvGetStreamCount();
+
+        m_Input = Input;
+        m_TrackInfo = TrackInfo;
+        m_Pool = Pool;
+        m_Stats = Stats;
+        m_Dts.assign(count,BAD_TIMECODE);
+        m_Scanned.assign(count,0);
+        m_State.assign(count,0);
+        m_ClusterStart = 0;
+        m_ClusterCont = 0;
+        m_Heap[0].Init(&m_Dts,&m_HeapPos[0],count);
+        m_Heap[1].Init(&m_Dts,&m_HeapPos[1],count);
+
+        InvalidateAll();
+    }
+    void Invalidate(unsigned int Id)
+    {
+        m_State[Id] |= StateDirty;
+        if (0==(m_State[Id]&StateQueued))
+        {
+            m_State[Id] |= StateQueued;
+            m_Pending.push_back(Id);
+        }
+    }
+    void InvalidateAll()
+    {
+        for (unsigned int i=0;i<m_State.size();i++)
+        {
+            Invalidate(i);
+        }
+    }
+    void Refresh()
+    {
+        size_t count = m_Pending.size();
+
+        if (count>1)
+        {
+            std::sort(m_Pending.begin(),m_Pending.end());
+        }
+
+        size_t keep = 0;
+        for (size_t k=0;k<count;k++)
+        {
+            unsigned int id = m_Pending[k];
+            if (RefreshStream(id))
+            {
+                m_Pending[keep++] = id;
+            } else {
+                m_State[id] &= ~StateQueued;
+            }
+            m_State[id] &= ~StateDirty;
+        }
+        m_Pending.resize(keep);
+    }
+    int ClusterFlags() const
+    {
+        return ((m_ClusterStart!=0)?1:0) | ((m_ClusterCont!=0)?2:0);
+    }
+    // stream with the lowest dts, either among all streams or only among
+    // streams not waiting for a cluster start
+    unsigned int MinStream(unsigned int HeapId) const
+    {
+        return m_Heap[HeapId].Empty() ? 0 : m_Heap[HeapId].Top();
+    }
+private:
+    // returns true if the stream has to be looked at again on the next frame
+    bool RefreshStream(unsigned int Id)
+    {
+        MyMkvTrackInfo* track = &(*m_TrackInfo)[Id];
+        IMkvFrameSource* stream = m_Input->MkvGetStream(Id);
+        bool force_fetch,type2;
+        unsigned int frames_scan,frames_count;
+        int64_t min_dts;
+
+        if ( (0==(m_State[Id]&StateDirty)) && (0!=m_Scanned[Id]) )
+        {
+            // streams with a partial scan window are re-checked only if
+            // another stream's read has queued more frames for them
+            if (stream->GetAvailableFramesCount()==m_Scanned[Id]) return true;
+        }
+
+        force_fetch = ( (track->info.type==mttVideo) || (track->info.type==mttAudio) );
+        type2 = true;
+
+        {
+            CStageTimer timer(&m_Stats->Track(Id)->fetch);
+            if (false==stream->FetchFrames(1,force_fetch))
+            {
+                throw mkv_error_exception("Error while reading input");
+            }
+        }
+
+        frames_count = stream->GetAvailableFramesCount();
+        frames_scan = (track->info.type==mttVideo)?16:1;
+        if (frames_count<frames_scan)
+        {
+            frames_scan = frames_count;
+        }
+
+        SetClusterState(Id,0);
+        if ( (track->info.type!=mttSubtitle) && frames_scan)
+        {
+            if (stream->PeekFrame(0)->cluster_start())
+            {
+                type2 = false;
+                SetClusterState(Id,StateClusterStart);
+            } else {
+                SetClusterState(Id,StateClusterCont);
+            }
+        }
+
+        min_dts = BAD_TIMECODE;
+        for (unsigned int j=0;j<frames_scan;j++)
+        {
+            int64_t dts;
+
+            IMkvChunk* tf = stream->PeekFrame(j);
+
+            if (tf->timecode==-1) throw mkv_error_exception("Frame not timestamped");
+            dts = ScaleTimecode(TimecodeFromClock(tf->timecode)+(TIMECODE_SCALE/2));
+
+            if (dts<min_dts)
+            {
+                min_dts = dts;
+            }
+        }
+        m_Dts[Id] = min_dts;
+        m_Scanned[Id] = frames_count;
+
+        m_Heap[0].Update(Id,(frames_scan!=0));
+        m_Heap[1].Update(Id,(frames_scan!=0) && type2);
+
+        if (track->compression_type==MKV_TRACK_COMPRESSION_ZLIB)
+        {
+            CStageTimer timer(&m_Stats->Track(Id)->compress);
+            for (unsigned int k=0;k<frames_count;k++)
+            {
+                CNZ(m_Pool->Start(stream->PeekFrame(k),
+                    track->compression_type,
+                    track->compression_level));
+            }
+        }
+
+        if (frames_count==0) return true;
+        if ( (track->info.type==mttVideo) && (frames_count<16) ) return true;
+        return false;
+    }
+    void SetClusterState(unsigned int Id,uint8_t State)
+    {
+        if (m_State[Id]&StateClusterStart) m_ClusterStart--;
+        if (m_State[Id]&StateClusterCont) m_ClusterCont--;
+        m_State[Id] = (m_State[Id]&(StateDirty|StateQueued)) | State;
+        if (State&StateClusterStart) m_ClusterStart++;
+        if (State&StateClusterCont) m_ClusterCont++;
+    }
+};
+
+class CDataBufferPool
+{
+private:
+    typedef union _Header
+    {
+        CDataBufferPool*    pool;
+        uint64_t            align[2];
+    } Header;
+private:
+    std::vector<Header*>    m_Free;
+    uint64_t                m_HeapAllocs;
+public:
+    CDataBufferPool()
+        : m_HeapAllocs(0)
+    {
+    }
+    ~CDataBufferPool()
+    {
+        for (size_t i=0;i<m_Free.size();i++)
+        {
+            ::operator delete(m_Free[i]);
+        }
+    }
+    uint64_t HeapAllocs() const
+    {
+        return m_HeapAllocs;
+    }
+    void* Get(size_t Size)
+    {
+        Header* hdr;
+
+        MKV_ASSERT(Size==sizeof(MyDataBuffer));
+        if (m_Free.empty())
+        {
+            hdr = (Header*) ::operator new(sizeof(Header)+sizeof(MyDataBuffer));
+            m_HeapAllocs++;
+        } else {
+            hdr = m_Free.back();
+            m_Free.pop_back();
+        }
+        hdr->pool = this;
+        return hdr+1;
+    }
+    static void Put(void* Ptr)
+    {
+        if (NULL==Ptr) return;
+
+        Header* hdr = ((Header*)Ptr)-1;
+        hdr->pool->m_Free.push_back(hdr);
+    }
+};
+
+void* MyDataBuffer::operator new(size_t Size,CDataBufferPool* Pool)
+{
+    return Pool->Get(Size);
+}
+
+void MyDataBuffer::operator delete(void* Ptr,CDataBufferPool* Pool)
+{
+    CDataBufferPool::Put(Ptr);
+}
+
+void MyDataBuffer::operator delete(void* Ptr)
+{
+    CDataBufferPool::Put(Ptr);
+}
+
+//
+// The muxer has at most one block in flight, so the block objects (and
+// the optional children of a block group) are kept and reused instead of
+// being allocated for every frame.
+//
+class CBlockPool
+{
+private:
+    CDataBufferPool             m_Buffers;
+    KaxSimpleBlock*             m_SimpleBlock;
+    KaxBlockGroup*              m_BlockGroup;
+    KaxBlockDuration*           m_Duration;
+    std::vector<KaxReferenceBlock*> m_Refs;
+    uint64_t                    m_HeapAllocs;
+public:
+    CBlockPool()
+        : m_SimpleBlock(NULL) , m_BlockGroup(NULL) , m_Duration(NULL) , m_HeapAllocs(0)
+    {
+    }
+    ~CBlockPool()
+    {
+        // attached frames go back to m_Buffers, which is destroyed last
+        delete m_SimpleBlock;
+        delete m_BlockGroup;
+        delete m_Duration;
+        for (size_t i=0;i<m_Refs.size();i++)
+        {
+            delete m_Refs[i];
+        }
+    }
+    CDataBufferPool* Buffers()
+    {
+        return &m_Buffers;
+    }
+    uint64_t HeapAllocs() const
+    {
+        return m_HeapAllocs + m_Buffers.HeapAllocs();
+    }
+    KaxSimpleBlock* GetSimpleBlock()
+    {
+        if (NULL==m_SimpleBlock)
+        {
+            m_SimpleBlock = new KaxSimpleBlock();
+            m_HeapAllocs++;
+        }
+        return m_SimpleBlock;
+    }
+    KaxBlockGroup* GetBlockGroup()
+    {
+        if (NULL==m_BlockGroup)
+        {
+            m_BlockGroup = new KaxBlockGroup();
+            GetChild<KaxBlock>(*m_BlockGroup);
+            m_HeapAllocs+=2;
+        }
+        return m_BlockGroup;
+    }
+    // must be called right before KaxBlockGroup::SetBlockDuration
+    void AddDuration(KaxBlockGroup* Group)
+    {
+        if (NULL==m_Duration)
+        {
+            m_Duration = new KaxBlockDuration();
+            m_HeapAllocs++;
+        }
+        Group->PushElement(*m_Duration);
+        m_Duration = NULL;
+    }
+    KaxReferenceBlock& AddReference(KaxBlockGroup* Group)
+    {
+        KaxReferenceBlock* ref;
+        if (m_Refs.empty())
+        {
+            ref = new KaxReferenceBlock();
+            m_HeapAllocs++;
+        } else {
+            ref = m_Refs.back();
+            m_Refs.pop_back();
+        }
+        Group->PushElement(*ref);
+        return *ref;
+    }
+    void Release(KaxSimpleBlock* Block)
+    {
+        Block->ClearFrames();
     }
-    static bool MyFreeBufferStatic(const DataBuffer & aBuffer)
+    void Release(KaxBlockGroup* Group)
     {
-        const DataBuffer* p = &aBuffer;
-        const MyDataBuffer* pm = static_cast<const MyDataBuffer*>(p);
-        return pm->FreeBuffer();
+        std::vector<EbmlElement*> &list = Group->GetElementList();
+        size_t keep = 0;
+
+        // detach the per-block children, keep the block and mandatory ones
+        for (size_t i=0;i<list.size();i++)
+        {
+            if (EbmlId(*list[i])==EBML_ID(KaxBlockDuration))
+            {
+                m_Duration = static_cast<KaxBlockDuration*>(list[i]);
+            } else if (EbmlId(*list[i])==EBML_ID(KaxReferenceBlock)) {
+                m_Refs.push_back(static_cast<KaxReferenceBlock*>(list[i]));
+            } else {
+                if (EbmlId(*list[i])==EBML_ID(KaxBlock))
+                {
+                    static_cast<KaxBlock*>(list[i])->ClearFrames();
+                }
+                list[keep++] = list[i];
+            }
+        }
+        list.resize(keep);
     }
 };
 
-MyDataBuffer::MyDataBuffer(IMkvChunk* aChunk,unsigned int aOffset)
- : DataBuffer((binary*)aChunk->get_data()+aOffset,aChunk->get_size()-aOffset,MyFreeBufferStatic)
-{
-    ref = aChunk->get_ref();
-}
-
 static void RenderVoid(IOCallback &File,unsigned int Size)
 {
     if (Size==0) return;
@@ -482,7 +1295,58 @@ static void RenderVoid(IOCallback &File,unsigned int Size)
     throw mkv_error_exception("RenderVoid failed");
 }
 
-static DataBuffer* GetDataBuffer(IMkvChunk* frame,MyMkvTrackInfo* track)
+//
+// Finds the longest prefix the first frames of a stream share. Audio and
+// video are fetched up to the sample size, subtitles are sampled from what is
+// already queued so that the other streams aren't read far ahead.
+//
+static void DetectHeaderStripping(IMkvFrameSource* Stream,MkvTrackType Type,std::vector<uint8_t>& Prefix,MkvTrackStats* Stats)
+{
+    unsigned int count;
+    uint64_t total;
+    size_t size;
+
+    Prefix.clear();
+
+    {
+        CStageTimer timer(&Stats->fetch);
+        if (false==Stream->FetchFrames(HEADER_STRIP_SAMPLE_FRAMES,(Type==mttVideo)||(Type==mttAudio)))
+        {
+            throw mkv_error_exception("Error while reading input");
+        }
+    }
+
+    count = Stream->GetAvailableFramesCount();
+    if (count>HEADER_STRIP_SAMPLE_FRAMES) count=HEADER_STRIP_SAMPLE_FRAMES;
+    if ( (count==0) || ( (count<HEADER_STRIP_MIN_FRAMES) && (false==Stream->SourceFinished()) ) ) return;
+
+    const uint8_t* first = Stream->PeekFrame(0)->get_data();
+    size = HEADER_STRIP_MAX_SIZE;
+    total = 0;
+    for (unsigned int i=0;i<count;i++)
+    {
+        IMkvChunk* frame = Stream->PeekFrame(i);
+        const uint8_t* data = frame->get_data();
+        size_t same;
+
+        // a stripped frame must keep at least one byte
+        if (frame->get_size()<=HEADER_STRIP_MIN_SIZE) return;
+        if (size>=frame->get_size()) size=frame->get_size()-1;
+        for (same=0;same<size;same++)
+        {
+            if (data[same]!=first[same]) break;
+        }
+        size = same;
+        total += frame->get_size();
+        if (size<HEADER_STRIP_MIN_SIZE) return;
+    }
+
+    if ((size*HEADER_STRIP_MIN_RATIO)<(total/count)) return;
+
+    Prefix.assign(first,first+size);
+}
+
+static DataBuffer* GetDataBuffer(IMkvChunk* frame,MyMkvTrackInfo* track,CDataBufferPool* pool,MkvTrackStats* stats)
 {
     DataBuffer* mkv_buffer;
 
@@ -493,17 +1357,275 @@ static DataBuffer* GetDataBuffer(IMkvChunk* frame,MyMkvTrackInfo* track)
         {
             throw mkv_error_exception("header_comp_data missing");
         }
-        mkv_buffer = new MyDataBuffer(frame,track->info.header_comp_size);
+        mkv_buffer = new (pool) MyDataBuffer(frame,track->own_source,track->info.header_comp_size);
     } else {
+        CStageTimer timer(&stats->compress);
         CNZ(frame->compress_start(track->compression_type,track->compression_level));
         CNZ(frame->compress_wait());
-        mkv_buffer = new MyDataBuffer(frame);
+        mkv_buffer = new (pool) MyDataBuffer(frame,track->own_source);
     }
     return mkv_buffer;
 }
 
-static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,const char *WritingApp)
+//
+// The cues of the file, kept as one small record per cue point. The
+// KaxCuePoint tree of a point is only built while it is sized or rendered,
+// so a long title doesn't hold thousands of element trees until the end.
+//
+class CCues : public KaxCues
+{
+private:
+    typedef struct _CuePoint
+    {
+        uint64_t    time;
+        uint64_t    track;
+        uint64_t    cluster;
+    } CuePoint;
+    static bool CueBefore(const CuePoint& A,const CuePoint& B)
+    {
+        if (A.time!=B.time) return A.time<B.time;
+        return A.track<B.track;
+    }
+private:
+    std::vector<CuePoint>   m_Points;
+public:
+    void Add(const KaxInternalBlock* Block)
+    {
+        CuePoint cue;
+        cue.time = Block->GlobalTimecode() / TIMECODE_SCALE;
+        cue.track = Block->TrackNum();
+        cue.cluster = Block->ClusterPosition();
+        m_Points.push_back(cue);
+    }
+    void Save(CCheckpointData& Data)
+    {
+        Data.Put(m_Points.size());
+        for (size_t i=0;i<m_Points.size();i++)
+        {
+            Data.Put(m_Points[i].time);
+            Data.Put(m_Points[i].track);
+            Data.Put(m_Points[i].cluster);
+        }
+    }
+    void Load(CCheckpointData& Data)
+    {
+        uint64_t count = Data.Get();
+        m_Points.resize((size_t)count);
+        for (size_t i=0;i<m_Points.size();i++)
+        {
+            m_Points[i].time = Data.Get();
+            m_Points[i].track = Data.Get();
+            m_Points[i].cluster = Data.Get();
+        }
+    }
+    bool IsDefaultValue() const
+    {
+        return m_Points.empty();
+    }
+    uint64 UpdateSize(bool bWithDefault,bool bForceRender)
+    {
+        // the order KaxCues::Render sorts its points in
+        std::stable_sort(m_Points.begin(),m_Points.end(),CueBefore);
+
+        // all points have the same children, one tree is reused for all
+        uint64 size = 0;
+        KaxCuePoint point;
+        for (size_t i=0;i<m_Points.size();i++)
+        {
+            SetPoint(point,m_Points[i]);
+            point.UpdateSize(bWithDefault,bForceRender);
+            size += point.ElementSize(bWithDefault);
+        }
+        SetSize_(size);
+        return size;
+    }
+protected:
+    filepos_t RenderData(IOCallback & output,bool bForceRender,bool bWithDefault)
+    {
+        filepos_t size = 0;
+        KaxCuePoint point;
+        for (size_t i=0;i<m_Points.size();i++)
+        {
+            SetPoint(point,m_Points[i]);
+            size += point.Render(output,bWithDefault,false,bForceRender);
+        }
+        return size;
+    }
+private:
+    // the same tree KaxCuePoint::PositionSet builds for a block, Point is
+    // either empty or was set before
+    static void SetPoint(KaxCuePoint& Point,const CuePoint& Cue)
+    {
+        GetChild<EbmlUInteger,KaxCueTime>(Point) = Cue.time;
+        KaxCueTrackPositions *positions = & GetChild<KaxCueTrackPositions>(Point);
+        GetChild<EbmlUInteger,KaxCueTrack>(positions) = Cue.track;
+        GetChild<EbmlUInteger,KaxCueClusterPosition>(positions) = Cue.cluster;
+    }
+};
+
+//
+// Resumable mux state. A checkpoint holds what can't be rebuilt from the
+// input: the random values and time used for the header, the state of the
+// cluster loop at a cluster boundary, and the cue points written so far.
+// A resumed mux builds the header again with the writer in replay mode,
+// checks that it ends where it did before, and continues at the saved size.
+//
+class CCheckpoint
+{
+private:
+    IMkvCheckpoint*         m_Target;
+    CEbmlWrite*             m_Writer;
+    CHeaderRandom           m_Random;
+    CCheckpointData         m_Data;
+    std::vector<MkvResumeStream> m_Streams;
+    uint64_t                m_Time;
+    uint64_t                m_HeaderSize;
+    uint64_t                m_FileSize;
+    uint64_t                m_LastSave;
+    bool                    m_Resume;
+public:
+    CCheckpoint(IMkvCheckpoint* Target,CEbmlWrite* Writer)
+        : m_Target(Target) , m_Writer(Writer) , m_Time(0) , m_HeaderSize(0) ,
+          m_FileSize(0) , m_LastSave(0) , m_Resume(false)
+    {
+    }
+    // reads the part MkvGetResumeInfo needs, the rest is read by Restore
+    static void ReadHead(CCheckpointData& Data,MkvResumeInfo* Info,MkvResumeStream* Streams,unsigned int StreamCount,uint64_t* HeaderSize)
+    {
+        if ( (Data.Get()!=CHECKPOINT_MAGIC) || (Data.Get()!=CHECKPOINT_VERSION) )
+        {
+            throw mkv_error_exception("Bad checkpoint data");
+        }
+        Info->file_size = Data.Get();
+        *HeaderSize = Data.Get();
+        Info->stream_count = (unsigned int)Data.Get();
+        for (unsigned int i=0;i<Info->stream_count;i++)
+        {
+            uint64_t frames = Data.Get();
+            int64_t timecode = Data.Get();
+            if ( (NULL!=Streams) && (i<StreamCount) )
+            {
+                Streams[i].frames = frames;
+                Streams[i].timecode = timecode;
+            }
+        }
+    }
+    void SetResumeData(const void* Data,size_t Size)
+    {
+        MkvResumeInfo info;
+        std::vector<uint8_t> random_log;
+
+        // the first pass checks the stream count is backed by data
+        m_Data.Assign(Data,Size);
+        ReadHead(m_Data,&info,NULL,0,&m_HeaderSize);
+        m_Streams.resize(info.stream_count);
+        m_Data.Assign(Data,Size);
+        ReadHead(m_Data,&info,m_Streams.empty()?NULL:&m_Streams[0],info.stream_count,&m_HeaderSize);
+        m_FileSize = info.file_size;
+        m_Time = m_Data.Get();
+        m_Data.GetBytes(random_log);
+        m_Random.Replay(random_log);
+        m_LastSave = m_FileSize;
+        m_Resume = true;
+    }
+    bool Resuming() const
+    {
+        return m_Resume;
+    }
+    CHeaderRandom* Random()
+    {
+        return &m_Random;
+    }
+    uint64_t Time()
+    {
+        if (!m_Resume) m_Time = libmkv_time();
+        return m_Time;
+    }
+    void Start()
+    {
+        if (m_Resume) m_Writer->StartReplay();
+    }
+    // called once the header is complete, restores the loop state when resuming
+    void HeaderDone(uint64_t Position,std::vector<MyMkvTrackInfo>& Tracks,CChapters& Chapters,CCues& Cues,
+        MkvClusterRecord* PrevCluster,bool* HavePrevCluster,int64_t* MaxDuration)
+    {
+        if (!m_Resume)
+        {
+            m_HeaderSize = Position;
+            m_LastSave = Position;
+            return;
+        }
+
+        if ( (Position!=m_HeaderSize) || (false==m_Random.ReplayDone()) || (m_Streams.size()!=Tracks.size()) )
+        {
+            throw mkv_error_exception("Checkpoint doesn't match the title");
+        }
+        CNZ(m_Writer->EndReplay(m_FileSize));
+
+        *MaxDuration = m_Data.Get();
+        PrevCluster->position = m_Data.Get();
+        PrevCluster->timecode = m_Data.Get();
+        *HavePrevCluster = (0!=m_Data.Get());
+        Chapters.Load(m_Data);
+        for (size_t i=0;i<Tracks.size();i++)
+        {
+            Tracks[i].frames_done = m_Streams[i].frames;
+            Tracks[i].last_timecode = m_Streams[i].timecode;
+            Tracks[i].Load(m_Data);
+        }
+
+        Cues.Load(m_Data);
+
+        m_Data.Clear();
+        m_Resume = false;
+    }
+    // called at a cluster boundary, File is positioned at the end of data
+    void Save(uint64_t Position,std::vector<MyMkvTrackInfo>& Tracks,CChapters& Chapters,CCues& Cues,
+        const MkvClusterRecord* PrevCluster,bool HavePrevCluster,int64_t MaxDuration)
+    {
+        if (NULL==m_Target) return;
+        if ((Position-m_LastSave)<CHECKPOINT_INTERVAL) return;
+
+        CNZ(m_Writer->Flush());
+
+        m_Data.Clear();
+        m_Data.Put(CHECKPOINT_MAGIC);
+        m_Data.Put(CHECKPOINT_VERSION);
+        m_Data.Put(Position);
+        m_Data.Put(m_HeaderSize);
+        m_Data.Put(Tracks.size());
+        for (size_t i=0;i<Tracks.size();i++)
+        {
+            m_Data.Put(Tracks[i].frames_done);
+            m_Data.Put(Tracks[i].last_timecode);
+        }
+        m_Data.Put(m_Time);
+        m_Data.PutBytes(m_Random.Log());
+
+        m_Data.Put(MaxDuration);
+        m_Data.Put(PrevCluster->position);
+        m_Data.Put(PrevCluster->timecode);
+        m_Data.Put(HavePrevCluster?1:0);
+        Chapters.Save(m_Data);
+        for (size_t i=0;i<Tracks.size();i++)
+        {
+            Tracks[i].Save(m_Data);
+        }
+        Cues.Save(m_Data);
+
+        if (false==m_Target->SaveCheckpoint(m_Data.Data(),(unsigned int)m_Data.Size()))
+        {
+            lgpl_trace("libmkv: checkpoint not saved");
+        }
+        m_Data.Clear();
+        m_LastSave = Position;
+    }
+};
+
+static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,const char *WritingApp,CMuxStats* Stats,CCheckpoint* Checkpoint)
 {
+    Checkpoint->Start();
+
     EbmlHead FileHead;
 
     EDocType & MyDocType = GetChild<EDocType>(FileHead);
@@ -520,10 +1642,14 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
     // objects
     KaxSegment FileSegment;
 
-    KaxCues AllCues;
+    CCues AllCues;
     AllCues.SetGlobalTimecodeScale(TIMECODE_SCALE);
 
-    CChapters Chapters(TitleInfo,FormatInfo);
+    CChapters Chapters(TitleInfo,FormatInfo,Checkpoint->Random());
+
+    // nothing is overwritten in streaming mode, elements that need final
+    // values are written at the end or left out
+    bool streaming = FormatInfo->profile.streamingOutput;
 
     // start render
     FileSegment.WriteHead(File, 8);
@@ -537,7 +1663,10 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
     KaxSeek* seek_att = AddSeekEntry<KaxAttachments>(MetaSeek);
     KaxSeek* seek_tags = AddSeekEntry<KaxTags>(MetaSeek);
 
-    CNZ(MetaSeek.Render(File));
+    if (!streaming)
+    {
+        CNZ(MetaSeek.Render(File));
+    }
 
     MkvTitleInfo    titleInfo;
 
@@ -548,7 +1677,10 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
     KaxInfo & MyInfos = GetChild<KaxInfo>(FileSegment);
 
     GetChild<EbmlUInteger,KaxTimecodeScale>(MyInfos) = TIMECODE_SCALE;
-    GetChild<EbmlFloat,KaxDuration>(MyInfos) = (double)0;
+    if (!streaming)
+    {
+        GetChild<EbmlFloat,KaxDuration>(MyInfos) = (double)0;
+    }
 
     GetChild<EbmlUnicodeString,KaxMuxingApp>(MyInfos) = GetLibraryVersionString();
     GetChild<EbmlUnicodeString,KaxWritingApp>(MyInfos) = UTF8string(WritingApp);
@@ -561,9 +1693,9 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
     uint8_t SegmentUid[16];
     for (unsigned int i=0;i<16;i++)
     {
-        SegmentUid[i] = lgpl_get_random_byte();
+        SegmentUid[i] = Checkpoint->Random()->Byte();
     }
-    uint64_t mtime = libmkv_time();
+    uint64_t mtime = Checkpoint->Time();
     GetChild<EbmlDate,KaxDateUTC>(MyInfos).SetEpochDate(mtime);
     GetChild<EbmlBinary,KaxSegmentUID>(MyInfos).CopyBuffer(SegmentUid, 16);
 
@@ -587,11 +1719,18 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
 
         ti = & track_info[i].info;
         track_info[i].duration_pos=0;
+        track_info[i].duration_time=0;
+        track_info[i].duration_size=0;
         track_info[i].refs[0]=BAD_TIMECODE;
         track_info[i].refs[1]=BAD_TIMECODE;
         track_info[i].stat_frames=0;
         track_info[i].stat_bytes=0;
         track_info[i].stat_bytes_out=0;
+        track_info[i].stat_time_start=0;
+        track_info[i].stat_time_end=0;
+        track_info[i].frames_done=0;
+        track_info[i].last_timecode=-1;
+        track_info[i].own_source=libmkv_is_own_source(Input->MkvGetStream(i));
 
         memset(ti,0,sizeof(*ti));
         if (false==Input->MkvGetStream(i)->UpdateTrackInfo(ti))
@@ -745,6 +1884,24 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
             track_info[i].compression_type=MKV_TRACK_COMPRESSION_NONE;
         }
 
+        if ( (!ti->header_comp_size) &&
+            ( (track_info[i].compression_type==MKV_TRACK_COMPRESSION_HEADERS) ||
+              ( FormatInfo->profile.autoHeaderStripping && (track_info[i].compression_type==MKV_TRACK_COMPRESSION_NONE) ) ) )
+        {
+            std::vector<uint8_t>& prefix = track_info[i].header_strip;
+            if (false==Checkpoint->Resuming())
+            {
+                DetectHeaderStripping(Input->MkvGetStream(i),ti->type,prefix,Stats->Track(i));
+            }
+            Checkpoint->Random()->Value(prefix);
+            if (!prefix.empty())
+            {
+                track_info[i].compression_type=MKV_TRACK_COMPRESSION_HEADERS;
+                ti->header_comp_data = &prefix[0];
+                ti->header_comp_size = (unsigned int)prefix.size();
+            }
+        }
+
         if ( (!ti->header_comp_size) && (track_info[i].compression_type==MKV_TRACK_COMPRESSION_HEADERS) )
         {
             track_info[i].compression_type=MKV_TRACK_COMPRESSION_NONE;
@@ -771,6 +1928,17 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
     Chapters.Render(File,seek_chap,FileSegment);
     RenderVoid(File,FormatInfo->debug.evoid[1]);
 
+    // space for the cues, so that readers find them without seeking to the end
+    EbmlVoid CuesSpace;
+    if ( FormatInfo->profile.cuesAtFront && (!streaming) && (titleInfo.duration!=0) )
+    {
+        uint64_t seconds = TimecodeFromClock(titleInfo.duration) / 1000000000;
+        uint64_t size = (seconds+1) * CUES_RESERVE_PER_SECOND * CUES_RESERVE_POINT_SIZE;
+        if (size<CUES_RESERVE_MIN) size = CUES_RESERVE_MIN;
+        CuesSpace.SetSize(size);
+        CNZ(CuesSpace.Render(File));
+    }
+
     MkvAttachmentInfo   ainfo;
     if (TitleInfo->GetAttachmentCount())
     {
@@ -789,95 +1957,47 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
         }
         CNZ(MyAttachments.Render(File));
         UpdateSeekEntry(seek_att,File,MyAttachments,FileSegment);
-        MyAttachments.RemoveAll();
+        DeleteChildren(MyAttachments);
     } else {
-        VoidElement(seek_att,File);
+        if (streaming)
+        {
+            RemoveElement(MetaSeek,seek_att);
+        } else {
+            VoidElement(seek_att,File);
+        }
     }
 
     // finish all meta info
     UpdateSeekEntry(seek_infos,File,MyInfos,FileSegment);
     UpdateSeekEntry(seek_tracks,File,MyTracks,FileSegment);
-    MyTracks.RemoveAll();
 
-    KaxCluster *curr_cluster=NULL,*prev_cluster=NULL;
+    KaxCluster *curr_cluster=NULL;
+    MkvClusterRecord prev_cluster;
+    bool have_prev_cluster=false;
     int64_t cluster_timecode=0;
     int64_t max_duration=0;
     uint64_t prg_val=0;
     int64_t frame_end;
 
+    Checkpoint->HeaderDone(File.getFilePointer(),track_info,Chapters,AllCues,&prev_cluster,&have_prev_cluster,&max_duration);
+
+    CCompressPool Pool(FormatInfo->compressionThreads,
+        (FormatInfo->compressionQueueDepth!=0) ? FormatInfo->compressionQueueDepth : COMPRESS_POOL_DEPTH);
+    CBlockPool Blocks;
+
+    CFrameScheduler Scheduler;
+    Scheduler.Init(Input,&track_info,&Pool,Stats);
+
     while(true)
     {
-        int64_t min_timecode1,min_timecode2;
-        unsigned int stream_id1,stream_id2,stream_id;
+        unsigned int stream_id;
         IMkvFrameSource *stream;
         int clusterFlags;
         bool new_cluster;
 
-        min_timecode1=min_timecode2=BAD_TIMECODE;
-        clusterFlags = 0;
-
-        stream_id = stream_id1 = stream_id2 = 0;
-        for (unsigned int i=0;i<tracks.size();i++)
-        {
-            bool force_fetch,type2;
-            unsigned int frames_scan;
-
-            force_fetch = ( (track_info[i].info.type==mttVideo) || (track_info[i].info.type==mttAudio) );
-            type2 = true;
-
-            if (false==Input->MkvGetStream(i)->FetchFrames(1,force_fetch))
-            {
-                throw mkv_error_exception("Error while reading input");
-            }
-
-            frames_scan = (track_info[i].info.type==mttVideo)?16:1;
-            if (Input->MkvGetStream(i)->GetAvailableFramesCount()<frames_scan)
-            {
-                frames_scan = Input->MkvGetStream(i)->GetAvailableFramesCount();
-            }
-
-            if ( (track_info[i].info.type!=mttSubtitle) && frames_scan)
-            {
-                if (Input->MkvGetStream(i)->PeekFrame(0)->cluster_start())
-                {
-                    type2 = false;
-                    clusterFlags |= 1;
-                } else {
-                    clusterFlags |= 2;
-                }
-            }
-
-            for (unsigned int j=0;j<frames_scan;j++)
-            {
-                int64_t dts;
-
-                IMkvChunk* tf = Input->MkvGetStream(i)->PeekFrame(j);
-
-                if (tf->timecode==-1) throw mkv_error_exception("Frame not timestamped");
-                dts = ScaleTimecode(TimecodeFromClock(tf->timecode)+(TIMECODE_SCALE/2));
+        Scheduler.Refresh();
+        clusterFlags = Scheduler.ClusterFlags();
 
-                if (dts<min_timecode1)
-                {
-                    min_timecode1 = dts;
-                    stream_id1 = i;
-                }
-                if ( (dts<min_timecode2) && type2 )
-                {
-                    min_timecode2 = dts;
-                    stream_id2 = i;
-                }
-            }
-            if (track_info[i].compression_type==MKV_TRACK_COMPRESSION_ZLIB)
-            {
-                frames_scan = Input->MkvGetStream(i)->GetAvailableFramesCount();
-                for (unsigned int k=0;k<frames_scan;k++)
-                {
-                    CNZ(Input->MkvGetStream(i)->PeekFrame(k)->compress_start(
-                        track_info[i].compression_type,
-                        track_info[i].compression_level));
-                }
-            }
-        }
         switch(clusterFlags)
         {
         case 0:
@@ -889,16 +2009,16 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
             {
                 stream_id = 0;
             } else {
-                stream_id = stream_id1;
+                stream_id = Scheduler.MinStream(0);
             }
             new_cluster = true;
             break;
         case 2:
-            stream_id = stream_id1;
+            stream_id = Scheduler.MinStream(0);
             new_cluster = false;
             break;
         case 3:
-            stream_id = stream_id2;
+            stream_id = Scheduler.MinStream(1);
             new_cluster = false;
             break;
         default:
@@ -937,20 +2057,29 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
             // no more frames
             break;
         }
-        frame = stream->PeekFrame(0);
+        MkvTrackStats* track_stats = Stats->Track(stream_id);
 
-        if (frame->chapter_mark())
+        frame = stream->PeekFrame(0);
         {
-            Chapters.AddChapterMark(frame->timecode,File);
+            CStageTimer timer(&track_stats->compress);
+            CNZ(Pool.Wait(frame));
         }
 
         if (new_cluster)
         {
+            // cluster start flags were cleared and more frames will be read
+            Scheduler.InvalidateAll();
+
+            CRenderTimer timer(Stats);
+
             if (NULL!=curr_cluster)
             {
-                FinishCluster(curr_cluster,&File,&FileSegment);
+                FinishCluster(curr_cluster,&File,&FileSegment,&prev_cluster,streaming);
+                have_prev_cluster=true;
+
+                // nothing of the new cluster is written yet
+                Checkpoint->Save(File.getFilePointer(),track_info,Chapters,AllCues,&prev_cluster,have_prev_cluster,max_duration);
             }
-            prev_cluster = curr_cluster;
             curr_cluster = & AddNewChild<KaxCluster>(FileSegment);
             curr_cluster->SetSizeInfinite();
             curr_cluster->SetParent(FileSegment);
@@ -962,24 +2091,33 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
                 CNZ(curr_cluster->WriteHead(File, 4));
             }
 
-            cluster_timecode = GetClusterTimecode(Input);
+            cluster_timecode = GetClusterTimecode(Input,Stats);
 
+            Stats->Get()->clusters++;
             curr_cluster->InitTimecode(ScaleTimecode(TimecodeFromClock(cluster_timecode)),TIMECODE_SCALE);
 
             GetChild<EbmlUInteger,KaxClusterTimecode>(curr_cluster) = ScaleTimecode(TimecodeFromClock(cluster_timecode));
             GetChild<KaxClusterTimecode>(*curr_cluster).Render(File);
 
-            if (NULL!=prev_cluster)
+            if (have_prev_cluster)
             {
-                GetChild<EbmlUInteger,KaxClusterPrevSize>(curr_cluster) = curr_cluster->GetElementPosition() - prev_cluster->GetElementPosition();
+                GetChild<EbmlUInteger,KaxClusterPrevSize>(curr_cluster) = curr_cluster->GetElementPosition() - prev_cluster.position;
                 GetChild<KaxClusterPrevSize>(*curr_cluster).Render(File);
             }
         }
 
+        if (frame->chapter_mark())
+        {
+            Chapters.AddChapterMark(frame->timecode,File);
+        }
+
         if (frame->get_size()==0)
         {
+            CStageTimer timer(&track_stats->compress);
             CNZ(frame->compress_wait());
+            track_info[stream_id].FrameDone(frame);
             stream->PopFrame();
+            Scheduler.Invalidate(stream_id);
             continue;
         }
 
@@ -1016,9 +2154,12 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
             fetch_frames = 1;
         }
 
-        if (false==stream->FetchFrames(fetch_frames,true))
         {
-            throw mkv_error_exception("Error while reading input");
+            CStageTimer timer(&track_stats->fetch);
+            if (false==stream->FetchFrames(fetch_frames,true))
+            {
+                throw mkv_error_exception("Error while reading input");
+            }
         }
 
         frames_count = stream->GetAvailableFramesCount();
@@ -1029,8 +2170,15 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
 
         if (frames_count>1)
         {
+            CStageTimer timer(&track_stats->compress);
             CNZ(frame->compress_start(track_info[stream_id].compression_type,track_info[stream_id].compression_level));
             CNZ(frame->compress_wait());
+
+            // let the pool compress the rest of the lace while we check it
+            for (unsigned int i=1;i<frames_count;i++)
+            {
+                CNZ(Pool.Start(stream->PeekFrame(i),track_info[stream_id].compression_type,track_info[stream_id].compression_level));
+            }
         }
 
         frame_keyframe = frame->keyframe();
@@ -1056,8 +2204,12 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
                 break;
             }
 
-            CNZ(frame->compress_start(track_info[stream_id].compression_type,track_info[stream_id].compression_level));
-            CNZ(frame->compress_wait());
+            {
+                CStageTimer timer(&track_stats->compress);
+                CNZ(Pool.Wait(frame));
+                CNZ(frame->compress_start(track_info[stream_id].compression_type,track_info[stream_id].compression_level));
+                CNZ(frame->compress_wait());
+            }
 
             if (frame->get_size()!=same_frame_size)
             {
@@ -1076,22 +2228,24 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
         blks=NULL;
         if (frame->old_block())
         {
-            blkg = new KaxBlockGroup();
+            blkg = Blocks.GetBlockGroup();
             blki = &(KaxInternalBlock&)(*blkg);
             blkg->SetParent(*curr_cluster);
 
             frames_count=1;
 
-            DataBuffer* mkv_buffer = GetDataBuffer(frame,&track_info[stream_id]);
+            DataBuffer* mkv_buffer = GetDataBuffer(frame,&track_info[stream_id],Blocks.Buffers(),track_stats);
             CNZ(blkg->AddFrame( * (tracks[stream_id]) , TimecodeFromClock(frame->timecode)+(TIMECODE_SCALE/2) , *mkv_buffer));
             track_info[stream_id].UpdateStat(frame);
 
             if (frame->auto_duration())
             {
+                Blocks.AddDuration(blkg);
                 blkg->SetBlockDuration( AUTO_DURATION_TIMECODE );
             } else {
                 if ( (frame->duration != track_info[stream_id].info.default_duration) || (track_info[stream_id].info.type==mttVideo) )
                 {
+                    Blocks.AddDuration(blkg);
                     blkg->SetBlockDuration( TimecodeFromClock(frame->duration)+(TIMECODE_SCALE/2) );
                 }
             }
@@ -1127,7 +2281,7 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
                 {
                     if (refs[nr]!=BAD_TIMECODE)
                     {
-                        KaxReferenceBlock & theRef = AddNewChild<KaxReferenceBlock>(*blkg);
+                        KaxReferenceBlock & theRef = Blocks.AddReference(blkg);
                         int64_t refTimecode = ScaleTimecode(TimecodeFromClock(refs[nr])+(TIMECODE_SCALE/2));
                         refTimecode -= ScaleTimecode(TimecodeFromClock(frame->timecode)+(TIMECODE_SCALE/2));
                         theRef.SetReferencedTimecode(refTimecode);
@@ -1136,9 +2290,12 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
                 }
             }
 
-            CNZ(blkg->Render(File));
+            {
+                CRenderTimer timer(Stats);
+                CNZ(blkg->Render(File));
+            }
 
-            if (track_info[stream_id].duration_pos)
+            if ( track_info[stream_id].duration_pos && (!streaming) )
             {
                 uint64_t duration = TimecodeFromClock(frame->timecode) - track_info[stream_id].duration_time;
                 if (duration < AUTO_DURATION_TIMECODE)
@@ -1157,7 +2314,7 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
             }
 
         } else {
-            blks = new KaxSimpleBlock();
+            blks = Blocks.GetSimpleBlock();
             blki = &(KaxInternalBlock&)(*blks);
             blks->SetParent(*curr_cluster);
             blks->SetKeyframe(frame->keyframe());
@@ -1167,50 +2324,79 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
             {
                 frame=stream->PeekFrame(i);
 
-                DataBuffer* mkv_buffer = GetDataBuffer(frame,&track_info[stream_id]);
+                DataBuffer* mkv_buffer = GetDataBuffer(frame,&track_info[stream_id],Blocks.Buffers(),track_stats);
                 CNZ(blks->AddFrame( * (tracks[stream_id]) , TimecodeFromClock(frame->timecode)+(TIMECODE_SCALE/2) , *mkv_buffer , all_same ? LACING_FIXED : LACING_EBML ));
 
                 track_info[stream_id].UpdateStat(frame);
             }
-            CNZ(blks->Render(File));
+            {
+                CRenderTimer timer(Stats);
+                CNZ(blks->Render(File));
+            }
         }
 
         if (new_cluster)
         {
-            KaxCuePoint *cp = & AddNewChild<KaxCuePoint>(AllCues);
-            cp->PositionSet(*blki,blkg,TIMECODE_SCALE);
+            AllCues.Add(blki);
         }
 
-        delete blks;
-        delete blkg;
+        if (NULL!=blks) Blocks.Release(blks);
+        if (NULL!=blkg) Blocks.Release(blkg);
+        track_stats->blocks++;
 
         for (unsigned int i=0;i<frames_count;i++)
         {
+            track_stats->frames++;
+            track_stats->bytes += stream->PeekFrame(0)->get_size();
+            track_info[stream_id].FrameDone(stream->PeekFrame(0));
             stream->PopFrame();
         }
+        Scheduler.Invalidate(stream_id);
+    }
+    {
+        CRenderTimer timer(Stats);
+        FinishCluster(curr_cluster,&File,&FileSegment,&prev_cluster,streaming);
     }
-    FinishCluster(curr_cluster,&File,&FileSegment);
 
     // update total duration
-    GetChild<EbmlFloat,KaxDuration>(MyInfos) = (double) ScaleTimecode(TimecodeFromClock(max_duration));
-    GetChild<KaxDuration>(MyInfos).OverwriteData(File,true);
+    if (!streaming)
+    {
+        GetChild<EbmlFloat,KaxDuration>(MyInfos) = (double) ScaleTimecode(TimecodeFromClock(max_duration));
+        GetChild<KaxDuration>(MyInfos).OverwriteData(File,true);
+    }
 
-    CNZ(AllCues.Render(File));
+    bool cues_done = false;
+    if (CuesSpace.GetElementPosition()!=0)
+    {
+        if (CuesSpace.ReplaceWith(AllCues,File)!=INVALID_FILEPOS_T)
+        {
+            cues_done = true;
+        } else {
+            lgpl_trace("libmkv: cues don't fit in the reserved space, written at the end");
+        }
+    }
+    if (!cues_done)
+    {
+        CNZ(AllCues.Render(File));
+    }
     UpdateSeekEntry(seek_cues,File,AllCues,FileSegment);
 
-    Chapters.Finalize(File,seek_chap,max_duration);
+    if ( (false==Chapters.Finalize(File,seek_chap,max_duration,FileSegment)) && streaming )
+    {
+        RemoveElement(MetaSeek,seek_chap);
+    }
 
     for (unsigned int i=1;i<Input->MkvGetStreamCount();i++)
     {
 
         if (track_info[i].stat_frames==0)
         {
-            VoidElement(tracks[i],File);
+            if (!streaming) VoidElement(tracks[i],File);
             my_world()->uc_emptytrack(Input,i,&track_info[i].info);
             continue;
         }
 
-        if (track_info[i].codec_private)
+        if ( track_info[i].codec_private && (!streaming) )
         {
             MkvTrackInfo ti;
 
@@ -1248,32 +2434,124 @@ static void MkvCreateFileInternal(IOCallback &File,IMkvTrack *Input,IMkvTitleInf
     UpdateSeekEntry(seek_tags,File,MyTags,FileSegment);
 
     // end
+    if (streaming)
+    {
+        // all positions are known now, the seek head goes last
+        CNZ(MetaSeek.Render(File));
+    } else {
+        // Set the correct size for the segment.
+        CNZ(FileSegment.ForceSize(File.getFilePointer() - ( FileSegment.GetElementPosition() + FileSegment.HeadSize() ) ));
+        CNZ(FileSegment.OverwriteHead(File));
+    }
 
-    // Set the correct size for the segment.
-    CNZ(FileSegment.ForceSize(File.getFilePointer() - ( FileSegment.GetElementPosition() + FileSegment.HeadSize() ) ));
-    CNZ(FileSegment.OverwriteHead(File));
+    Stats->Get()->block_heap_allocs = Blocks.HeapAllocs();
 }
 
-static void FinishCluster(KaxCluster *cluster,IOCallback *File,KaxSegment *Segment)
+static void FinishCluster(KaxCluster *cluster,IOCallback *File,KaxSegment *Segment,MkvClusterRecord *Record,bool Streaming)
 {
     // add position info
     GetChild<EbmlUInteger,KaxClusterPosition>(cluster) =
         cluster->GetElementPosition() - ( Segment->GetElementPosition() + Segment->HeadSize() );
     GetChild<KaxClusterPosition>(*cluster).Render(*File);
 
-    // correct size
-    CNZ(cluster->ForceSize(File->getFilePointer() - ( cluster->GetElementPosition() + cluster->HeadSize() ) ));
-    CNZ(cluster->OverwriteHead(*File));
+    // correct size, streaming output keeps the unknown size
+    if (!Streaming)
+    {
+        CNZ(cluster->ForceSize(File->getFilePointer() - ( cluster->GetElementPosition() + cluster->HeadSize() ) ));
+        CNZ(cluster->OverwriteHead(*File));
+    }
+
+    // cluster is complete on disk, keep only what is needed to link the next one
+    Record->position = cluster->GetElementPosition();
+    Record->timecode = cluster->GlobalTimecode();
+
+    std::vector<EbmlElement*> &list = Segment->GetElementList();
+    for (size_t i=list.size();i>0;i--)
+    {
+        if (list[i-1]==cluster)
+        {
+            Segment->Remove(i-1);
+            break;
+        }
+    }
+    delete cluster;
 }
 
 extern "C"
-bool __cdecl MkvCreateFile(IMkvWriteTarget* Output,IMkvTrack *Input,const char *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo) throw()
+bool __cdecl MkvGetResumeInfo(const void* ResumeData,unsigned int ResumeSize,MkvResumeInfo* Info,MkvResumeStream* Streams,unsigned int StreamCount) throw()
 {
-    CEbmlWrite  wrt(Output);
     try
     {
-        MkvCreateFileInternal(wrt,Input,TitleInfo,FormatInfo,WritingApp);
+        CCheckpointData data;
+        uint64_t header_size;
+        data.Assign(ResumeData,ResumeSize);
+        CCheckpoint::ReadHead(data,Info,Streams,StreamCount,&header_size);
         return true;
+    } catch(...)
+    {
+        return false;
+    }
+}
+
+extern "C"
+bool __cdecl MkvCreateFile(IMkvWriteTarget* Output,IMkvTrack *Input,const char *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo) throw()
+{
+    return MkvCreateFileEx(Output,Input,WritingApp,TitleInfo,FormatInfo,NULL,NULL);
+}
+
+extern "C"
+bool __cdecl MkvCreateFileEx(IMkvWriteTarget* Output,IMkvTrack *Input,const char *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,IWorld* World,MkvMuxStats* Stats) throw()
+{
+    return MkvCreateFileResumable(Output,Input,WritingApp,TitleInfo,FormatInfo,World,Stats,NULL,NULL,0);
+}
+
+// Copies the format of the caller, with the fields its profile version
+// doesn't know about cleared. Older callers have a shorter MkvFormatInfo.
+static void GetFormatInfo(const MkvFormatInfo* FormatInfo,MkvFormatInfo* Format)
+{
+    memset(Format,0,sizeof(MkvFormatInfo));
+    memcpy(Format,FormatInfo,offsetof(MkvFormatInfo,compressionThreads));
+    if (Format->profile.version>=MKV_PROFILE_VERSION_COMPRESSION_POOL)
+    {
+        Format->compressionThreads = FormatInfo->compressionThreads;
+        Format->compressionQueueDepth = FormatInfo->compressionQueueDepth;
+    }
+    if (Format->profile.version<MKV_PROFILE_VERSION_STREAMING) Format->profile.streamingOutput=false;
+    if (Format->profile.version<MKV_PROFILE_VERSION_CUES_AT_FRONT) Format->profile.cuesAtFront=false;
+    if (Format->profile.version<MKV_PROFILE_VERSION_HEADER_STRIPPING) Format->profile.autoHeaderStripping=false;
+}
+
+extern "C"
+bool __cdecl MkvCreateFileResumable(IMkvWriteTarget* Output,IMkvTrack *Input,const char *WritingApp,IMkvTitleInfo* TitleInfo,MkvFormatInfo* FormatInfo,IWorld* World,MkvMuxStats* Stats,IMkvCheckpoint* Checkpoint,const void* ResumeData,unsigned int ResumeSize) throw()
+{
+    CThreadWorld world(World);
+    CMuxStats   stats;
+    CEbmlWrite  wrt(Output,stats.Get());
+    bool        rtn = false;
+    uint64_t    start = libmkv_clock_ns();
+    MkvFormatInfo format;
+    try
+    {
+        GetFormatInfo(FormatInfo,&format);
+        wrt.SetStreaming(format.profile.streamingOutput);
+
+        // streaming output can't be truncated and resumed
+        CCheckpoint checkpoint(format.profile.streamingOutput ? NULL : Checkpoint,&wrt);
+        if (NULL!=ResumeData)
+        {
+            if (format.profile.streamingOutput) throw mkv_error_exception("Can't resume streaming output");
+            checkpoint.SetResumeData(ResumeData,ResumeSize);
+        }
+
+        // every element of the mux is created and deleted in this arena
+        EbmlArena arena;
+        {
+            EbmlArena::Scope arena_scope(arena);
+            MkvCreateFileInternal(wrt,Input,TitleInfo,&format,WritingApp,&stats,&checkpoint);
+        }
+        MKV_ASSERT(arena.GetElementCount()==0);
+        CNZ(wrt.Flush());
+        rtn = true;
     } catch(std::exception &Ex)
     {
         // no memory allocations here
@@ -1289,6 +2567,14 @@ bool __cdecl MkvCreateFile(IMkvWriteTarget* Output,IMkvTrack *Input,const char *
     {
         lgpl_trace("Exception: unknown");
     }
-    return false;
+
+    stats.Get()->total.time_ns = libmkv_clock_ns() - start;
+    stats.Get()->total.calls = 1;
+    stats.Finish(Input->MkvGetStreamCount());
+    if (NULL!=Stats)
+    {
+        memcpy(Stats,stats.Get(),sizeof(MkvMuxStats));
+    }
+    return rtn;
 }
 
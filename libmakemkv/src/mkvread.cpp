@@ -0,0 +1,1289 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include <libmkv/libmkv.h>
+#include <libmkv/internal.h>
+#include <lgpl/cassert>
+#include <exception>
+#include <lgpl/world.h>
+#include <vector>
+#include <deque>
+#include <string>
+
+//
+// Matroska reader for remuxing. libebml is built without its read side
+// (EBML_NO_READ), so elements are parsed here directly from a buffered
+// sequential stream, using libmatroska only for the element ids.
+//
+
+#define READ_BUFFER_SIZE            (256*1024)
+#define UNKNOWN_SIZE                (~(uint64_t)0)
+
+// largest header element (tracks, chapters, an attachment) read into memory
+#define MAX_HEADER_ELEMENT_SIZE     (256*1024*1024)
+
+#define CNZ(x) if (!(x)) { throw mkv_error_exception( "Error in " #x ); };
+
+#define ID(x) EBML_ID_VALUE(EBML_ID(x))
+
+// chunk timecodes run at 27MHz*40, Matroska time is in nanoseconds
+static inline int64_t ClockFromNs(int64_t Ns)
+{
+    return (Ns*27)/25;
+}
+
+class CReadBuffer
+{
+private:
+    IMkvReadSource*         m_Source;
+    std::vector<uint8_t>    m_Buffer;
+    size_t                  m_Pos;
+    size_t                  m_Size;
+    uint64_t                m_Offset;
+    bool                    m_Eof;
+public:
+    CReadBuffer(IMkvReadSource* Source)
+        : m_Source(Source) , m_Buffer(READ_BUFFER_SIZE) , m_Pos(0) , m_Size(0) , m_Offset(0) , m_Eof(false)
+    {
+    }
+    uint64_t Position() const
+    {
+        return m_Offset + m_Pos;
+    }
+    bool AtEnd()
+    {
+        if (m_Pos==m_Size) Fill();
+        return (m_Pos==m_Size);
+    }
+    uint8_t Byte()
+    {
+        if (AtEnd()) throw mkv_error_exception("Unexpected end of file");
+        return m_Buffer[m_Pos++];
+    }
+    void Read(void* Data,size_t Size)
+    {
+        uint8_t* p = (uint8_t*)Data;
+        while (Size!=0)
+        {
+            if (AtEnd()) throw mkv_error_exception("Unexpected end of file");
+            size_t len = m_Size - m_Pos;
+            if (len>Size) len=Size;
+            memcpy(p,&m_Buffer[m_Pos],len);
+            m_Pos += len;
+            p += len;
+            Size -= len;
+        }
+    }
+    void Skip(uint64_t Size)
+    {
+        if (Size<=(m_Size-m_Pos))
+        {
+            m_Pos += (size_t)Size;
+            return;
+        }
+        // large elements (cues, tags) are seeked over if the source can
+        if ( (Size>m_Buffer.size()) && Seek(Position()+Size) ) return;
+        while (Size!=0)
+        {
+            if (AtEnd()) throw mkv_error_exception("Unexpected end of file");
+            size_t len = m_Size - m_Pos;
+            if (len>Size) len=(size_t)Size;
+            m_Pos += len;
+            Size -= len;
+        }
+    }
+    // makes up to Size bytes at the position readable in one piece, fewer at
+    // the end of the file or when they don't fit in the buffer
+    const uint8_t* Peek(size_t Size,size_t* Available)
+    {
+        if ( ((m_Size-m_Pos)<Size) && (!m_Eof) )
+        {
+            // move what is left to the start and read after it
+            size_t left = m_Size - m_Pos;
+            if (left!=0) memmove(&m_Buffer[0],&m_Buffer[m_Pos],left);
+            m_Offset += m_Pos;
+            m_Pos = 0;
+            m_Size = left;
+
+            unsigned int size;
+            CNZ(m_Source->Read(&m_Buffer[left],(unsigned int)(m_Buffer.size()-left),&size));
+            m_Size += size;
+            if (size<(m_Buffer.size()-left)) m_Eof=true;
+        }
+        *Available = m_Size - m_Pos;
+        if (*Available>Size) *Available = Size;
+        return &m_Buffer[m_Pos];
+    }
+    bool Seek(uint64_t Offset)
+    {
+        if ( (Offset>=m_Offset) && (Offset<=(m_Offset+m_Size)) )
+        {
+            m_Pos = (size_t)(Offset - m_Offset);
+            return true;
+        }
+        if (false==m_Source->Seek(Offset)) return false;
+        m_Offset = Offset;
+        m_Pos = 0;
+        m_Size = 0;
+        m_Eof = false;
+        return true;
+    }
+private:
+    void Fill()
+    {
+        if (m_Eof) return;
+
+        unsigned int size;
+        m_Offset += m_Size;
+        m_Pos = 0;
+        m_Size = 0;
+        CNZ(m_Source->Read(&m_Buffer[0],(unsigned int)m_Buffer.size(),&size));
+        m_Size = size;
+        if (size<m_Buffer.size()) m_Eof=true;
+    }
+};
+
+class CEbmlParser
+{
+public:
+    CReadBuffer     m_Input;
+public:
+    CEbmlParser(IMkvReadSource* Source)
+        : m_Input(Source)
+    {
+    }
+    // returns false at the end of the file
+    bool ReadElement(uint32_t* Id,uint64_t* Size)
+    {
+        if (m_Input.AtEnd()) return false;
+
+        uint8_t b = m_Input.Byte();
+        unsigned int len = VintLength(b);
+        if (len>4) throw mkv_error_exception("Bad element id");
+        uint32_t id = b;
+        for (unsigned int i=1;i<len;i++)
+        {
+            id = (id<<8) | m_Input.Byte();
+        }
+        *Id = id;
+
+        bool unknown;
+        *Size = ReadVint(&unknown);
+        if (unknown) *Size = UNKNOWN_SIZE;
+        return true;
+    }
+    // a child of a master element ending at End, with a known size
+    void ReadChild(uint64_t End,uint32_t* Id,uint64_t* Size)
+    {
+        if (false==ReadElement(Id,Size)) throw mkv_error_exception("Unexpected end of file");
+        if ( (*Size==UNKNOWN_SIZE) || ((m_Input.Position()+*Size)>End) )
+        {
+            throw mkv_error_exception("Bad element size");
+        }
+    }
+    uint64_t ReadVint(bool* Unknown=NULL)
+    {
+        uint8_t b = m_Input.Byte();
+        unsigned int len = VintLength(b);
+        if (len>8) throw mkv_error_exception("Bad element size");
+
+        uint8_t mask = (uint8_t)(0xff>>len);
+        uint64_t value = b & mask;
+        bool all_ones = ((b&mask)==mask);
+        for (unsigned int i=1;i<len;i++)
+        {
+            b = m_Input.Byte();
+            value = (value<<8) | b;
+            all_ones = all_ones && (b==0xff);
+        }
+        if (Unknown) *Unknown = all_ones;
+        return value;
+    }
+    uint64_t ReadUInt(uint64_t Size)
+    {
+        if (Size>8) throw mkv_error_exception("Bad integer element");
+        uint64_t value = 0;
+        for (unsigned int i=0;i<Size;i++)
+        {
+            value = (value<<8) | m_Input.Byte();
+        }
+        return value;
+    }
+    double ReadFloat(uint64_t Size)
+    {
+        uint64_t value = ReadUInt(Size);
+        if (Size==4)
+        {
+            uint32_t v32 = (uint32_t)value;
+            float f;
+            memcpy(&f,&v32,sizeof(f));
+            return f;
+        }
+        if (Size==8)
+        {
+            double d;
+            memcpy(&d,&value,sizeof(d));
+            return d;
+        }
+        if (Size==0) return 0;
+        throw mkv_error_exception("Bad float element");
+    }
+    void ReadBinary(uint64_t Size,std::vector<uint8_t>& Data)
+    {
+        if (Size>MAX_HEADER_ELEMENT_SIZE) throw mkv_error_exception("Element too large");
+        Data.resize((size_t)Size);
+        if (Size) m_Input.Read(&Data[0],(size_t)Size);
+    }
+    void ReadString(uint64_t Size,std::string& Str)
+    {
+        std::vector<uint8_t> data;
+        ReadBinary(Size,data);
+        while ( (!data.empty()) && (data.back()==0) ) data.pop_back();
+        Str.assign(data.begin(),data.end());
+    }
+private:
+    static unsigned int VintLength(uint8_t First)
+    {
+        unsigned int len = 1;
+        for (uint8_t mask=0x80;(mask!=0) && (0==(First&mask));mask>>=1)
+        {
+            len++;
+        }
+        return len;
+    }
+};
+
+class CMkvReader;
+
+class CReaderChunk : public IMkvChunk , public ILibmkvChunkRef
+{
+public:
+    CMkvReader*             m_Owner;
+    std::vector<uint8_t>    m_Data;
+    volatile unsigned int   m_Refs;
+public:
+    CReaderChunk(CMkvReader* Owner)
+        : m_Owner(Owner) , m_Refs(0)
+    {
+    }
+    virtual ~CReaderChunk()
+    {
+    }
+    const uint8_t*  get_data() { return m_Data.empty() ? NULL : &m_Data[0]; }
+    unsigned int    get_size() { return (unsigned int)m_Data.size(); }
+    void*           get_ref() { libmkv_atomic_add(&m_Refs,1); return static_cast<ILibmkvChunkRef*>(this); }
+    // frames stay in the file's encoding, the track keeps its compression
+    bool            compress_start(unsigned int,unsigned int) { return true; }
+    bool            compress_wait() { return true; }
+    unsigned int    compress_srcsize() { return (unsigned int)m_Data.size(); }
+    void            ReleaseRef();
+};
+
+class CReaderStream : public IMkvFrameSource
+{
+public:
+    CMkvReader*                 m_Reader;
+    uint64_t                    m_Number;
+    std::deque<CReaderChunk*>   m_Queue;
+    uint64_t                    m_ClusterSeq;
+    MkvTrackInfo                m_Info;
+    MkvProfileTrackInfo         m_Profile;
+    std::string                 m_CodecId;
+    std::string                 m_Lang;
+    std::string                 m_Name;
+    std::vector<uint8_t>        m_CodecPrivate;
+    std::vector<uint8_t>        m_HeaderStrip;
+public:
+    CReaderStream(CMkvReader* Reader)
+        : m_Reader(Reader) , m_Number(0) , m_ClusterSeq(0)
+    {
+        memset(&m_Info,0,sizeof(m_Info));
+        m_Profile.compressionType = MKV_TRACK_COMPRESSION_NONE;
+        m_Profile.compressionLevel = 0;
+        libmkv_register_source(this,true);
+    }
+    virtual ~CReaderStream()
+    {
+        while (!m_Queue.empty()) PopFrame();
+        libmkv_register_source(this,false);
+    }
+    unsigned int GetAvailableFramesCount()
+    {
+        return (unsigned int)m_Queue.size();
+    }
+    void PopFrame()
+    {
+        CReaderChunk* chunk = m_Queue.front();
+        m_Queue.pop_front();
+        chunk->ReleaseRef();
+    }
+    bool SourceFinished();
+    bool FetchFrames(unsigned int Count,bool Force);
+    IMkvChunk* PeekFrame(unsigned int Index)
+    {
+        return m_Queue[Index];
+    }
+    bool UpdateTrackInfo(MkvTrackInfo* Info)
+    {
+        memcpy(Info,&m_Info,sizeof(m_Info));
+        return true;
+    }
+    void SetInfoPointers()
+    {
+        m_Info.codec_id = m_CodecId.c_str();
+        m_Info.lang = m_Lang.c_str();
+        m_Info.name = m_Name.empty() ? NULL : m_Name.c_str();
+        m_Info.codec_private = m_CodecPrivate.empty() ? NULL : &m_CodecPrivate[0];
+        m_Info.codec_private_size = (unsigned int)m_CodecPrivate.size();
+        m_Info.header_comp_data = m_HeaderStrip.empty() ? NULL : &m_HeaderStrip[0];
+        m_Info.header_comp_size = (unsigned int)m_HeaderStrip.size();
+        m_Info.profile_track_info = (m_Profile.compressionType!=MKV_TRACK_COMPRESSION_NONE) ? &m_Profile : NULL;
+    }
+};
+
+class CMkvReader : public IMkvReader
+{
+private:
+    typedef struct _Chapter
+    {
+        int64_t                     start;
+        std::vector<std::string>    lang;
+        std::vector<std::string>    text;
+        std::vector<const char*>    lang_ptr;
+        std::vector<const char*>    text_ptr;
+    } Chapter;
+    typedef struct _Attachment
+    {
+        std::string                 name;
+        std::string                 mime_type;
+        std::vector<uint8_t>        data;
+    } Attachment;
+private:
+    CEbmlParser                 m_Parser;
+    CReadBuffer&                m_Input;
+    std::vector<CReaderStream*> m_Streams;
+    std::vector<CReaderChunk*>  m_Free;
+    CLibmkvLock                 m_FreeLock;
+    std::vector<Chapter>        m_Chapters;
+    std::vector<Attachment>     m_Attachments;
+    std::string                 m_Title;
+    uint64_t                    m_TimecodeScale;
+    double                      m_Duration;
+    uint64_t                    m_SegmentStart;
+    uint64_t                    m_SegmentEnd;
+    uint64_t                    m_ClusterEnd;
+    uint64_t                    m_ClusterSeq;
+    uint64_t                    m_ClusterTimecode;
+    size_t                      m_NextChapter;
+    bool                        m_InCluster;
+    bool                        m_Eof;
+    bool                        m_HaveTracks;
+    bool                        m_HaveChapters;
+    bool                        m_HaveAttachments;
+    KaxBlockLaces               m_Laces;
+public:
+    CMkvReader(IMkvReadSource* Source)
+        : m_Parser(Source) , m_Input(m_Parser.m_Input) , m_TimecodeScale(1000000) , m_Duration(0) ,
+          m_SegmentStart(0) , m_SegmentEnd(UNKNOWN_SIZE) , m_ClusterEnd(0) , m_ClusterSeq(0) ,
+          m_ClusterTimecode(0) , m_NextChapter(0) , m_InCluster(false) , m_Eof(false) ,
+          m_HaveTracks(false) , m_HaveChapters(false) , m_HaveAttachments(false)
+    {
+    }
+    virtual ~CMkvReader()
+    {
+        for (size_t i=0;i<m_Streams.size();i++)
+        {
+            delete m_Streams[i];
+        }
+        for (size_t i=0;i<m_Free.size();i++)
+        {
+            delete m_Free[i];
+        }
+    }
+    void Release()
+    {
+        delete this;
+    }
+    void Open();
+    bool Fetch(CReaderStream* Stream,unsigned int Count,bool Force);
+    bool Finished() const
+    {
+        return m_Eof;
+    }
+    // chunks may be released on another thread when the reader is prefetched
+    void FreeChunk(CReaderChunk* Chunk)
+    {
+        m_FreeLock.Lock();
+        m_Free.push_back(Chunk);
+        m_FreeLock.Unlock();
+    }
+public:
+    unsigned int MkvGetStreamCount()
+    {
+        return (unsigned int)m_Streams.size();
+    }
+    IMkvFrameSource* MkvGetStream(unsigned int Index)
+    {
+        return m_Streams[Index];
+    }
+    unsigned int GetChapterCount()
+    {
+        return (unsigned int)m_Chapters.size();
+    }
+    void GetChapterInfo(MkvChapterInfo *info,unsigned int chapter_id)
+    {
+        Chapter& chap = m_Chapters[chapter_id];
+        info->name_count = (unsigned int)chap.text.size();
+        info->name_lang = chap.lang_ptr.empty() ? NULL : &chap.lang_ptr[0];
+        info->name_text = chap.text_ptr.empty() ? NULL : &chap.text_ptr[0];
+    }
+    void GetMkvTitleInfo(MkvTitleInfo *info)
+    {
+        info->metadata_lang = NULL;
+        info->name = m_Title.empty() ? NULL : m_Title.c_str();
+        info->duration = ClockFromNs((int64_t)(m_Duration*m_TimecodeScale));
+    }
+    unsigned int GetAttachmentCount()
+    {
+        return (unsigned int)m_Attachments.size();
+    }
+    void GetAttachmentInfo(MkvAttachmentInfo* info,unsigned int attachment_id)
+    {
+        Attachment& att = m_Attachments[attachment_id];
+        info->name = att.name.c_str();
+        info->mime_type = att.mime_type.c_str();
+        info->data = att.data.empty() ? NULL : &att.data[0];
+        info->size = (unsigned int)att.data.size();
+    }
+private:
+    void ReadHeader(uint64_t* ChaptersPos,uint64_t* AttachmentsPos);
+    void ReadSeekHead(uint64_t End,uint64_t* ChaptersPos,uint64_t* AttachmentsPos);
+    void ReadInfo(uint64_t End);
+    void ReadTracks(uint64_t End);
+    void ReadTrackEntry(uint64_t End);
+    void ReadContentEncodings(uint64_t End,CReaderStream* Stream);
+    void ReadChapters(uint64_t End);
+    void ReadChapterAtom(uint64_t End);
+    void ReadAttachments(uint64_t End);
+    bool ReadAt(uint64_t Position,uint32_t Id);
+    bool ReadNextBlock();
+    void StartCluster(uint64_t Size);
+    void ReadBlockGroup(uint64_t End);
+    void ReadBlock(uint64_t Size,bool Simple,std::vector<CReaderChunk*>* Frames);
+    CReaderStream* FindStream(uint64_t Number);
+    CReaderChunk* NewChunk(CReaderStream* Stream,size_t Size);
+    static bool IsTopLevel(uint32_t Id);
+};
+
+void CReaderChunk::ReleaseRef()
+{
+    if (0==libmkv_atomic_add(&m_Refs,-1)) m_Owner->FreeChunk(this);
+}
+
+bool CReaderStream::SourceFinished()
+{
+    return m_Queue.empty() && m_Reader->Finished();
+}
+
+bool CReaderStream::FetchFrames(unsigned int Count,bool Force)
+{
+    return m_Reader->Fetch(this,Count,Force);
+}
+
+void CMkvReader::Open()
+{
+    uint32_t id;
+    uint64_t size;
+
+    if ( (false==m_Parser.ReadElement(&id,&size)) || (id!=ID(EbmlHead)) || (size==UNKNOWN_SIZE) )
+    {
+        throw mkv_error_exception("Not an EBML file");
+    }
+    uint64_t end = m_Input.Position() + size;
+    std::string doc_type = "matroska";
+    while (m_Input.Position()<end)
+    {
+        m_Parser.ReadChild(end,&id,&size);
+        if (id==ID(EDocType))
+        {
+            m_Parser.ReadString(size,doc_type);
+        } else {
+            m_Input.Skip(size);
+        }
+    }
+    if ( (doc_type!="matroska") && (doc_type!="webm") )
+    {
+        throw mkv_error_exception("Not a Matroska file");
+    }
+
+    // skip anything before the segment
+    while (true)
+    {
+        if (false==m_Parser.ReadElement(&id,&size)) throw mkv_error_exception("No segment");
+        if (id==ID(KaxSegment)) break;
+        if (size==UNKNOWN_SIZE) throw mkv_error_exception("Bad element size");
+        m_Input.Skip(size);
+    }
+    m_SegmentStart = m_Input.Position();
+    if (size!=UNKNOWN_SIZE) m_SegmentEnd = m_SegmentStart + size;
+
+    uint64_t chapters_pos = UNKNOWN_SIZE, attachments_pos = UNKNOWN_SIZE;
+    ReadHeader(&chapters_pos,&attachments_pos);
+    if (!m_HaveTracks) throw mkv_error_exception("No tracks");
+
+    // chapters and attachments written after the clusters
+    if ( (!m_HaveChapters) || (!m_HaveAttachments) )
+    {
+        uint64_t cluster_pos = m_Input.Position();
+        bool moved = false;
+        if ( (!m_HaveChapters) && (chapters_pos!=UNKNOWN_SIZE) )
+        {
+            moved = ReadAt(chapters_pos,ID(KaxChapters)) || moved;
+        }
+        if ( (!m_HaveAttachments) && (attachments_pos!=UNKNOWN_SIZE) )
+        {
+            moved = ReadAt(attachments_pos,ID(KaxAttachments)) || moved;
+        }
+        if ( moved && (false==m_Input.Seek(cluster_pos)) )
+        {
+            throw mkv_error_exception("Seek failed");
+        }
+    }
+
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        m_Streams[i]->SetInfoPointers();
+    }
+}
+
+// reads the level 1 elements up to the first cluster, leaves the input there
+void CMkvReader::ReadHeader(uint64_t* ChaptersPos,uint64_t* AttachmentsPos)
+{
+    while (true)
+    {
+        uint32_t id;
+        uint64_t size;
+        uint64_t start = m_Input.Position();
+
+        if ( (start>=m_SegmentEnd) || (false==m_Parser.ReadElement(&id,&size)) )
+        {
+            m_Eof = true;
+            return;
+        }
+        if (id==ID(KaxCluster))
+        {
+            StartCluster(size);
+            return;
+        }
+        if (size==UNKNOWN_SIZE) throw mkv_error_exception("Bad element size");
+
+        uint64_t end = m_Input.Position() + size;
+        if (id==ID(KaxSeekHead))
+        {
+            ReadSeekHead(end,ChaptersPos,AttachmentsPos);
+        } else if (id==ID(KaxInfo)) {
+            ReadInfo(end);
+        } else if ( (id==ID(KaxTracks)) && (!m_HaveTracks) ) {
+            ReadTracks(end);
+        } else if ( (id==ID(KaxChapters)) && (!m_HaveChapters) ) {
+            ReadChapters(end);
+        } else if ( (id==ID(KaxAttachments)) && (!m_HaveAttachments) ) {
+            ReadAttachments(end);
+        } else {
+            m_Input.Skip(size);
+        }
+    }
+}
+
+void CMkvReader::ReadSeekHead(uint64_t End,uint64_t* ChaptersPos,uint64_t* AttachmentsPos)
+{
+    uint32_t id;
+    uint64_t size;
+
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if (id!=ID(KaxSeek))
+        {
+            m_Input.Skip(size);
+            continue;
+        }
+
+        uint64_t seek_end = m_Input.Position() + size;
+        uint64_t seek_id = 0, seek_pos = UNKNOWN_SIZE;
+        while (m_Input.Position()<seek_end)
+        {
+            m_Parser.ReadChild(seek_end,&id,&size);
+            if (id==ID(KaxSeekID))
+            {
+                seek_id = m_Parser.ReadUInt(size);
+            } else if (id==ID(KaxSeekPosition)) {
+                seek_pos = m_Parser.ReadUInt(size);
+            } else {
+                m_Input.Skip(size);
+            }
+        }
+        if (seek_pos==UNKNOWN_SIZE) continue;
+        if (seek_id==ID(KaxChapters)) *ChaptersPos = m_SegmentStart + seek_pos;
+        if (seek_id==ID(KaxAttachments)) *AttachmentsPos = m_SegmentStart + seek_pos;
+    }
+}
+
+// reads a level 1 element at Position, returns true if the input was moved
+bool CMkvReader::ReadAt(uint64_t Position,uint32_t Id)
+{
+    uint32_t id;
+    uint64_t size;
+
+    if (false==m_Input.Seek(Position))
+    {
+        lgpl_trace("libmkv: input can't seek, chapters or attachments at the end of the file are lost");
+        return false;
+    }
+    if ( (false==m_Parser.ReadElement(&id,&size)) || (id!=Id) || (size==UNKNOWN_SIZE) ) return true;
+
+    uint64_t end = m_Input.Position() + size;
+    if (Id==ID(KaxChapters))
+    {
+        ReadChapters(end);
+    } else {
+        ReadAttachments(end);
+    }
+    return true;
+}
+
+void CMkvReader::ReadInfo(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if (id==ID(KaxTimecodeScale))
+        {
+            m_TimecodeScale = m_Parser.ReadUInt(size);
+            if (m_TimecodeScale==0) throw mkv_error_exception("Bad timecode scale");
+        } else if (id==ID(KaxDuration)) {
+            m_Duration = m_Parser.ReadFloat(size);
+        } else if (id==ID(KaxTitle)) {
+            m_Parser.ReadString(size,m_Title);
+        } else {
+            m_Input.Skip(size);
+        }
+    }
+}
+
+void CMkvReader::ReadTracks(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if (id==ID(KaxTrackEntry))
+        {
+            ReadTrackEntry(m_Input.Position()+size);
+        } else {
+            m_Input.Skip(size);
+        }
+    }
+    m_HaveTracks = true;
+}
+
+void CMkvReader::ReadTrackEntry(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+    uint64_t track_type = 0;
+    bool flag_default = true, flag_lacing = true, flag_forced = false;
+
+    CReaderStream* stream = new CReaderStream(this);
+    MkvTrackInfo* info = &stream->m_Info;
+    stream->m_Lang = "eng";
+
+    try
+    {
+        while (m_Input.Position()<End)
+        {
+            m_Parser.ReadChild(End,&id,&size);
+            uint64_t end = m_Input.Position() + size;
+
+            if (id==ID(KaxTrackNumber))
+            {
+                stream->m_Number = m_Parser.ReadUInt(size);
+            } else if (id==ID(KaxTrackType)) {
+                track_type = m_Parser.ReadUInt(size);
+            } else if (id==ID(KaxCodecID)) {
+                m_Parser.ReadString(size,stream->m_CodecId);
+            } else if (id==ID(KaxCodecPrivate)) {
+                m_Parser.ReadBinary(size,stream->m_CodecPrivate);
+            } else if (id==ID(KaxTrackLanguage)) {
+                m_Parser.ReadString(size,stream->m_Lang);
+            } else if (id==ID(KaxTrackName)) {
+                m_Parser.ReadString(size,stream->m_Name);
+            } else if (id==ID(KaxTrackDefaultDuration)) {
+                info->default_duration = ClockFromNs(m_Parser.ReadUInt(size));
+            } else if (id==ID(KaxTrackFlagDefault)) {
+                flag_default = (0!=m_Parser.ReadUInt(size));
+            } else if (id==ID(KaxTrackFlagForced)) {
+                flag_forced = (0!=m_Parser.ReadUInt(size));
+            } else if (id==ID(KaxTrackFlagLacing)) {
+                flag_lacing = (0!=m_Parser.ReadUInt(size));
+            } else if (id==ID(KaxTrackMinCache)) {
+                info->min_cache = (unsigned int)m_Parser.ReadUInt(size);
+            } else if (id==ID(KaxContentEncodings)) {
+                ReadContentEncodings(end,stream);
+            } else if (id==ID(KaxTrackVideo)) {
+                while (m_Input.Position()<end)
+                {
+                    m_Parser.ReadChild(end,&id,&size);
+                    if (id==ID(KaxVideoPixelWidth))
+                    {
+                        info->u.video.pixel_h = (int)m_Parser.ReadUInt(size);
+                    } else if (id==ID(KaxVideoPixelHeight)) {
+                        info->u.video.pixel_v = (int)m_Parser.ReadUInt(size);
+                    } else if (id==ID(KaxVideoDisplayWidth)) {
+                        info->u.video.display_h = (int)m_Parser.ReadUInt(size);
+                    } else if (id==ID(KaxVideoDisplayHeight)) {
+                        info->u.video.display_v = (int)m_Parser.ReadUInt(size);
+                    } else if (id==ID(KaxVideoStereoMode)) {
+                        info->u.video.stereo_mode = (uint8_t)m_Parser.ReadUInt(size);
+                    } else {
+                        m_Input.Skip(size);
+                    }
+                }
+            } else if (id==ID(KaxTrackAudio)) {
+                info->u.audio.sample_rate = 8000;
+                info->u.audio.channels_count = 1;
+                while (m_Input.Position()<end)
+                {
+                    m_Parser.ReadChild(end,&id,&size);
+                    if (id==ID(KaxAudioSamplingFreq))
+                    {
+                        info->u.audio.sample_rate = (int)m_Parser.ReadFloat(size);
+                    } else if (id==ID(KaxAudioChannels)) {
+                        info->u.audio.channels_count = (int)m_Parser.ReadUInt(size);
+                    } else if (id==ID(KaxAudioBitDepth)) {
+                        info->u.audio.bits_per_sample = (int)m_Parser.ReadUInt(size);
+                    } else {
+                        m_Input.Skip(size);
+                    }
+                }
+            } else {
+                m_Input.Skip(size);
+            }
+        }
+    } catch(...)
+    {
+        delete stream;
+        throw;
+    }
+
+    switch(track_type)
+    {
+    case 1: info->type = mttVideo; break;
+    case 2: info->type = mttAudio; break;
+    case 17: info->type = mttSubtitle; break;
+    default: info->type = mttUnknown; break;
+    }
+
+    if ( (info->type==mttUnknown) || (stream->m_Number==0) || stream->m_CodecId.empty() || (NULL!=FindStream(stream->m_Number)) )
+    {
+        lgpl_trace("libmkv: track dropped");
+        delete stream;
+        return;
+    }
+
+    if (info->type==mttVideo)
+    {
+        if (info->u.video.display_h==0) info->u.video.display_h = info->u.video.pixel_h;
+        if (info->u.video.display_v==0) info->u.video.display_v = info->u.video.pixel_v;
+    }
+
+    // the muxer takes three letter ISO 639-2 codes only
+    if (stream->m_Lang.size()!=3) stream->m_Lang = "und";
+
+    info->mkv_flags = (flag_default?MKV_TRACK_FLAG_DEFAULT:0) | (flag_forced?MKV_TRACK_FLAG_FORCED:0) |
+        (flag_lacing?MKV_TRACK_FLAG_LACING:0);
+
+    m_Streams.push_back(stream);
+}
+
+void CMkvReader::ReadContentEncodings(uint64_t End,CReaderStream* Stream)
+{
+    uint32_t id;
+    uint64_t size;
+    unsigned int count = 0;
+
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if (id!=ID(KaxContentEncoding))
+        {
+            m_Input.Skip(size);
+            continue;
+        }
+        if (++count>1) throw mkv_error_exception("Multiple content encodings are not supported");
+
+        uint64_t end = m_Input.Position() + size;
+        uint64_t scope = 1;
+        bool compression = false;
+        while (m_Input.Position()<end)
+        {
+            m_Parser.ReadChild(end,&id,&size);
+            if (id==ID(KaxContentEncodingScope))
+            {
+                scope = m_Parser.ReadUInt(size);
+            } else if (id==ID(KaxContentEncryption)) {
+                throw mkv_error_exception("Encrypted tracks are not supported");
+            } else if (id==ID(KaxContentCompression)) {
+                uint64_t comp_end = m_Input.Position() + size;
+                compression = true;
+                Stream->m_Profile.compressionType = MKV_TRACK_COMPRESSION_ZLIB;
+                while (m_Input.Position()<comp_end)
+                {
+                    m_Parser.ReadChild(comp_end,&id,&size);
+                    if (id==ID(KaxContentCompAlgo))
+                    {
+                        Stream->m_Profile.compressionType = (unsigned int)m_Parser.ReadUInt(size);
+                    } else if (id==ID(KaxContentCompSettings)) {
+                        m_Parser.ReadBinary(size,Stream->m_HeaderStrip);
+                    } else {
+                        m_Input.Skip(size);
+                    }
+                }
+            } else {
+                m_Input.Skip(size);
+            }
+        }
+        if ( compression && (scope!=1) )
+        {
+            throw mkv_error_exception("Compressed codec private data is not supported");
+        }
+        if (Stream->m_Profile.compressionType>MKV_TRACK_COMPRESSION_HEADERS)
+        {
+            throw mkv_error_exception("Unknown compression");
+        }
+        if (Stream->m_Profile.compressionType!=MKV_TRACK_COMPRESSION_HEADERS)
+        {
+            Stream->m_HeaderStrip.clear();
+        }
+    }
+}
+
+void CMkvReader::ReadChapters(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+    bool have_default = false;
+
+    // the default edition, or the first one
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if ( (id!=ID(KaxEditionEntry)) || have_default )
+        {
+            m_Input.Skip(size);
+            continue;
+        }
+
+        uint64_t end = m_Input.Position() + size;
+        std::vector<Chapter> prev;
+        bool is_default = false;
+
+        prev.swap(m_Chapters);
+        while (m_Input.Position()<end)
+        {
+            m_Parser.ReadChild(end,&id,&size);
+            if (id==ID(KaxChapterAtom))
+            {
+                ReadChapterAtom(m_Input.Position()+size);
+            } else if (id==ID(KaxEditionFlagDefault)) {
+                is_default = (0!=m_Parser.ReadUInt(size));
+            } else {
+                m_Input.Skip(size);
+            }
+        }
+        if (is_default)
+        {
+            have_default = true;
+        } else if (!prev.empty()) {
+            prev.swap(m_Chapters);
+        }
+    }
+
+    for (size_t i=0;i<m_Chapters.size();i++)
+    {
+        Chapter& chap = m_Chapters[i];
+        for (size_t j=0;j<chap.text.size();j++)
+        {
+            chap.lang_ptr.push_back(chap.lang[j].c_str());
+            chap.text_ptr.push_back(chap.text[j].c_str());
+        }
+    }
+    m_HaveChapters = true;
+}
+
+void CMkvReader::ReadChapterAtom(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+    bool hidden = false, enabled = true;
+    Chapter chap;
+
+    chap.start = 0;
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if (id==ID(KaxChapterTimeStart))
+        {
+            chap.start = ClockFromNs(m_Parser.ReadUInt(size));
+        } else if (id==ID(KaxChapterFlagHidden)) {
+            hidden = (0!=m_Parser.ReadUInt(size));
+        } else if (id==ID(KaxChapterFlagEnabled)) {
+            enabled = (0!=m_Parser.ReadUInt(size));
+        } else if (id==ID(KaxChapterDisplay)) {
+            uint64_t end = m_Input.Position() + size;
+            std::string text, lang = "eng";
+            while (m_Input.Position()<end)
+            {
+                m_Parser.ReadChild(end,&id,&size);
+                if (id==ID(KaxChapterString))
+                {
+                    m_Parser.ReadString(size,text);
+                } else if (id==ID(KaxChapterLanguage)) {
+                    m_Parser.ReadString(size,lang);
+                } else {
+                    m_Input.Skip(size);
+                }
+            }
+            if (lang.size()!=3) lang = "und";
+            chap.lang.push_back(lang);
+            chap.text.push_back(text);
+        } else {
+            m_Input.Skip(size);
+        }
+    }
+
+    // chapters are marked on frames in file order
+    if ( hidden || (!enabled) ) return;
+    if ( (!m_Chapters.empty()) && (chap.start<=m_Chapters.back().start) ) return;
+    m_Chapters.push_back(chap);
+}
+
+void CMkvReader::ReadAttachments(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if (id!=ID(KaxAttached))
+        {
+            m_Input.Skip(size);
+            continue;
+        }
+
+        uint64_t end = m_Input.Position() + size;
+        m_Attachments.resize(m_Attachments.size()+1);
+        Attachment& att = m_Attachments.back();
+        while (m_Input.Position()<end)
+        {
+            m_Parser.ReadChild(end,&id,&size);
+            if (id==ID(KaxFileName))
+            {
+                m_Parser.ReadString(size,att.name);
+            } else if (id==ID(KaxMimeType)) {
+                m_Parser.ReadString(size,att.mime_type);
+            } else if (id==ID(KaxFileData)) {
+                m_Parser.ReadBinary(size,att.data);
+            } else {
+                m_Input.Skip(size);
+            }
+        }
+    }
+    m_HaveAttachments = true;
+}
+
+bool CMkvReader::IsTopLevel(uint32_t Id)
+{
+    return (Id==ID(KaxCluster)) || (Id==ID(KaxCues)) || (Id==ID(KaxTags)) || (Id==ID(KaxChapters)) ||
+        (Id==ID(KaxAttachments)) || (Id==ID(KaxSeekHead)) || (Id==ID(KaxInfo)) || (Id==ID(KaxTracks)) ||
+        (Id==ID(KaxSegment)) || (Id==ID(EbmlHead));
+}
+
+CReaderStream* CMkvReader::FindStream(uint64_t Number)
+{
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        if (m_Streams[i]->m_Number==Number) return m_Streams[i];
+    }
+    return NULL;
+}
+
+void CMkvReader::StartCluster(uint64_t Size)
+{
+    m_InCluster = true;
+    m_ClusterEnd = (Size==UNKNOWN_SIZE) ? UNKNOWN_SIZE : (m_Input.Position()+Size);
+    m_ClusterTimecode = 0;
+    m_ClusterSeq++;
+}
+
+bool CMkvReader::Fetch(CReaderStream* Stream,unsigned int Count,bool Force)
+{
+    // other streams are only read ahead for streams the muxer waits on
+    if (!Force) return true;
+
+    try
+    {
+        while ( (Stream->m_Queue.size()<Count) && (!m_Eof) )
+        {
+            ReadNextBlock();
+        }
+        return true;
+    } catch(std::exception &Ex)
+    {
+        lgpl_trace(Ex.what());
+    } catch(...)
+    {
+        lgpl_trace("libmkv: read failed");
+    }
+    return false;
+}
+
+// reads up to the next block (of any stream), returns false at the end
+bool CMkvReader::ReadNextBlock()
+{
+    uint32_t id;
+    uint64_t size;
+
+    while (!m_Eof)
+    {
+        if ( m_InCluster && (m_ClusterEnd!=UNKNOWN_SIZE) && (m_Input.Position()>=m_ClusterEnd) )
+        {
+            m_InCluster = false;
+        }
+        if ( (!m_InCluster) && (m_Input.Position()>=m_SegmentEnd) )
+        {
+            m_Eof = true;
+            break;
+        }
+        if (false==m_Parser.ReadElement(&id,&size))
+        {
+            m_Eof = true;
+            break;
+        }
+
+        if (m_InCluster)
+        {
+            // a cluster of unknown size ends at the next level 1 element
+            if ( (m_ClusterEnd==UNKNOWN_SIZE) && IsTopLevel(id) )
+            {
+                m_InCluster = false;
+            } else {
+                if ( (size==UNKNOWN_SIZE) || ((m_ClusterEnd!=UNKNOWN_SIZE) && ((m_Input.Position()+size)>m_ClusterEnd)) )
+                {
+                    throw mkv_error_exception("Bad element size");
+                }
+                if (id==ID(KaxClusterTimecode))
+                {
+                    m_ClusterTimecode = m_Parser.ReadUInt(size);
+                } else if (id==ID(KaxSimpleBlock)) {
+                    ReadBlock(size,true,NULL);
+                    return true;
+                } else if (id==ID(KaxBlockGroup)) {
+                    ReadBlockGroup(m_Input.Position()+size);
+                    return true;
+                } else {
+                    m_Input.Skip(size);
+                }
+                continue;
+            }
+        }
+
+        if (id==ID(KaxCluster))
+        {
+            StartCluster(size);
+        } else {
+            if (size==UNKNOWN_SIZE) throw mkv_error_exception("Bad element size");
+            m_Input.Skip(size);
+        }
+    }
+    return false;
+}
+
+void CMkvReader::ReadBlockGroup(uint64_t End)
+{
+    uint32_t id;
+    uint64_t size;
+    std::vector<CReaderChunk*> frames;
+    bool have_duration = false, have_refs = false;
+    uint64_t duration = 0;
+
+    while (m_Input.Position()<End)
+    {
+        m_Parser.ReadChild(End,&id,&size);
+        if ( (id==ID(KaxBlock)) && frames.empty() )
+        {
+            ReadBlock(size,false,&frames);
+        } else if (id==ID(KaxBlockDuration)) {
+            duration = m_Parser.ReadUInt(size);
+            have_duration = true;
+        } else if (id==ID(KaxReferenceBlock)) {
+            m_Input.Skip(size);
+            have_refs = true;
+        } else {
+            m_Input.Skip(size);
+        }
+    }
+
+    for (size_t i=0;i<frames.size();i++)
+    {
+        if (!have_refs) frames[i]->flags |= MKV_CHUNK_KEYFRAME;
+        if (have_duration)
+        {
+            frames[i]->duration = ClockFromNs(duration*m_TimecodeScale) / frames.size();
+        }
+    }
+}
+
+//
+// Reads the frames of a block straight into their chunks. Frames of
+// header-stripped tracks get the stripped bytes back, the muxer strips them
+// again.
+//
+void CMkvReader::ReadBlock(uint64_t Size,bool Simple,std::vector<CReaderChunk*>* Frames)
+{
+    uint64_t end = m_Input.Position() + Size;
+    uint64_t number = m_Parser.ReadVint();
+    uint8_t timecode_hi = m_Input.Byte();
+    uint8_t timecode_lo = m_Input.Byte();
+    int16_t timecode = (int16_t)((timecode_hi<<8) | timecode_lo);
+    uint8_t block_flags = m_Input.Byte();
+
+    CReaderStream* stream = FindStream(number);
+    if (NULL==stream)
+    {
+        m_Input.Skip(end-m_Input.Position());
+        return;
+    }
+
+    // only the lace head has to be in the buffer, the frames are read after it
+    uint64_t data_size = end - m_Input.Position();
+    if (data_size>0xffffffff) throw mkv_error_exception("Bad element size");
+    LacingType lacing = (LacingType)((block_flags>>1)&3);
+    const uint8_t* head = NULL;
+    size_t head_available = 0;
+    if (lacing!=LACING_NONE)
+    {
+        head = m_Input.Peek((size_t)data_size,&head_available);
+    }
+    if (false==m_Laces.ParseHead(head,(uint32)head_available,(uint32)data_size,lacing))
+    {
+        throw mkv_error_exception("Bad lacing");
+    }
+    m_Input.Skip(m_Laces.HeadSize());
+
+    int64_t block_time = ClockFromNs(((int64_t)m_ClusterTimecode+timecode)*(int64_t)m_TimecodeScale);
+    uint32_t flags = MKV_CHUNK_LIBMKV_REF;
+    if (Simple)
+    {
+        if (block_flags&0x80) flags |= MKV_CHUNK_KEYFRAME;
+        if (block_flags&0x01) flags |= MKV_CHUNK_DISCARDABLE;
+    } else {
+        flags |= MKV_CHUNK_OLD_BLOCK;
+    }
+
+    for (unsigned int i=0;i<m_Laces.NumberFrames();i++)
+    {
+        size_t frame_size = m_Laces[i].Size;
+        CReaderChunk* chunk = NewChunk(stream,frame_size);
+        size_t strip = stream->m_HeaderStrip.size();
+
+        if (frame_size!=0) m_Input.Read(&chunk->m_Data[strip],frame_size);
+        chunk->timecode = block_time + ((int64_t)i)*stream->m_Info.default_duration;
+        chunk->duration = stream->m_Info.default_duration;
+        chunk->flags = flags;
+
+        // frames keep the clusters of the file
+        if ( (stream->m_ClusterSeq!=m_ClusterSeq) && (stream->m_Info.type!=mttSubtitle) )
+        {
+            chunk->flags |= MKV_CHUNK_CLUSTER_START;
+        }
+        stream->m_ClusterSeq = m_ClusterSeq;
+
+        if ( (stream==m_Streams[0]) && (m_NextChapter<m_Chapters.size()) &&
+            (chunk->timecode>=m_Chapters[m_NextChapter].start) )
+        {
+            chunk->flags |= MKV_CHUNK_CHAPTER_MARK;
+            while ( (m_NextChapter<m_Chapters.size()) && (chunk->timecode>=m_Chapters[m_NextChapter].start) )
+            {
+                m_NextChapter++;
+            }
+        }
+
+        stream->m_Queue.push_back(chunk);
+        if (Frames) Frames->push_back(chunk);
+    }
+}
+
+CReaderChunk* CMkvReader::NewChunk(CReaderStream* Stream,size_t Size)
+{
+    CReaderChunk* chunk = NULL;
+
+    m_FreeLock.Lock();
+    if (!m_Free.empty())
+    {
+        chunk = m_Free.back();
+        m_Free.pop_back();
+    }
+    m_FreeLock.Unlock();
+    if (NULL==chunk) chunk = new CReaderChunk(this);
+    chunk->m_Refs = 1;
+    chunk->m_Data.resize(Stream->m_HeaderStrip.size()+Size);
+    if (!Stream->m_HeaderStrip.empty())
+    {
+        memcpy(&chunk->m_Data[0],&Stream->m_HeaderStrip[0],Stream->m_HeaderStrip.size());
+    }
+    return chunk;
+}
+
+extern "C"
+IMkvReader* __cdecl MkvOpenReader(IMkvReadSource* Input) throw()
+{
+    CMkvReader* reader = NULL;
+    try
+    {
+        reader = new CMkvReader(Input);
+        reader->Open();
+        return reader;
+    } catch(std::exception &Ex)
+    {
+        lgpl_trace(Ex.what());
+    } catch(...)
+    {
+        lgpl_trace("libmkv: can't open input");
+    }
+    delete reader;
+    return NULL;
+}
@@ -0,0 +1,828 @@
+/*
+    libMakeMKV - MKV multiplexer library
+
+    Copyright (C) 2007-2016 GuinpinSoft inc <libmkv@makemkv.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include <libmkv/libmkv.h>
+#include <libmkv/internal.h>
+#include <lgpl/cassert>
+#include <exception>
+#include <lgpl/world.h>
+#include <vector>
+
+#ifndef _MSC_VER
+#define MKV_PREFETCH_THREADS 1
+#include <pthread.h>
+#endif
+
+#define PREFETCH_HIGH_FRAMES        1024
+#define PREFETCH_LOW_FRAMES         512
+#define PREFETCH_HIGH_BYTES         (64*1024*1024)
+#define PREFETCH_LOW_BYTES          (32*1024*1024)
+
+// the muxer asks for up to this many frames of a stream at once
+#define PREFETCH_MIN_CAPACITY       256
+
+// the producer reads up to this many frames of a stream before it queues
+// them and moves on to the next stream
+#define PREFETCH_BATCH_FRAMES       64
+
+// the producer publishes its stats at least every this many reads
+#define PREFETCH_STATS_STEPS        256
+
+// m_Failed values
+#define PREFETCH_FAILED_INPUT       1
+#define PREFETCH_FAILED_EXCEPTION   2
+
+//
+// Each stream has a single producer, single consumer ring of frames. The
+// producer thread owns the head and everything in front of it, the muxer
+// owns the tail. The lock is only taken by a side that has to sleep and by
+// the other side to wake it, which it finds out through the waiting flags.
+// Index stores and flag loads are sequentially consistent so that a side
+// going to sleep can't miss the other side's last update.
+//
+#ifdef MKV_PREFETCH_THREADS
+
+static inline unsigned int AtomicLoad(const volatile unsigned int* Value)
+{
+    return __atomic_load_n(Value,__ATOMIC_SEQ_CST);
+}
+
+static inline void AtomicStore(volatile unsigned int* Value,unsigned int NewValue)
+{
+    __atomic_store_n(Value,NewValue,__ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t AtomicAdd64(volatile uint64_t* Value,uint64_t Add)
+{
+    return __atomic_add_fetch(Value,Add,__ATOMIC_SEQ_CST);
+}
+
+#else
+
+static inline unsigned int AtomicLoad(const volatile unsigned int* Value)
+{
+    return *Value;
+}
+
+static inline void AtomicStore(volatile unsigned int* Value,unsigned int NewValue)
+{
+    *Value = NewValue;
+}
+
+static inline uint64_t AtomicAdd64(volatile uint64_t* Value,uint64_t Add)
+{
+    return (*Value += Add);
+}
+
+#endif
+
+class CPrefetchTrack;
+
+//
+// The muxer only sees the frames it asked for, as if the input read them on
+// demand, so that its decisions (scan windows, lacing, cluster starts) and
+// with them the output don't depend on how far the producer got.
+//
+class CPrefetchStream : public IMkvFrameSource
+{
+    friend class CPrefetchTrack;
+private:
+    typedef struct _Entry
+    {
+        IMkvChunk*      chunk;
+        void*           ref;
+        unsigned int    size;
+        bool            libmkv_ref;
+    } Entry;
+private:
+    CPrefetchTrack*         m_Track;
+    IMkvFrameSource*        m_Source;
+    MkvTrackInfo            m_Info;
+    bool                    m_InfoValid;
+    bool                    m_OwnSource;
+    std::vector<Entry>      m_Ring;
+    unsigned int            m_Mask;
+    volatile unsigned int   m_Head;
+    volatile unsigned int   m_Tail;
+    volatile unsigned int   m_Demand;
+    volatile unsigned int   m_Poll;
+    volatile unsigned int   m_Finished;
+    // muxer only
+    unsigned int            m_Window;
+    // producer only
+    bool                    m_ReadAhead;
+    bool                    m_Paused;
+    bool                    m_SourceDone;
+    uint64_t                m_PushedFrames;
+    uint64_t                m_PushedBytes;
+public:
+    CPrefetchStream(CPrefetchTrack* Track,IMkvFrameSource* Source,unsigned int Capacity);
+    virtual ~CPrefetchStream();
+public:
+    unsigned int GetAvailableFramesCount()
+    {
+        unsigned int queued = AtomicLoad(&m_Head) - m_Tail;
+        unsigned int window = m_Window - m_Tail;
+        return (queued<window) ? queued : window;
+    }
+    void PopFrame();
+    bool SourceFinished()
+    {
+        return (0!=AtomicLoad(&m_Finished)) && (AtomicLoad(&m_Head)==m_Tail);
+    }
+    bool FetchFrames(unsigned int Count,bool Force);
+    IMkvChunk* PeekFrame(unsigned int Index)
+    {
+        MKV_ASSERT(Index<GetAvailableFramesCount());
+        return m_Ring[(m_Tail+Index)&m_Mask].chunk;
+    }
+    bool UpdateTrackInfo(MkvTrackInfo* Info);
+private:
+    unsigned int Queued() const
+    {
+        return m_Head - AtomicLoad(&m_Tail);
+    }
+    void Drain();
+    bool CheckFinished();
+    bool Waited(unsigned int Queued);
+    bool WantsReadAhead(unsigned int High,unsigned int Low);
+};
+
+class CPrefetchTrack : public IMkvPrefetchTrack
+{
+    friend class CPrefetchStream;
+private:
+    IMkvTrack*                      m_Input;
+    IWorld*                         m_World;
+    MkvPrefetchLimits               m_Limits;
+    std::vector<CPrefetchStream*>   m_Streams;
+    MkvPrefetchStats                m_Stats;            // muxer side
+    MkvPrefetchStats                m_ProducerStats;    // producer side
+    MkvPrefetchStats                m_ProducerShared;   // published under m_Lock
+    volatile uint64_t               m_Bytes;
+    volatile unsigned int           m_ProducerWaiting;
+    volatile unsigned int           m_ConsumerWaiting;
+    volatile unsigned int           m_PollSeq;
+    volatile unsigned int           m_Stalled;
+    volatile unsigned int           m_Failed;
+    volatile unsigned int           m_Done;
+    volatile unsigned int           m_Stop;
+    unsigned int                    m_PollSeen;
+    unsigned int                    m_FinishedStreams;
+    bool                            m_BytesPaused;
+    bool                            m_Threaded;
+#ifdef MKV_PREFETCH_THREADS
+    pthread_t                       m_Thread;
+    pthread_mutex_t                 m_Lock;
+    pthread_cond_t                  m_ProducerCond;
+    pthread_cond_t                  m_ConsumerCond;
+#endif
+public:
+    CPrefetchTrack(IMkvTrack* Input,const MkvPrefetchLimits* Limits);
+    virtual ~CPrefetchTrack();
+    void Start();
+public:
+    unsigned int MkvGetStreamCount()
+    {
+        return (unsigned int)m_Streams.size();
+    }
+    IMkvFrameSource* MkvGetStream(unsigned int Index)
+    {
+        return m_Streams[Index];
+    }
+    void GetPrefetchStats(MkvPrefetchStats* Stats);
+    void Release()
+    {
+        delete this;
+    }
+private:
+    bool AllFinished();
+    bool WaitFrames(CPrefetchStream* Stream,unsigned int Count,bool Force);
+    void WaitDone();
+    void Popped(unsigned int Size,unsigned int Queued);
+    void Pushed(unsigned int Size);
+    void WakeProducer();
+    void WakeConsumer();
+    bool Fail(unsigned int Reason=PREFETCH_FAILED_INPUT);
+    bool CheckFailed();
+    void PublishStats();
+    bool DrainDemanded();
+    unsigned int BatchSize(CPrefetchStream* Stream);
+    CPrefetchStream* NextStream();
+    bool Step(CPrefetchStream* Stream);
+    bool Poll();
+    void ProducerProc();
+    static void* ProducerProcStatic(void* Context);
+};
+
+CPrefetchStream::CPrefetchStream(CPrefetchTrack* Track,IMkvFrameSource* Source,unsigned int Capacity)
+    : m_Track(Track) , m_Source(Source) , m_InfoValid(false) , m_OwnSource(false) , m_Head(0) , m_Tail(0) , m_Demand(0) ,
+      m_Poll(0) , m_Finished(0) , m_Window(0) , m_ReadAhead(false) , m_Paused(false) , m_SourceDone(false) ,
+      m_PushedFrames(0) , m_PushedBytes(0)
+{
+    unsigned int size = 1;
+    while (size<Capacity) size<<=1;
+
+    Entry entry;
+    memset(&entry,0,sizeof(entry));
+    m_Ring.resize(size,entry);
+    m_Mask = size-1;
+
+    memset(&m_Info,0,sizeof(m_Info));
+    m_InfoValid = m_Source->UpdateTrackInfo(&m_Info);
+    m_ReadAhead = (m_Info.type==mttVideo) || (m_Info.type==mttAudio);
+
+    // the muxer sees the chunks of Source, so it may trust their flag only if
+    // this stream is registered too
+    m_OwnSource = libmkv_is_own_source(m_Source);
+    if (m_OwnSource) libmkv_register_source(this,true);
+}
+
+CPrefetchStream::~CPrefetchStream()
+{
+    if (m_OwnSource) libmkv_register_source(this,false);
+    while (m_Head!=m_Tail)
+    {
+        Entry& entry = m_Ring[(m_Tail++)&m_Mask];
+        libmkv_free_chunk_ref(entry.ref,entry.libmkv_ref);
+    }
+}
+
+void CPrefetchStream::PopFrame()
+{
+    unsigned int tail = m_Tail;
+    Entry entry = m_Ring[tail&m_Mask];
+
+    MKV_ASSERT(0!=GetAvailableFramesCount());
+
+    // the entry belongs to the producer once the tail moves past it
+    libmkv_free_chunk_ref(entry.ref,entry.libmkv_ref);
+    AtomicStore(&m_Tail,tail+1);
+
+    m_Track->Popped(entry.size,AtomicLoad(&m_Head)-(tail+1));
+}
+
+bool CPrefetchStream::FetchFrames(unsigned int Count,bool Force)
+{
+    if (Count>m_Ring.size()) Count = (unsigned int)m_Ring.size();
+
+    if ((m_Window-m_Tail)<Count) m_Window = m_Tail+Count;
+
+    if ( ((AtomicLoad(&m_Head)-m_Tail)>=Count) || (0!=AtomicLoad(&m_Finished)) )
+    {
+        return m_Track->CheckFailed();
+    }
+
+    // video and audio are being read ahead anyway, so a poll waits for them
+    // just like a forced fetch
+    return m_Track->WaitFrames(this,Count,Force||m_ReadAhead);
+}
+
+bool CPrefetchStream::UpdateTrackInfo(MkvTrackInfo* Info)
+{
+    // the input may only be called once the producer is done with it
+    if (m_Track->AllFinished()) m_Track->WaitDone();
+    if ( (!m_Track->m_Threaded) || (0!=AtomicLoad(&m_Track->m_Done)) )
+    {
+        return m_Source->UpdateTrackInfo(Info);
+    }
+    memcpy(Info,&m_Info,sizeof(m_Info));
+    return m_InfoValid;
+}
+
+// producer: moves the frames the input already has into the ring
+void CPrefetchStream::Drain()
+{
+    unsigned int head = m_Head;
+
+    if (0==m_Source->GetAvailableFramesCount()) return;
+
+    while ( ((head-AtomicLoad(&m_Tail))<m_Ring.size()) && (0!=m_Source->GetAvailableFramesCount()) )
+    {
+        IMkvChunk* chunk = m_Source->PeekFrame(0);
+        Entry& entry = m_Ring[head&m_Mask];
+
+        // our ref keeps the chunk alive after the input pops it
+        entry.chunk = chunk;
+        entry.libmkv_ref = libmkv_is_chunk_ref(chunk,m_OwnSource);
+        entry.ref = chunk->get_ref();
+        entry.size = chunk->get_size();
+        m_Source->PopFrame();
+
+        m_Track->Pushed(entry.size);
+        m_PushedFrames++;
+        m_PushedBytes += entry.size;
+        head++;
+        AtomicStore(&m_Head,head);
+    }
+
+    unsigned int queued = head-AtomicLoad(&m_Tail);
+    if (queued>m_Track->m_ProducerStats.max_frames)
+    {
+        m_Track->m_ProducerStats.max_frames = queued;
+    }
+    if (Waited(queued)) m_Track->WakeConsumer();
+}
+
+// producer: true when the muxer waits for no more than Queued frames of this
+// stream. It stores the count before it flags that it is waiting, so a
+// waiting muxer is never missed.
+bool CPrefetchStream::Waited(unsigned int Queued)
+{
+    unsigned int demand = AtomicLoad(&m_Demand);
+    unsigned int poll = AtomicLoad(&m_Poll);
+    return ( (0!=demand) && (Queued>=demand) ) || ( (0!=poll) && (Queued>=poll) );
+}
+
+// producer: returns true once the input stream has nothing left
+bool CPrefetchStream::CheckFinished()
+{
+    if (m_SourceDone) return true;
+    if ( (0!=m_Source->GetAvailableFramesCount()) || (false==m_Source->SourceFinished()) ) return false;
+
+    m_SourceDone = true;
+    m_Track->m_FinishedStreams++;
+    AtomicStore(&m_Finished,1);
+    m_Track->WakeConsumer();
+    return true;
+}
+
+// producer: high/low watermark hysteresis on the stream's queue
+bool CPrefetchStream::WantsReadAhead(unsigned int High,unsigned int Low)
+{
+    unsigned int queued = Queued();
+
+    if (m_Paused)
+    {
+        if (queued<=Low) m_Paused = false;
+    } else {
+        if (queued>=High) m_Paused = true;
+    }
+    return m_ReadAhead && (!m_SourceDone) && (!m_Paused) && (queued<m_Ring.size());
+}
+
+CPrefetchTrack::CPrefetchTrack(IMkvTrack* Input,const MkvPrefetchLimits* Limits)
+    : m_Input(Input) , m_World(my_world()) , m_Bytes(0) , m_ProducerWaiting(0) , m_ConsumerWaiting(0) ,
+      m_PollSeq(0) , m_Stalled(0) , m_Failed(0) , m_Done(0) , m_Stop(0) , m_PollSeen(0) , m_FinishedStreams(0) ,
+      m_BytesPaused(false) , m_Threaded(false)
+{
+    if (NULL!=Limits)
+    {
+        m_Limits = *Limits;
+    } else {
+        m_Limits.high_frames = PREFETCH_HIGH_FRAMES;
+        m_Limits.low_frames = PREFETCH_LOW_FRAMES;
+        m_Limits.high_bytes = PREFETCH_HIGH_BYTES;
+        m_Limits.low_bytes = PREFETCH_LOW_BYTES;
+    }
+    if (m_Limits.high_frames==0) m_Limits.high_frames = 1;
+    if (m_Limits.low_frames>=m_Limits.high_frames) m_Limits.low_frames = m_Limits.high_frames-1;
+    if (m_Limits.low_bytes>m_Limits.high_bytes) m_Limits.low_bytes = m_Limits.high_bytes;
+
+    memset(&m_Stats,0,sizeof(m_Stats));
+    memset(&m_ProducerStats,0,sizeof(m_ProducerStats));
+    memset(&m_ProducerShared,0,sizeof(m_ProducerShared));
+
+    unsigned int capacity = m_Limits.high_frames;
+    if (capacity<PREFETCH_MIN_CAPACITY) capacity = PREFETCH_MIN_CAPACITY;
+
+    for (unsigned int i=0;i<m_Input->MkvGetStreamCount();i++)
+    {
+        m_Streams.push_back(new CPrefetchStream(this,m_Input->MkvGetStream(i),capacity));
+    }
+
+#ifdef MKV_PREFETCH_THREADS
+    pthread_mutex_init(&m_Lock,NULL);
+    pthread_cond_init(&m_ProducerCond,NULL);
+    pthread_cond_init(&m_ConsumerCond,NULL);
+#endif
+}
+
+void CPrefetchTrack::Start()
+{
+#ifdef MKV_PREFETCH_THREADS
+    // without a thread the input is read on demand on the muxer thread
+    m_Threaded = (0==pthread_create(&m_Thread,NULL,ProducerProcStatic,this));
+#endif
+}
+
+CPrefetchTrack::~CPrefetchTrack()
+{
+#ifdef MKV_PREFETCH_THREADS
+    if (m_Threaded)
+    {
+        pthread_mutex_lock(&m_Lock);
+        AtomicStore(&m_Stop,1);
+        pthread_cond_signal(&m_ProducerCond);
+        pthread_mutex_unlock(&m_Lock);
+        pthread_join(m_Thread,NULL);
+    }
+#endif
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        delete m_Streams[i];
+    }
+#ifdef MKV_PREFETCH_THREADS
+    pthread_cond_destroy(&m_ConsumerCond);
+    pthread_cond_destroy(&m_ProducerCond);
+    pthread_mutex_destroy(&m_Lock);
+#endif
+}
+
+// muxer: the producer side is what the producer published last
+void CPrefetchTrack::GetPrefetchStats(MkvPrefetchStats* Stats)
+{
+    MkvPrefetchStats producer;
+
+    if (m_Threaded)
+    {
+#ifdef MKV_PREFETCH_THREADS
+        pthread_mutex_lock(&m_Lock);
+        memcpy(&producer,&m_ProducerShared,sizeof(producer));
+        pthread_mutex_unlock(&m_Lock);
+#endif
+    } else {
+        memcpy(&producer,&m_ProducerStats,sizeof(producer));
+    }
+
+    memcpy(Stats,&m_Stats,sizeof(m_Stats));
+    Stats->max_frames = producer.max_frames;
+    Stats->max_bytes = producer.max_bytes;
+    Stats->fetch = producer.fetch;
+    Stats->producer_wait = producer.producer_wait;
+    Stats->queued_bytes = AtomicAdd64(&m_Bytes,0);
+    Stats->queued_frames = 0;
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        Stats->queued_frames += AtomicLoad(&m_Streams[i]->m_Head) - AtomicLoad(&m_Streams[i]->m_Tail);
+    }
+}
+
+bool CPrefetchTrack::AllFinished()
+{
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        if (false==m_Streams[i]->SourceFinished()) return false;
+    }
+    return true;
+}
+
+void CPrefetchTrack::Pushed(unsigned int Size)
+{
+    uint64_t bytes = AtomicAdd64(&m_Bytes,Size);
+    if (bytes>m_ProducerStats.max_bytes) m_ProducerStats.max_bytes = bytes;
+}
+
+void CPrefetchTrack::Popped(unsigned int Size,unsigned int Queued)
+{
+    uint64_t bytes = AtomicAdd64(&m_Bytes,(uint64_t)0-Size);
+
+    m_Stats.frames++;
+    m_Stats.bytes += Size;
+
+    if ( (Queued<=m_Limits.low_frames) || (bytes<=m_Limits.low_bytes) )
+    {
+        WakeProducer();
+    }
+}
+
+void CPrefetchTrack::WakeProducer()
+{
+#ifdef MKV_PREFETCH_THREADS
+    if (0==AtomicLoad(&m_ProducerWaiting)) return;
+    pthread_mutex_lock(&m_Lock);
+    pthread_cond_signal(&m_ProducerCond);
+    pthread_mutex_unlock(&m_Lock);
+#endif
+}
+
+void CPrefetchTrack::WakeConsumer()
+{
+#ifdef MKV_PREFETCH_THREADS
+    if (0==AtomicLoad(&m_ConsumerWaiting)) return;
+    pthread_mutex_lock(&m_Lock);
+    pthread_cond_signal(&m_ConsumerCond);
+    pthread_mutex_unlock(&m_Lock);
+#endif
+}
+
+// muxer: Force waits until Count frames are queued or the stream ends, a
+// poll only until the producer has nothing more it may read
+bool CPrefetchTrack::WaitFrames(CPrefetchStream* Stream,unsigned int Count,bool Force)
+{
+    CStageTimer timer(&m_Stats.consumer_wait);
+
+    if (!m_Threaded)
+    {
+        if (Force)
+        {
+            while ( (Stream->Queued()<Count) && (!Stream->m_SourceDone) && (0==m_Failed) )
+            {
+                Step(Stream);
+            }
+        } else {
+            Stream->m_Poll = Count;
+            Poll();
+            Stream->m_Poll = 0;
+        }
+        return CheckFailed();
+    }
+
+#ifdef MKV_PREFETCH_THREADS
+    pthread_mutex_lock(&m_Lock);
+    if (Force)
+    {
+        AtomicStore(&Stream->m_Demand,Count);
+    } else {
+        AtomicStore(&Stream->m_Poll,Count);
+        AtomicStore(&m_Stalled,0);
+        AtomicStore(&m_PollSeq,m_PollSeq+1);
+    }
+    AtomicStore(&m_ConsumerWaiting,1);
+    pthread_cond_signal(&m_ProducerCond);
+    while ( ((AtomicLoad(&Stream->m_Head)-Stream->m_Tail)<Count) && (0==AtomicLoad(&Stream->m_Finished)) &&
+        (0==AtomicLoad(&m_Failed)) && (0==AtomicLoad(&m_Done)) && (Force || (0==AtomicLoad(&m_Stalled))) )
+    {
+        pthread_cond_wait(&m_ConsumerCond,&m_Lock);
+    }
+    AtomicStore(&m_ConsumerWaiting,0);
+    AtomicStore(&Stream->m_Demand,0);
+    AtomicStore(&Stream->m_Poll,0);
+    pthread_mutex_unlock(&m_Lock);
+#endif
+    return CheckFailed();
+}
+
+void CPrefetchTrack::WaitDone()
+{
+    if (!m_Threaded) return;
+#ifdef MKV_PREFETCH_THREADS
+    pthread_mutex_lock(&m_Lock);
+    AtomicStore(&m_ConsumerWaiting,1);
+    while ( (0==AtomicLoad(&m_Done)) && (0==AtomicLoad(&m_Failed)) )
+    {
+        pthread_cond_wait(&m_ConsumerCond,&m_Lock);
+    }
+    AtomicStore(&m_ConsumerWaiting,0);
+    pthread_mutex_unlock(&m_Lock);
+#endif
+}
+
+bool CPrefetchTrack::Fail(unsigned int Reason)
+{
+    AtomicStore(&m_Failed,Reason);
+    WakeConsumer();
+    return false;
+}
+
+// muxer: an exception the input threw on the producer thread is thrown
+// again here, an input that returned false fails the fetch
+bool CPrefetchTrack::CheckFailed()
+{
+    unsigned int failed = AtomicLoad(&m_Failed);
+    if (failed==PREFETCH_FAILED_EXCEPTION)
+    {
+        throw mkv_error_exception("Input failed on the prefetch thread");
+    }
+    return (0==failed);
+}
+
+// producer: called with m_Lock held
+void CPrefetchTrack::PublishStats()
+{
+    memcpy(&m_ProducerShared,&m_ProducerStats,sizeof(m_ProducerShared));
+}
+
+// producer: queues what the input has of the streams the muxer waits for,
+// returns false once all streams ended
+bool CPrefetchTrack::DrainDemanded()
+{
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        CPrefetchStream* stream = m_Streams[i];
+        if ( (!stream->m_SourceDone) && (AtomicLoad(&stream->m_Demand)>stream->Queued()) )
+        {
+            stream->Drain();
+            stream->CheckFinished();
+        }
+    }
+    return m_FinishedStreams<m_Streams.size();
+}
+
+// producer: video and audio are read in batches towards the high watermarks,
+// estimating the bytes from the frames queued so far, so that a muxer waiting
+// for them is woken once per batch instead of once per frame. Sparse streams
+// are only read as far as the muxer asks.
+unsigned int CPrefetchTrack::BatchSize(CPrefetchStream* Stream)
+{
+    unsigned int queued = Stream->Queued();
+    unsigned int count = 1;
+
+    if ( Stream->m_ReadAhead && (queued<m_Limits.high_frames) )
+    {
+        count = m_Limits.high_frames-queued;
+        if (count>PREFETCH_BATCH_FRAMES) count = PREFETCH_BATCH_FRAMES;
+
+        uint64_t bytes = AtomicAdd64(&m_Bytes,0);
+        if ( (0!=Stream->m_PushedFrames) && (bytes<m_Limits.high_bytes) )
+        {
+            uint64_t frame_size = Stream->m_PushedBytes/Stream->m_PushedFrames+1;
+            uint64_t fit = (m_Limits.high_bytes-bytes)/frame_size+1;
+            if (fit<count) count = (unsigned int)fit;
+        }
+    }
+
+    unsigned int demand = AtomicLoad(&Stream->m_Demand);
+    if (demand>(queued+count)) count = demand-queued;
+
+    unsigned int room = (unsigned int)Stream->m_Ring.size()-queued;
+    if (count>room) count = room;
+    return (0!=count) ? count : 1;
+}
+
+// producer: streams the muxer waits for first, then the emptiest stream to read ahead
+CPrefetchStream* CPrefetchTrack::NextStream()
+{
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        CPrefetchStream* stream = m_Streams[i];
+        if ( (!stream->m_SourceDone) && (AtomicLoad(&stream->m_Demand)>stream->Queued()) )
+        {
+            return stream;
+        }
+    }
+
+    uint64_t bytes = AtomicAdd64(&m_Bytes,0);
+    if (m_BytesPaused)
+    {
+        if (bytes<=m_Limits.low_bytes) m_BytesPaused = false;
+    } else {
+        if (bytes>=m_Limits.high_bytes) m_BytesPaused = true;
+    }
+    if (m_BytesPaused) return NULL;
+
+    CPrefetchStream* rtn = NULL;
+    bool reading = false;
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        CPrefetchStream* stream = m_Streams[i];
+        if ( stream->m_ReadAhead && (!stream->m_SourceDone) ) reading = true;
+        if (false==stream->WantsReadAhead(m_Limits.high_frames,m_Limits.low_frames)) continue;
+        if ( (NULL==rtn) || (stream->Queued()<rtn->Queued()) )
+        {
+            rtn = stream;
+        }
+    }
+    if (reading) return rtn;
+
+    // video and audio are done, read whatever is left of the sparse streams
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        CPrefetchStream* stream = m_Streams[i];
+        if ( (!stream->m_SourceDone) && (0==stream->Queued()) )
+        {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+// producer: reads a batch of Stream, returns false once all streams ended.
+// Frames the input read of other streams on the way stay with it until
+// those are read.
+bool CPrefetchTrack::Step(CPrefetchStream* Stream)
+{
+    bool ok;
+    {
+        CStageTimer timer(&m_ProducerStats.fetch);
+        ok = Stream->m_Source->FetchFrames(BatchSize(Stream),true);
+    }
+    if (!ok) return Fail();
+
+    Stream->Drain();
+    Stream->CheckFinished();
+    return DrainDemanded();
+}
+
+// producer: passes the muxer's polls of sparse streams on to the input
+bool CPrefetchTrack::Poll()
+{
+    for (size_t i=0;i<m_Streams.size();i++)
+    {
+        CPrefetchStream* stream = m_Streams[i];
+        unsigned int count = AtomicLoad(&stream->m_Poll);
+
+        if ( (stream->m_SourceDone) || (count<=stream->Queued()) ) continue;
+
+        {
+            CStageTimer timer(&m_ProducerStats.fetch);
+            if (false==stream->m_Source->FetchFrames(count-stream->Queued(),false)) return Fail();
+        }
+        stream->Drain();
+        stream->CheckFinished();
+    }
+    return DrainDemanded();
+}
+
+void CPrefetchTrack::ProducerProc()
+{
+#ifdef MKV_PREFETCH_THREADS
+    CThreadWorld world(m_World);
+    unsigned int steps = 0;
+
+    try
+    {
+        while (0==AtomicLoad(&m_Stop))
+        {
+            unsigned int poll_seq = AtomicLoad(&m_PollSeq);
+            if (poll_seq!=m_PollSeen)
+            {
+                m_PollSeen = poll_seq;
+                if (false==Poll()) break;
+            }
+
+            CPrefetchStream* stream = NextStream();
+            if (NULL!=stream)
+            {
+                if (false==Step(stream)) break;
+                if ((++steps%PREFETCH_STATS_STEPS)==0)
+                {
+                    pthread_mutex_lock(&m_Lock);
+                    PublishStats();
+                    pthread_mutex_unlock(&m_Lock);
+                }
+                continue;
+            }
+
+            // nothing to read, a pending poll gets what is queued
+            CStageTimer timer(&m_ProducerStats.producer_wait);
+            pthread_mutex_lock(&m_Lock);
+            PublishStats();
+            AtomicStore(&m_ProducerWaiting,1);
+            if ( (0==AtomicLoad(&m_Stop)) && (AtomicLoad(&m_PollSeq)==m_PollSeen) && (NULL==NextStream()) )
+            {
+                AtomicStore(&m_Stalled,1);
+                pthread_cond_signal(&m_ConsumerCond);
+                pthread_cond_wait(&m_ProducerCond,&m_Lock);
+            }
+            AtomicStore(&m_ProducerWaiting,0);
+            pthread_mutex_unlock(&m_Lock);
+        }
+    } catch(std::exception &Ex)
+    {
+        char tstr[512];
+        strcpy(tstr,"Exception in prefetch: ");
+        strncat(tstr,Ex.what(),sizeof(tstr)-strlen(tstr)-1);
+        lgpl_trace(tstr);
+        Fail(PREFETCH_FAILED_EXCEPTION);
+    } catch(...)
+    {
+        lgpl_trace("Exception in prefetch: unknown");
+        Fail(PREFETCH_FAILED_EXCEPTION);
+    }
+
+    pthread_mutex_lock(&m_Lock);
+    PublishStats();
+    AtomicStore(&m_Done,1);
+    pthread_cond_signal(&m_ConsumerCond);
+    pthread_mutex_unlock(&m_Lock);
+#endif
+}
+
+void* CPrefetchTrack::ProducerProcStatic(void* Context)
+{
+    ((CPrefetchTrack*)Context)->ProducerProc();
+    return NULL;
+}
+
+extern "C"
+IMkvPrefetchTrack* __cdecl MkvCreatePrefetchTrack(IMkvTrack* Input,const MkvPrefetchLimits* Limits) throw()
+{
+    try
+    {
+        CPrefetchTrack* track = new CPrefetchTrack(Input,Limits);
+        track->Start();
+        return track;
+    } catch(...)
+    {
+        lgpl_trace("libmkv: can't create prefetch track");
+    }
+    return NULL;
+}
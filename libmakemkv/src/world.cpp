@@ -80,9 +80,16 @@ void  __cdecl CDefaultWorld::iso6392T(char* lang)
 }
 
 
+#ifdef _MSC_VER
+#define WORLD_THREAD_LOCAL __declspec(thread)
+#else
+#define WORLD_THREAD_LOCAL __thread
+#endif
+
 // interface
 CDefaultWorld   world_def;
 IWorld*         world_ptr = NULL;
+static WORLD_THREAD_LOCAL IWorld* world_thread_ptr = NULL;
 
 #ifdef my_world
 #undef my_world
@@ -91,9 +98,17 @@ IWorld*         world_ptr = NULL;
 extern "C"
 IWorld* my_world()
 {
+    if (NULL!=world_thread_ptr) return world_thread_ptr;
     return (NULL==world_ptr)?&world_def:world_ptr;
 }
 
+IWorld* set_thread_world(IWorld* new_world)
+{
+    IWorld* prev = world_thread_ptr;
+    world_thread_ptr = new_world;
+    return prev;
+}
+
 extern "C"
 bool __cdecl set_world(IWorld* new_world,int world_name)
 {
@@ -103,7 +118,9 @@ bool __cdecl set_world(IWorld* new_world,int world_name)
         return true;
     }
 
-    // reference libmkv
+    // reference libmkv, programs that link only the muxer (mkvbench) build
+    // without the ABI libraries
+#ifndef LGPL_WORLD_NO_ABI_REFS
     static volatile bool always_false = false;
     if (always_false)
     {
@@ -124,6 +141,7 @@ bool __cdecl set_world(IWorld* new_world,int world_name)
         i+=(int)LIBM_pow(i,41);
 #endif
     }
+#endif
 
     return false;
 }
@@ -128,6 +128,68 @@ class MATROSKA_DLL_API SimpleDataBuffer : public DataBuffer {
     SimpleDataBuffer(const SimpleDataBuffer & ToClone);
 };
 
+/*!
+  \brief The frames of a lace, found in the block data without copying it
+
+  The frame table points into the data given to Parse(). The first frames are
+  kept inline, longer laces use a table that grows once and is reused by the
+  next Parse(), so a KaxBlockLaces kept from block to block doesn't allocate.
+*/
+class MATROSKA_DLL_API KaxBlockLaces {
+  public:
+    struct Frame {
+      const binary * Buffer;
+      uint32         Size;
+    };
+
+    KaxBlockLaces() :Count(0), LaceHeadSize(0) {}
+
+    /*!
+      \param Data the block data following the flags of the block head
+      \param Lacing the lacing given by the flags
+      \return false when the lace doesn't match the size of the data
+    */
+    bool Parse(const binary * Data, uint32 Size, LacingType Lacing);
+
+    /*!
+      \brief Parse only the frame sizes, for readers that don't keep the whole block in memory
+      \param Head the start of the block data following the flags, HeadAvailable octets of it
+      \param Size the size of the whole block data
+      \return false when the lace doesn't match Size, or when it doesn't fit in HeadAvailable
+      \note the frame buffers are NULL, the first frame starts HeadSize() octets after Head
+    */
+    bool ParseHead(const binary * Head, uint32 HeadAvailable, uint32 Size, LacingType Lacing);
+
+    unsigned int NumberFrames() const {return Count;}
+    const Frame & operator[](unsigned int Index) const {assert(Index < Count); return Table()[Index];}
+    void Clear() {Count = 0; LaceHeadSize = 0;}
+
+    /*!
+      \return the size of the number of frames and of the frame sizes, the first frame follows
+    */
+    uint32 HeadSize() const {return LaceHeadSize;}
+
+    static const unsigned int MaxFrames = 256;
+    static const unsigned int InlineFrames = 16;
+
+  protected:
+    friend class KaxInternalBlock; // fills the sizes it reads from a stream
+
+    bool ParseSizes(const binary * Data, uint32 Available, uint32 Size, LacingType Lacing);
+    void SetBuffers(const binary * Data);
+    /*!
+      \brief the table for a lace of FrameNum frames, Count is left as it is
+    */
+    Frame * TableFor(unsigned int FrameNum);
+
+    const Frame * Table() const {return (Count > InlineFrames) ? &MoreFrames[0] : Frames;}
+
+    Frame              Frames[InlineFrames];
+    std::vector<Frame> MoreFrames; // the table of laces with more than InlineFrames frames
+    unsigned int       Count;
+    uint32             LaceHeadSize;
+};
+
 /*!
   \note the data is copied locally, it can be freed right away
 * /
@@ -232,8 +294,13 @@ class KaxInternalBlock : public EbmlBinary {
     */
     uint64 ReadInternalHead(IOCallback & input);
 
-    unsigned int NumberFrames() const { return (unsigned int)SizeList.size();}
-    DataBuffer & GetBuffer(unsigned int iIndex) {return *myBuffers[iIndex];}
+    unsigned int NumberFrames() const { return ReadLaces.NumberFrames();}
+    DataBuffer & GetBuffer(unsigned int iIndex) {UseReadFrames(); return *myBuffers[iIndex];}
+    /*!
+      \brief the frames read, without making a DataBuffer for each one like GetBuffer()
+      \note the frame buffers are NULL when the block was read with SCOPE_PARTIAL_DATA
+    */
+    const KaxBlockLaces & GetReadLaces() const {return ReadLaces;}
 
     bool AddFrame(const KaxTrackEntry & track, uint64 timecode, DataBuffer & buffer, LacingType lacing = LACING_AUTO, bool invisible = false);
 
@@ -242,6 +309,11 @@ class KaxInternalBlock : public EbmlBinary {
     */
     void ReleaseFrames();
 
+    /*!
+      \brief release all the frames and empty the frame list, so the Block can be filled again
+    */
+    void ClearFrames();
+
     void SetParent(KaxCluster & aParentCluster);
 
     /*!
@@ -269,7 +341,8 @@ class KaxInternalBlock : public EbmlBinary {
 
   protected:
     std::vector<DataBuffer *> myBuffers;
-    std::vector<int32>        SizeList;
+    KaxBlockLaces             ReadLaces;  ///< the frames read from the block data, only their sizes with SCOPE_PARTIAL_DATA
+    std::vector<DataBuffer>   ReadFrames; ///< ReadLaces as DataBuffers, first in myBuffers, made when they are asked for
     uint64     Timecode; // temporary timecode of the first frame, non scaled
     int16      LocalTimecode;
     bool       bLocalTimecodeUsed;
@@ -280,6 +353,12 @@ class KaxInternalBlock : public EbmlBinary {
 
     filepos_t RenderData(IOCallback & output, bool bForceRender, bool bSaveDefault = false);
 
+    void UseReadFrames() {
+      if (myBuffers.empty() && ReadLaces.NumberFrames() != 0)
+        MakeReadFrames();
+    }
+    void MakeReadFrames();
+
     KaxCluster * ParentCluster;
     bool       bIsSimple;
     bool       bIsKeyframe;
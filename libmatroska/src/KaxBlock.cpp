@@ -77,7 +77,6 @@ KaxInternalBlock::~KaxInternalBlock()
 
 KaxInternalBlock::KaxInternalBlock(const KaxInternalBlock & ElementToClone)
   :EbmlBinary(ElementToClone)
-  ,myBuffers(ElementToClone.myBuffers.size())
   ,Timecode(ElementToClone.Timecode)
   ,LocalTimecode(ElementToClone.LocalTimecode)
   ,bLocalTimecodeUsed(ElementToClone.bLocalTimecodeUsed)
@@ -86,10 +85,16 @@ KaxInternalBlock::KaxInternalBlock(const KaxInternalBlock & ElementToClone)
 {
   // add a clone of the list
   std::vector<DataBuffer *>::const_iterator Itr = ElementToClone.myBuffers.begin();
-  std::vector<DataBuffer *>::iterator myItr = myBuffers.begin();
   while (Itr != ElementToClone.myBuffers.end()) {
-    *myItr = (*Itr)->Clone();
-    ++Itr; ++myItr;
+    myBuffers.push_back((*Itr)->Clone());
+    ++Itr;
+  }
+
+  // or of the frames read, when they were never asked for as DataBuffers
+  const KaxBlockLaces & Laces = ElementToClone.ReadLaces;
+  if (myBuffers.empty() && Laces.NumberFrames() != 0 && Laces[0].Buffer != NULL) {
+    for (unsigned int Index = 0; Index < Laces.NumberFrames(); Index++)
+      myBuffers.push_back(DataBuffer(const_cast<binary *>(Laces[Index].Buffer), Laces[Index].Size).Clone());
   }
 }
 
@@ -267,7 +272,62 @@ filepos_t KaxBlockVirtual::UpdateSize(bool /* bSaveDefault */, bool /* bForceRen
 #endif // MATROSKA_VERSION
 
 /*!
-  \todo more optimisation is possible (render the Block head and don't copy the buffer in memory, care should be taken with the allocation of Data)
+  \brief Gathers the parts of a block to write them with IOCallback::writev()
+
+  The head and the lace sizes are copied to a small table, the frames are
+  only pointed to. A block with more parts than fit is written in several
+  calls.
+*/
+class KaxBlockVector {
+  public:
+    KaxBlockVector(IOCallback & aOutput)
+      :Output(aOutput), Count(0), TableUsed(0), bTableLast(false)
+    {}
+
+    void Copy(const binary * Data, size_t Size) {
+      assert(Size <= sizeof(Table));
+      if (TableUsed + Size > sizeof(Table) || (!bTableLast && Count == VectorSize))
+        Flush();
+      memcpy(Table + TableUsed, Data, Size);
+      if (bTableLast) {
+        Vector[Count - 1].Size += Size;
+      } else {
+        Vector[Count].Buffer = Table + TableUsed;
+        Vector[Count].Size = Size;
+        Count++;
+        bTableLast = true;
+      }
+      TableUsed += Size;
+    }
+
+    void Refer(const binary * Data, size_t Size) {
+      if (Count == VectorSize)
+        Flush();
+      Vector[Count].Buffer = Data;
+      Vector[Count].Size = Size;
+      Count++;
+      bTableLast = false;
+    }
+
+    void Flush() {
+      Output.writeFully(Vector, Count);
+      Count = 0;
+      TableUsed = 0;
+      bTableLast = false;
+    }
+
+  protected:
+    static const size_t VectorSize = 64;
+
+    IOCallback & Output;
+    IOVector Vector[VectorSize];
+    size_t Count;
+    binary Table[256];
+    size_t TableUsed;
+    bool bTableLast;
+};
+
+/*!
   \todo the actual timecode to write should be retrieved from the Cluster from here
 */
 filepos_t KaxInternalBlock::RenderData(IOCallback & output, bool /* bForceRender */, bool /* bSaveDefault */)
@@ -338,33 +398,34 @@ filepos_t KaxInternalBlock::RenderData(IOCallback & output, bool /* bForceRender
         assert(0);
     }
 
-    output.writeFully(BlockHead, 4 + ((TrackNumber > 0x80) ? 1 : 0));
+    KaxBlockVector Vector(output);
+    Vector.Copy(BlockHead, 4 + ((TrackNumber > 0x80) ? 1 : 0));
 
     binary tmpValue;
     switch (mLacing) {
       case LACING_XIPH:
         // number of laces
         tmpValue = myBuffers.size()-1;
-        output.writeFully(&tmpValue, 1);
+        Vector.Copy(&tmpValue, 1);
 
         // set the size of each member in the lace
         for (i=0; i<myBuffers.size()-1; i++) {
           tmpValue = 0xFF;
           uint16 tmpSize = myBuffers[i]->Size();
           while (tmpSize >= 0xFF) {
-            output.writeFully(&tmpValue, 1);
+            Vector.Copy(&tmpValue, 1);
             SetSize_(GetSize() + 1);
             tmpSize -= 0xFF;
           }
           tmpValue = binary(tmpSize);
-          output.writeFully(&tmpValue, 1);
+          Vector.Copy(&tmpValue, 1);
           SetSize_(GetSize() + 1);
         }
         break;
       case LACING_EBML:
         // number of laces
         tmpValue = myBuffers.size()-1;
-        output.writeFully(&tmpValue, 1);
+        Vector.Copy(&tmpValue, 1);
         {
           int64 _Size;
           int _CodedSize;
@@ -376,7 +437,7 @@ filepos_t KaxInternalBlock::RenderData(IOCallback & output, bool /* bForceRender
 
           // first size in the lace is not a signed
           CodedValueLength(_Size, _CodedSize, _FinalHead);
-          output.writeFully(_FinalHead, _CodedSize);
+          Vector.Copy(_FinalHead, _CodedSize);
           SetSize_(GetSize() + _CodedSize);
 
           // set the size of each member in the lace
@@ -384,7 +445,7 @@ filepos_t KaxInternalBlock::RenderData(IOCallback & output, bool /* bForceRender
             _Size = int64(myBuffers[i]->Size()) - int64(myBuffers[i-1]->Size());
             _CodedSize = CodedSizeLengthSigned(_Size, 0);
             CodedValueLengthSigned(_Size, _CodedSize, _FinalHead);
-            output.writeFully(_FinalHead, _CodedSize);
+            Vector.Copy(_FinalHead, _CodedSize);
             SetSize_(GetSize() + _CodedSize);
           }
         }
@@ -392,7 +453,7 @@ filepos_t KaxInternalBlock::RenderData(IOCallback & output, bool /* bForceRender
       case LACING_FIXED:
         // number of laces
         tmpValue = myBuffers.size()-1;
-        output.writeFully(&tmpValue, 1);
+        Vector.Copy(&tmpValue, 1);
         break;
       case LACING_NONE:
         break;
@@ -402,14 +463,177 @@ filepos_t KaxInternalBlock::RenderData(IOCallback & output, bool /* bForceRender
 
     // put the data of each frame
     for (i=0; i<myBuffers.size(); i++) {
-      output.writeFully(myBuffers[i]->Buffer(), myBuffers[i]->Size());
+      Vector.Refer(myBuffers[i]->Buffer(), myBuffers[i]->Size());
       SetSize_(GetSize() + myBuffers[i]->Size());
     }
+    Vector.Flush();
   }
 
   return GetSize();
 }
 
+/*!
+  \brief Reads an EBML lace size, the length comes from the first octet
+  \param Length set to the coded length, 0 when it's invalid or doesn't fit in Size
+  \note unlike ReadCodedSizeValue() there's no bit by bit loop or unknown size
+*/
+static inline uint64 ReadLaceSize(const binary * Data, uint32 Size, uint32 & Length)
+{
+  // length of the coded size by the high nibble of the first octet, or the low one + 4
+  static const uint8 NibbleLength[16] = { 0, 4, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+  binary First = Data[0];
+  if (First & 0xF0) {
+    Length = NibbleLength[First >> 4];
+  } else {
+    Length = First ? NibbleLength[First] + 4 : 0;
+  }
+  if (Length == 0 || Length > Size) {
+    Length = 0;
+    return 0;
+  }
+
+  switch (Length) {
+    case 1:
+      return First & 0x7F;
+    case 2:
+      return (uint64(First & 0x3F) << 8) | Data[1];
+  }
+
+  uint64 Result = First & (0xFF >> Length);
+  for (uint32 i = 1; i < Length; i++)
+    Result = (Result << 8) | Data[i];
+  return Result;
+}
+
+bool KaxBlockLaces::Parse(const binary * Data, uint32 Size, LacingType Lacing)
+{
+  if (!ParseSizes(Data, Size, Size, Lacing))
+    return false;
+  SetBuffers(Data + LaceHeadSize);
+  return true;
+}
+
+bool KaxBlockLaces::ParseHead(const binary * Head, uint32 HeadAvailable, uint32 Size, LacingType Lacing)
+{
+  if (!ParseSizes(Head, (HeadAvailable < Size) ? HeadAvailable : Size, Size, Lacing))
+    return false;
+  SetBuffers(NULL);
+  return true;
+}
+
+KaxBlockLaces::Frame * KaxBlockLaces::TableFor(unsigned int FrameNum)
+{
+  if (FrameNum <= InlineFrames)
+    return Frames;
+  // grown once to the largest lace, reused afterwards
+  if (MoreFrames.size() < MaxFrames)
+    MoreFrames.resize(MaxFrames);
+  return &MoreFrames[0];
+}
+
+void KaxBlockLaces::SetBuffers(const binary * Buffer)
+{
+  Frame * Table = (Count > InlineFrames) ? &MoreFrames[0] : Frames;
+  for (unsigned int Index = 0; Index < Count; Index++) {
+    Table[Index].Buffer = Buffer;
+    if (Buffer != NULL)
+      Buffer += Table[Index].Size;
+  }
+}
+
+/*!
+  \brief Fills the frame sizes, Count and LaceHeadSize
+  \param Available the octets of Data that can be read, the lace head has to fit in them
+*/
+bool KaxBlockLaces::ParseSizes(const binary * Data, uint32 Available, uint32 Size, LacingType Lacing)
+{
+  Count = 0;
+  LaceHeadSize = 0;
+
+  if (Lacing == LACING_NONE) {
+    Frames[0].Size = Size;
+    Count = 1;
+    return true;
+  }
+
+  if (Available == 0)
+    return false;
+
+  unsigned int FrameNum = unsigned(Data[0]) + 1;
+  uint32 Pos = 1;
+  uint64 Known = 0; // sizes of the frames but the last one
+  unsigned int Index;
+
+  Frame * Table = TableFor(FrameNum);
+
+  switch (Lacing) {
+    case LACING_XIPH:
+      for (Index = 0; Index < FrameNum - 1; Index++) {
+        uint64 FrameSize = 0;
+        binary Value;
+        do {
+          if (Pos >= Available)
+            return false;
+          Value = Data[Pos++];
+          FrameSize += Value;
+        } while (Value == 0xFF);
+        if (FrameSize > Size)
+          return false;
+        Table[Index].Size = uint32(FrameSize);
+        Known += FrameSize;
+      }
+      break;
+    case LACING_EBML:
+      {
+        // the first size is always there, the others are differences to the previous one
+        uint32 Length;
+        if (Pos >= Available)
+          return false;
+        int64 FrameSize = int64(ReadLaceSize(Data + Pos, Available - Pos, Length));
+        Pos += Length;
+        for (Index = 0; ; ) {
+          if (Length == 0 || FrameSize <= 0 || FrameSize > int64(Size))
+            return false;
+          Table[Index].Size = uint32(FrameSize);
+          if (++Index >= FrameNum - 1)
+            break;
+          if (Pos >= Available)
+            return false;
+          uint64 Coded = ReadLaceSize(Data + Pos, Available - Pos, Length);
+          FrameSize += int64(Coded) - ((int64(1) << (7 * Length - 1)) - 1);
+          Pos += Length;
+        }
+        if (FrameNum == 1) {
+          // a single frame still has its size coded
+          if (Table[0].Size != Size - Pos)
+            return false;
+          break;
+        }
+        for (Index = 0; Index < FrameNum - 1; Index++)
+          Known += Table[Index].Size;
+      }
+      break;
+    case LACING_FIXED:
+      if ((Size - Pos) % FrameNum != 0)
+        return false;
+      for (Index = 0; Index < FrameNum - 1; Index++)
+        Table[Index].Size = (Size - Pos) / FrameNum;
+      Known = uint64(Size - Pos) - (Size - Pos) / FrameNum;
+      break;
+    default:
+      return false;
+  }
+
+  if (Known > Size - Pos)
+    return false;
+  Table[FrameNum - 1].Size = uint32(Size - Pos - Known);
+
+  LaceHeadSize = Pos;
+  Count = FrameNum;
+  return true;
+}
+
 #ifndef EBML_NO_READ
 uint64 KaxInternalBlock::ReadInternalHead(IOCallback & input)
 {
@@ -445,7 +669,8 @@ uint64 KaxInternalBlock::ReadInternalHead(IOCallback & input)
 }
 
 /*!
-  \todo better zero copy handling
+  \note the frames point into the block data, which is not copied when the
+  input can read it in place (see IOCallback::readInPlace)
 */
 filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
 {
@@ -492,94 +717,11 @@ filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
       mInvisible = (Flags & 0x08) >> 3;
       mLacing = LacingType((Flags & 0x06) >> 1);
 
-      // put all Frames in the list
-      if (mLacing == LACING_NONE) {
-        FirstFrameLocation += Mem.GetPosition();
-        DataBuffer * soloFrame = new DataBuffer(BufferStart + Mem.GetPosition(), GetSize() - BlockHeadSize);
-        myBuffers.push_back(soloFrame);
-        SizeList.resize(1);
-        SizeList[0] = GetSize() - BlockHeadSize;
-      } else {
-        // read the number of frames in the lace
-        uint32 LastBufferSize = GetSize() - BlockHeadSize - 1; // 1 for number of frame
-        uint8 FrameNum = Mem.GetUInt8(); // number of frames in the lace - 1
-        // read the list of frame sizes
-        uint8 Index;
-        int32 FrameSize;
-        uint32 SizeRead;
-        uint64 SizeUnknown;
-
-        SizeList.resize(FrameNum + 1);
-
-        switch (mLacing) {
-          case LACING_XIPH:
-            for (Index=0; Index<FrameNum; Index++) {
-              // get the size of the frame
-              FrameSize = 0;
-              uint8 Value;
-              do {
-                Value = Mem.GetUInt8();
-                FrameSize += Value;
-                LastBufferSize--;
-              } while (Value == 0xFF);
-              SizeList[Index] = FrameSize;
-              LastBufferSize -= FrameSize;
-            }
-            SizeList[Index] = LastBufferSize;
-            break;
-          case LACING_EBML:
-            SizeRead = LastBufferSize;
-            FrameSize = ReadCodedSizeValue(BufferStart + Mem.GetPosition(), SizeRead, SizeUnknown);
-            if (!FrameSize || (static_cast<uint32>(FrameSize + SizeRead) > LastBufferSize))
-              throw SafeReadIOCallback::EndOfStreamX(SizeRead);
-            SizeList[0] = FrameSize;
-            Mem.Skip(SizeRead);
-            LastBufferSize -= FrameSize + SizeRead;
-
-            for (Index=1; Index<FrameNum; Index++) {
-              // get the size of the frame
-              SizeRead = LastBufferSize;
-              FrameSize += ReadCodedSizeSignedValue(BufferStart + Mem.GetPosition(), SizeRead, SizeUnknown);
-              if (!FrameSize || (static_cast<uint32>(FrameSize + SizeRead) > LastBufferSize))
-                throw SafeReadIOCallback::EndOfStreamX(SizeRead);
-              SizeList[Index] = FrameSize;
-              Mem.Skip(SizeRead);
-              LastBufferSize -= FrameSize + SizeRead;
-            }
-            if (Index <= FrameNum) // Safety check if FrameNum == 0
-              SizeList[Index] = LastBufferSize;
-            break;
-          case LACING_FIXED:
-            for (Index=0; Index<=FrameNum; Index++) {
-              // get the size of the frame
-              SizeList[Index] = LastBufferSize / (FrameNum + 1);
-            }
-            break;
-          default: // other lacing not supported
-            assert(0);
-        }
-
-        FirstFrameLocation += Mem.GetPosition();
-
-        for (Index=0; Index<=FrameNum; Index++) {
-          DataBuffer * lacedFrame = new DataBuffer(BufferStart + Mem.GetPosition(), SizeList[Index]);
-          myBuffers.push_back(lacedFrame);
-          Mem.Skip(SizeList[Index]);
-        }
-      }
-
-      binary *BufferEnd = BufferStart + GetSize();
-      size_t NumFrames  = myBuffers.size();
-
-      // Sanity checks for frame pointers and boundaries.
-      for (size_t Index = 0; Index < NumFrames; ++Index) {
-        binary *FrameStart  = myBuffers[Index]->Buffer();
-        binary *FrameEnd    = FrameStart + myBuffers[Index]->Size();
-        binary *ExpectedEnd = (Index + 1) < NumFrames ? myBuffers[Index + 1]->Buffer() : BufferEnd;
-
-        if ((FrameStart < BufferStart) || (FrameEnd > BufferEnd) || (FrameEnd != ExpectedEnd))
-          throw SafeReadIOCallback::EndOfStreamX(0);
-      }
+      // the frames point into the data, DataBuffers are only made for GetBuffer()
+      ClearFrames();
+      if (!ReadLaces.Parse(BufferStart + Mem.GetPosition(), GetSize() - BlockHeadSize, mLacing))
+        throw SafeReadIOCallback::EndOfStreamX(0);
+      FirstFrameLocation += Mem.GetPosition() + ReadLaces.HeadSize();
 
       SetValueIsSet();
     } else if (ReadFully == SCOPE_PARTIAL_DATA) {
@@ -626,7 +768,8 @@ filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
 
       FirstFrameLocation += cursor - _TempHead;
 
-      // put all Frames in the list
+      // put the sizes of all Frames in the list, the frames stay in the input
+      ClearFrames();
       if (mLacing != LACING_NONE) {
         // read the number of frames in the lace
         uint32 LastBufferSize = GetSize() - BlockHeadSize - 1; // 1 for number of frame
@@ -637,7 +780,7 @@ filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
         uint32 SizeRead;
         uint64 SizeUnknown;
 
-        SizeList.resize(FrameNum + 1);
+        KaxBlockLaces::Frame * SizeList = ReadLaces.TableFor(FrameNum + 1);
 
         switch (mLacing) {
           case LACING_XIPH:
@@ -653,17 +796,17 @@ filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
               } while (_TempHead[0] == 0xFF);
 
               FirstFrameLocation++;
-              SizeList[Index] = FrameSize;
+              SizeList[Index].Size = FrameSize;
               LastBufferSize -= FrameSize;
             }
-            SizeList[Index] = LastBufferSize;
+            SizeList[Index].Size = LastBufferSize;
             break;
           case LACING_EBML:
             SizeRead = LastBufferSize;
             cursor = _tmpBuf = new binary[FrameNum*4]; /// \warning assume the mean size will be coded in less than 4 bytes
             Result += input.read(cursor, FrameNum*4);
             FrameSize = ReadCodedSizeValue(cursor, SizeRead, SizeUnknown);
-            SizeList[0] = FrameSize;
+            SizeList[0].Size = FrameSize;
             cursor += SizeRead;
             LastBufferSize -= FrameSize + SizeRead;
 
@@ -671,29 +814,31 @@ filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
               // get the size of the frame
               SizeRead = LastBufferSize;
               FrameSize += ReadCodedSizeSignedValue(cursor, SizeRead, SizeUnknown);
-              SizeList[Index] = FrameSize;
+              SizeList[Index].Size = FrameSize;
               cursor += SizeRead;
               LastBufferSize -= FrameSize + SizeRead;
             }
 
             FirstFrameLocation += cursor - _tmpBuf;
 
-            SizeList[Index] = LastBufferSize;
+            SizeList[Index].Size = LastBufferSize;
             delete [] _tmpBuf;
             break;
           case LACING_FIXED:
             for (Index=0; Index<=FrameNum; Index++) {
               // get the size of the frame
-              SizeList[Index] = LastBufferSize / (FrameNum + 1);
+              SizeList[Index].Size = LastBufferSize / (FrameNum + 1);
             }
             break;
           default: // other lacing not supported
             assert(0);
         }
+        ReadLaces.Count = FrameNum + 1;
       } else {
-        SizeList.resize(1);
-        SizeList[0] = GetSize() - BlockHeadSize;
+        ReadLaces.Frames[0].Size = GetSize() - BlockHeadSize;
+        ReadLaces.Count = 1;
       }
+      ReadLaces.SetBuffers(NULL);
       SetValueIsSet(false);
       Result = GetSize();
     } else {
@@ -704,9 +849,12 @@ filepos_t KaxInternalBlock::ReadData(IOCallback & input, ScopeMode ReadFully)
   } catch (SafeReadIOCallback::EndOfStreamX &) {
     SetValueIsSet(false);
 
-    std::memset(EbmlBinary::GetBuffer(), 0, GetSize());
+    // data read in place belongs to the input and is read-only
+    if (!IsDataInPlace())
+      std::memset(EbmlBinary::GetBuffer(), 0, GetSize());
     myBuffers.clear();
-    SizeList.clear();
+    ReadFrames.clear();
+    ReadLaces.Clear();
     Timecode           = 0;
     LocalTimecode      = 0;
     TrackNumber        = 0;
@@ -860,12 +1008,35 @@ void KaxInternalBlock::ReleaseFrames()
   for (i=myBuffers.size()-1; i>=0; i--) {
     if (myBuffers[i] != NULL) {
       myBuffers[i]->FreeBuffer(*myBuffers[i]);
-      delete myBuffers[i];
+      if (size_t(i) >= ReadFrames.size())
+        delete myBuffers[i];
       myBuffers[i] = NULL;
     }
   }
 }
 
+void KaxInternalBlock::ClearFrames()
+{
+  ReleaseFrames();
+  myBuffers.clear();
+  ReadFrames.clear();
+  ReadLaces.Clear();
+}
+
+void KaxInternalBlock::MakeReadFrames()
+{
+  unsigned int Index, NumFrames = ReadLaces.NumberFrames();
+  // with SCOPE_PARTIAL_DATA there is nothing to point to
+  if (ReadLaces[0].Buffer == NULL)
+    return;
+  ReadFrames.reserve(NumFrames);
+  myBuffers.reserve(NumFrames);
+  for (Index = 0; Index < NumFrames; Index++)
+    ReadFrames.push_back(DataBuffer(const_cast<binary *>(ReadLaces[Index].Buffer), ReadLaces[Index].Size));
+  for (Index = 0; Index < NumFrames; Index++)
+    myBuffers.push_back(&ReadFrames[Index]);
+}
+
 void KaxBlockGroup::SetBlockDuration(uint64 TimeLength)
 {
   assert(ParentTrack != NULL);
@@ -914,12 +1085,12 @@ int64 KaxInternalBlock::GetDataPosition(size_t FrameNumber)
 {
   int64 _Result = -1;
 
-  if (ValueIsSet() && FrameNumber < SizeList.size()) {
+  if (ValueIsSet() && FrameNumber < ReadLaces.NumberFrames()) {
     _Result = FirstFrameLocation;
 
     size_t _Idx = 0;
     while(FrameNumber--) {
-      _Result += SizeList[_Idx++];
+      _Result += ReadLaces[_Idx++].Size;
     }
   }
 
@@ -930,8 +1101,8 @@ int64 KaxInternalBlock::GetFrameSize(size_t FrameNumber)
 {
   int64 _Result = -1;
 
-  if (/*bValueIsSet &&*/ FrameNumber < SizeList.size()) {
-    _Result = SizeList[FrameNumber];
+  if (/*bValueIsSet &&*/ FrameNumber < ReadLaces.NumberFrames()) {
+    _Result = ReadLaces[FrameNumber].Size;
   }
 
   return _Result;
@@ -1066,7 +1237,7 @@ void KaxBlockBlob::SetBlockGroup( KaxBlockGroup &BlockRef )
 #ifndef EBML_NO_READ
 filepos_t KaxBlockVirtual::ReadData(IOCallback & input, ScopeMode /* ReadFully */)
 {
-  input.setFilePointer(SizePosition + CodedSizeLength(Size, SizeLength, bSizeIsFinite) + Size, seek_beginning);
+  input.setFilePointer(GetEndPosition(), seek_beginning);
   return GetSize();
 }
 #endif // EBML_NO_READ